@@ -0,0 +1,189 @@
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "analysisfile.h"
+
+// Layout: header, padded to 128 bytes | one status byte per unit, padded to 64 bytes | one record per unit.
+static constexpr size_t header_bytes = 128;
+static_assert(sizeof(AnalysisHeader) <= header_bytes, "AnalysisHeader doesn't fit");
+
+static size_t align64(size_t n)
+{
+    return (n + 63) & ~static_cast<size_t>(63);
+}
+
+AnalysisFile::AnalysisFile(const char* path, AnalysisHeader header, int _units, int _blocks)
+    : data(nullptr), size(0), units(_units), blocks(_blocks)
+{
+    memcpy(header.magic, "BFRA", 4);
+    header.version = current_version;
+
+    record_bytes = (static_cast<size_t>(blocks) + 1) / 2;
+    const size_t status_offset = header_bytes;
+    const size_t records_offset = status_offset + align64(units);
+    const size_t expected_size = records_offset + record_bytes * units;
+    const std::string name(path);
+
+    bool created;
+
+#ifdef _WIN32
+    mapping = nullptr;
+    file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        throw std::runtime_error("cannot open analysis_file " + name + ".");
+
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file, &file_size))
+    {
+        close();
+        throw std::runtime_error("cannot read the size of analysis_file " + name + ".");
+    }
+
+    size = static_cast<size_t>(file_size.QuadPart);
+    created = (size == 0);
+    if (created)
+        size = expected_size;
+
+    //the mapping grows a new file to its full size, filled with zeros
+    if (size == expected_size)
+    {
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE, static_cast<DWORD>(static_cast<uint64_t>(size) >> 32), static_cast<DWORD>(size), nullptr);
+        if (mapping)
+            data = static_cast<uint8_t*>(MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size));
+    }
+#else
+    fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd == -1)
+        throw std::runtime_error("cannot open analysis_file " + name + ".");
+
+    struct stat st;
+    if (fstat(fd, &st))
+    {
+        close();
+        throw std::runtime_error("cannot read the size of analysis_file " + name + ".");
+    }
+
+    size = static_cast<size_t>(st.st_size);
+    created = (size == 0);
+    if (created)
+    {
+        //a sparse file, filled with zeros
+        if (ftruncate(fd, static_cast<off_t>(expected_size)))
+        {
+            close();
+            throw std::runtime_error("cannot resize analysis_file " + name + ".");
+        }
+
+        size = expected_size;
+    }
+
+    if (size == expected_size)
+    {
+        void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (p != MAP_FAILED)
+            data = static_cast<uint8_t*>(p);
+    }
+#endif
+
+    if (size != expected_size)
+    {
+        close();
+        throw std::runtime_error("analysis_file " + name + " has the wrong size, it was written for a different clip or it is damaged.");
+    }
+
+    if (!data)
+    {
+        close();
+        throw std::runtime_error("cannot map analysis_file " + name + ".");
+    }
+
+    if (created)
+        memcpy(data, &header, sizeof(header));
+    else if (memcmp(data, &header, 4 + sizeof(header.version)))
+    {
+        close();
+        throw std::runtime_error("analysis_file " + name + " isn't a Bifrost analysis file or was written by a different version.");
+    }
+    else if (memcmp(data, &header, sizeof(header)))
+    {
+        close();
+        throw std::runtime_error("analysis_file " + name + " was written for a different clip or with different settings.");
+    }
+
+    status = data + status_offset;
+    records = data + records_offset;
+
+    state = std::make_unique<std::atomic<uint8_t>[]>(units);
+    for (int i = 0; i < units; ++i)
+        state[i].store((status[i] == 1) ? 2 : 0, std::memory_order_relaxed);
+}
+
+AnalysisFile::~AnalysisFile()
+{
+    close();
+}
+
+void AnalysisFile::close()
+{
+#ifdef _WIN32
+    if (data)
+        UnmapViewOfFile(data);
+    if (mapping)
+        CloseHandle(mapping);
+    if (file != INVALID_HANDLE_VALUE)
+        CloseHandle(file);
+
+    mapping = nullptr;
+    file = INVALID_HANDLE_VALUE;
+#else
+    if (data)
+        munmap(data, size);
+    if (fd != -1)
+        ::close(fd);
+
+    fd = -1;
+#endif
+
+    data = nullptr;
+}
+
+bool AnalysisFile::read(int unit, uint8_t* classes) const
+{
+    if (state[unit].load(std::memory_order_acquire) != 2)
+        return false;
+
+    const uint8_t* record = records + record_bytes * unit;
+
+    for (int i = 0; i < blocks; ++i)
+        classes[i] = (record[i >> 1] >> ((i & 1) * 4)) & 15;
+
+    return true;
+}
+
+void AnalysisFile::write(int unit, const uint8_t* classes)
+{
+    uint8_t expected = 0;
+    if (!state[unit].compare_exchange_strong(expected, 1, std::memory_order_acq_rel))
+        return;
+
+    uint8_t* record = records + record_bytes * unit;
+
+    for (int i = 0; i < blocks; i += 2)
+        record[i >> 1] = (classes[i] & 15) | ((i + 1 < blocks) ? (classes[i + 1] & 15) << 4 : 0);
+
+    //the record is complete before it is marked, a run that is interrupted leaves the unit missing
+    status[unit] = 1;
+    state[unit].store(2, std::memory_order_release);
+}
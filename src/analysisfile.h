@@ -0,0 +1,68 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+// Everything the block classification depends on. A file written with a different header is rejected.
+struct AnalysisHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t num_frames;
+    uint32_t fields;
+    uint32_t bits;
+    uint32_t block_width;
+    uint32_t block_height;
+    uint32_t blocks_x;
+    uint32_t blocks_y;
+    uint32_t offset;
+    float luma_thresh;
+    float relativeframediff;
+    uint32_t superblock;
+    uint32_t roi[4]; // blocks of the region of interest: left, top, right, bottom
+    uint32_t scenechange;
+    uint32_t motion_scale;
+};
+
+// Memory-mapped record of the block classes of every unit (frame or field), 4 bits per block.
+// Units that haven't been processed yet are marked as missing, so the file can be filled in any order and by several runs.
+// Errors are reported with std::runtime_error.
+class AnalysisFile
+{
+    static constexpr uint32_t current_version = 2;
+
+    uint8_t* data;
+    size_t size;
+    uint8_t* status;
+    uint8_t* records;
+    size_t record_bytes;
+    int units;
+    int blocks;
+    // 0: missing, 1: being written by this process, 2: recorded
+    std::unique_ptr<std::atomic<uint8_t>[]> state;
+
+#ifdef _WIN32
+    void* file;
+    void* mapping;
+#else
+    int fd;
+#endif
+
+    void close();
+
+public:
+    // header's magic and version are filled in here.
+    AnalysisFile(const char* path, AnalysisHeader header, int units, int blocks);
+    ~AnalysisFile();
+
+    AnalysisFile(const AnalysisFile&) = delete;
+    AnalysisFile& operator=(const AnalysisFile&) = delete;
+
+    // Copies the classes of unit into classes (one per byte) if they were recorded.
+    bool read(int unit, uint8_t* classes) const;
+    // Records the classes of unit unless another thread already did it.
+    void write(int unit, const uint8_t* classes);
+};
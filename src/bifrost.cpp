@@ -1,494 +1,1989 @@
+#include <cmath>
+#include <cstdio>
 #include <cstring>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <limits>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <vector>
 
 #include "avisynth.h"
+#include "analysisfile.h"
+#include "bifrost.h"
+#include "threadpool.h"
 
-enum BlendDirection
+// Blocks outside the region of interest, their chroma is copied from the current frame.
+static constexpr uint8_t passthrough_class = msFallback | (bdNone << 2);
+
+// Stripes of block rows handed to the worker threads are sized so that all the planes they touch fit in this.
+static constexpr size_t stripe_cache_size = 256 * 1024;
+
+// Luma planes from this size on are copied with non-temporal stores. A smaller one would likely still be cached when the next filter reads it.
+static constexpr size_t stream_plane_size = 4 * 1024 * 1024;
+
+template <typename T>
+void processBlockRow_c(const BlockRow& row)
+{
+    processBlockRow<T, BlockRowOps_c<T>>(row);
+}
+
+template void processBlockRow_c<uint8_t>(const BlockRow& row);
+template void processBlockRow_c<uint16_t>(const BlockRow& row);
+template void processBlockRow_c<float>(const BlockRow& row);
+
+template <typename T>
+BlockRowFunction blockRowFunction_c(int block_width_uv, int block_height_uv)
+{
+    return selectBlockRow<T, BlockRowOps_c<T>>(block_width_uv, block_height_uv);
+}
+
+template BlockRowFunction blockRowFunction_c<uint8_t>(int block_width_uv, int block_height_uv);
+template BlockRowFunction blockRowFunction_c<uint16_t>(int block_width_uv, int block_height_uv);
+template BlockRowFunction blockRowFunction_c<float>(int block_width_uv, int block_height_uv);
+
+template <typename T>
+static float blockLumaDiff(const T* src1_y, const T* src2_y, int block_width, int block_height, int src1_stride_y, int src2_stride_y)
+{
+    int diff = 0;
+
+    for (int y = 0; y < block_height; ++y)
+    {
+        for (int x = 0; x < block_width; ++x)
+        {
+            diff += abs(src1_y[x] - src2_y[x]);
+        }
+
+        src1_y += src1_stride_y;
+        src2_y += src2_stride_y;
+    }
+
+    return static_cast<float>(diff) / (block_width * block_height);
+}
+
+template <typename T>
+void lumaDiffRow_c(const void* src1_y_, const void* src2_y_, int src1_stride_y, int src2_stride_y, int block_width, int block_height, int blocks_x, float* diff)
+{
+    const T* src1_y = reinterpret_cast<const T*>(src1_y_);
+    const T* src2_y = reinterpret_cast<const T*>(src2_y_);
+
+    //float sums depend on the order, every column is summed top to bottom like in the SIMD versions,
+    //a chunk of columns at a time
+    if constexpr (std::is_same<T, float>::value)
+    {
+        const int width = block_width * blocks_x;
+        constexpr int step = 64;
+        float colsum[step];
+        LumaDiffAccumulator<float> acc(diff, block_width, block_height);
+
+        for (int x0 = 0; x0 < width; x0 += step)
+        {
+            const int count = std::min(step, width - x0);
+            const T* s1 = src1_y + x0;
+            const T* s2 = src2_y + x0;
+
+            for (int i = 0; i < count; ++i)
+                colsum[i] = 0.0f;
+
+            for (int y = 0; y < block_height; ++y)
+            {
+                for (int i = 0; i < count; ++i)
+                    colsum[i] += std::abs(s1[i] - s2[i]);
+
+                s1 += src1_stride_y;
+                s2 += src2_stride_y;
+            }
+
+            for (int i = 0; i < count; ++i)
+                acc.add(colsum[i]);
+        }
+    }
+    else
+    {
+        for (int x = 0; x < blocks_x; ++x)
+            diff[x] = blockLumaDiff<T>(src1_y + block_width * static_cast<int64_t>(x), src2_y + block_width * static_cast<int64_t>(x), block_width, block_height, src1_stride_y, src2_stride_y);
+    }
+}
+
+template void lumaDiffRow_c<uint8_t>(const void* src1_y, const void* src2_y, int src1_stride_y, int src2_stride_y, int block_width, int block_height, int blocks_x, float* diff);
+template void lumaDiffRow_c<uint16_t>(const void* src1_y, const void* src2_y, int src1_stride_y, int src2_stride_y, int block_width, int block_height, int blocks_x, float* diff);
+template void lumaDiffRow_c<float>(const void* src1_y, const void* src2_y, int src1_stride_y, int src2_stride_y, int block_width, int block_height, int blocks_x, float* diff);
+
+template <typename T, int Scale>
+void decimateRow_c(const void* src_y, int src_stride_y, void* dst, int width)
+{
+    decimatePixels<T, Scale>(reinterpret_cast<const T*>(src_y), src_stride_y, reinterpret_cast<T*>(dst), 0, width);
+}
+
+template void decimateRow_c<uint8_t, 2>(const void* src_y, int src_stride_y, void* dst, int width);
+template void decimateRow_c<uint8_t, 4>(const void* src_y, int src_stride_y, void* dst, int width);
+template void decimateRow_c<uint16_t, 2>(const void* src_y, int src_stride_y, void* dst, int width);
+template void decimateRow_c<uint16_t, 4>(const void* src_y, int src_stride_y, void* dst, int width);
+template void decimateRow_c<float, 2>(const void* src_y, int src_stride_y, void* dst, int width);
+template void decimateRow_c<float, 4>(const void* src_y, int src_stride_y, void* dst, int width);
+
+uint64_t hashPlane_c(const uint8_t* srcp, int pitch, int row_size, int height)
+{
+    uint64_t acc[4];
+    uint8_t tail[hash_stripe];
+    hashInit(acc);
+
+    for (int y = 0; y < height; ++y)
+    {
+        int x = 0, s = 0;
+        for (; x + hash_stripe <= row_size; x += hash_stripe, ++s)
+        {
+            hashStripe(acc, srcp + x, hash_keys.stripe[s & 15]);
+            if ((s & 15) == 15)
+                hashScramble(acc);
+        }
+
+        if (x < row_size)
+            hashStripe(acc, hashTail(srcp, x, row_size, tail), hash_keys.stripe[s & 15]);
+
+        hashScramble(acc);
+        srcp += pitch;
+    }
+
+    return hashFinish(acc, row_size, height);
+}
+
+// Per-block luma differences of frame (or field) pairs. Unit n's ldnext is unit n+offset's ldprev,
+// so every pair is computed once and shared by the neighbouring GetFrame calls.
+// The decimated luma planes of motion_scale are kept the same way with the key (unit, unit).
+template <typename V>
+class SharedCache
+{
+public:
+    typedef std::shared_ptr<const V> Map;
+
+private:
+    typedef std::pair<int, int> Key;
+
+    struct Entry
+    {
+        std::shared_future<Map> map;
+        std::list<Key>::iterator lru;
+    };
+
+    std::mutex mtx;
+    std::map<Key, Entry> entries;
+    std::list<Key> lru;
+    size_t max_entries;
+
+public:
+    SharedCache(size_t max_bytes, size_t map_bytes)
+        : max_entries(std::max<size_t>(max_bytes / std::max<size_t>(map_bytes, 1), 8))
+    {
+    }
+
+    template <typename F>
+    Map get(int a, int b, F compute)
+    {
+        const Key key(a, b);
+        std::promise<Map> promise;
+        std::unique_lock<std::mutex> lock(mtx);
+
+        auto it = entries.find(key);
+        if (it != entries.end())
+        {
+            lru.splice(lru.begin(), lru, it->second.lru);
+            std::shared_future<Map> map = it->second.map;
+            lock.unlock();
+
+            // Waits if another thread is still computing this pair.
+            return map.get();
+        }
+
+        lru.push_front(key);
+        entries[key] = { promise.get_future().share(), lru.begin() };
+
+        while (entries.size() > max_entries)
+        {
+            entries.erase(lru.back());
+            lru.pop_back();
+        }
+
+        lock.unlock();
+
+        try
+        {
+            Map map = std::make_shared<const V>(compute());
+            promise.set_value(map);
+            return map;
+        }
+        catch (...)
+        {
+            promise.set_exception(std::current_exception());
+
+            lock.lock();
+            it = entries.find(key);
+            if (it != entries.end())
+            {
+                lru.erase(it->second.lru);
+                entries.erase(it);
+            }
+
+            throw;
+        }
+    }
+};
+
+typedef SharedCache<std::vector<float>> LumaDiffCache;
+typedef SharedCache<std::vector<uint8_t>> DecimatedCache;
+
+// The planes of a frame, or of one of its fields when the pitches are doubled.
+template <typename P>
+struct Planes
+{
+    P* ptr[3];
+    int pitch[3];
+};
+
+typedef Planes<const uint8_t> SrcPlanes;
+typedef Planes<uint8_t> DstPlanes;
+
+// Statistics of one output frame, summed over its fields and the threads. Times are in nanoseconds.
+struct FrameStats
+{
+    int64_t blocks[4];      // blocks of every MaskSource
+    int64_t blocks_skipped; // blocks outside the region of interest
+    int64_t mask_pixels[3]; // blended pixels of every BlendDirection
+    int64_t lumadiff_ns;
+    int64_t mask_ns;
+    int64_t blend_ns;
+    int64_t dup_hits;       // frames copied from the dup_cache
+    int64_t dup_misses;
+
+    void add(const FrameStats& other)
+    {
+        for (int i = 0; i < 4; ++i)
+            blocks[i] += other.blocks[i];
+        blocks_skipped += other.blocks_skipped;
+        for (int i = 0; i < 3; ++i)
+            mask_pixels[i] += other.mask_pixels[i];
+
+        lumadiff_ns += other.lumadiff_ns;
+        mask_ns += other.mask_ns;
+        blend_ns += other.blend_ns;
+        dup_hits += other.dup_hits;
+        dup_misses += other.dup_misses;
+    }
+};
+
+// Output frames of dup_cache, keyed by the hash of the source frames n-1..n+1 they always depend on. The least recently used ones are dropped.
+class ResultCache
+{
+public:
+    struct Result
+    {
+        PVideoFrame frame;
+        FrameStats stats;
+        bool outer_read[2];     // frames n-2 and n+2 were read by some block
+        uint64_t outer_hash[2];
+    };
+
+private:
+    typedef std::list<std::pair<uint64_t, Result>> List;
+
+    std::mutex mtx;
+    std::map<uint64_t, List::iterator> entries;
+    List lru;
+    size_t max_entries;
+
+public:
+    ResultCache(size_t _max_entries) : max_entries(_max_entries) {}
+
+    bool find(uint64_t key, Result& result)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+
+        auto it = entries.find(key);
+        if (it == entries.end())
+            return false;
+
+        lru.splice(lru.begin(), lru, it->second);
+        result = it->second->second;
+        return true;
+    }
+
+    void insert(uint64_t key, const Result& result)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+
+        //an entry of other frames two steps away
+        auto it = entries.find(key);
+        if (it != entries.end())
+        {
+            lru.erase(it->second);
+            entries.erase(it);
+        }
+
+        lru.emplace_front(key, result);
+        entries[key] = lru.begin();
+
+        while (entries.size() > max_entries)
+        {
+            entries.erase(lru.back().first);
+            lru.pop_back();
+        }
+    }
+};
+
+// Aligned scratch memory of the stripes, sized once. Every running stripe holds a block, the blocks are allocated for the threads that
+// run at the same time and reused by the next frames.
+class ScratchArenas
+{
+    struct Free
+    {
+        void operator()(uint8_t* p) const { ::operator delete[](p, std::align_val_t(64)); }
+    };
+
+    typedef std::unique_ptr<uint8_t[], Free> Block;
+
+    size_t size;
+    std::mutex mtx;
+    std::vector<Block> free_blocks;
+
+    Block allocate() { return Block(static_cast<uint8_t*>(::operator new[](size, std::align_val_t(64)))); }
+
+public:
+    // Gives its block back when the stripe is done.
+    class Lease
+    {
+        ScratchArenas* arenas;
+        Block block;
+
+    public:
+        Lease(ScratchArenas* _arenas, Block _block) : arenas(_arenas), block(std::move(_block)) {}
+        Lease(Lease&&) = default;
+
+        ~Lease()
+        {
+            if (block)
+            {
+                std::lock_guard<std::mutex> lock(arenas->mtx);
+                arenas->free_blocks.push_back(std::move(block));
+            }
+        }
+
+        uint8_t* data() const { return block.get(); }
+    };
+
+    // Sizes rounded up like this keep the next part of a block aligned.
+    static size_t align(size_t n) { return (n + 63) & ~static_cast<size_t>(63); }
+
+    ScratchArenas(size_t _size, int count) : size(align(std::max<size_t>(_size, 1)))
+    {
+        for (int i = 0; i < count; ++i)
+            free_blocks.push_back(allocate());
+    }
+
+    Lease acquire()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+
+            if (!free_blocks.empty())
+            {
+                Block block = std::move(free_blocks.back());
+                free_blocks.pop_back();
+                return Lease(this, std::move(block));
+            }
+        }
+
+        //more frames are processed at the same time than there are threads
+        return Lease(this, allocate());
+    }
+};
+
+static inline int64_t elapsedNs(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+// The chroma show paints, for every show. colours is filled with the U and V of every MaskSource for show=1 and with
+// the 8 U pixels, then the 8 V pixels, of every value of a byte of the mask for show=2. Float chroma is centered on 0.
+template <typename T>
+static void showColours(std::vector<T>& colours, int show, int bits)
+{
+    //fallback red, current green, prev blue, next yellow; masked pixels magenta, the others grey
+    static constexpr int class_colours[4][2] = { { 90, 240 }, { 54, 34 }, { 240, 110 }, { 16, 146 } };
+    static constexpr int masked[2] = { 202, 222 };
+
+    auto value = [&](int v)
+    {
+        if constexpr (std::is_same<T, float>::value)
+            return (v - 128) / 255.0f;
+        else
+            return static_cast<T>(v << (bits - 8));
+    };
+
+    colours.clear();
+
+    if (show == 1)
+    {
+        for (auto& c : class_colours)
+        {
+            colours.push_back(value(c[0]));
+            colours.push_back(value(c[1]));
+        }
+    }
+    else
+    {
+        for (int i = 0; i < 256; ++i)
+            for (int uv = 0; uv < 2; ++uv)
+                for (int bit = 0; bit < 8; ++bit)
+                    colours.push_back(value((i >> bit & 1) ? masked[uv] : 128));
+    }
+}
+
+// The chroma of show for one row of blocks, in the colours of showColours. show=1 paints every block in the colour of its
+// MaskSource, blocks outside the region of interest keep their chroma. show=2 paints the pixels set in mask magenta and all
+// the others grey, 8 pixels at a time, mask is null for a row with no blocks in the region of interest.
+// The pixels right of the last block keep their chroma in both.
+template <typename T>
+static void showBlockRow(const BlockRow& r, int show, const uint64_t* mask, const T* colours)
+{
+    const int width_uv = r.blocks_x * r.block_width_uv;
+
+    for (int y = 0; y < r.block_height_uv; ++y)
+    {
+        const T* srcc_u = reinterpret_cast<const T*>(r.srcc_u) + r.srcc_pitch_uv * static_cast<int64_t>(y);
+        const T* srcc_v = reinterpret_cast<const T*>(r.srcc_v) + r.srcc_pitch_uv * static_cast<int64_t>(y);
+        T* dst_u = reinterpret_cast<T*>(r.dst_u) + r.dst_pitch_uv * static_cast<int64_t>(y);
+        T* dst_v = reinterpret_cast<T*>(r.dst_v) + r.dst_pitch_uv * static_cast<int64_t>(y);
+
+        if (show == 1)
+        {
+            //one run of blocks of the same colour at a time
+            auto colour = [&](int i) { return (r.source[i] == msFallback && r.direction[i] == bdNone) ? -1 : r.source[i]; };
+
+            for (int x = 0; x < r.blocks_x;)
+            {
+                const int c = colour(x);
+                int end = x + 1;
+                while (end < r.blocks_x && colour(end) == c)
+                    ++end;
+
+                const int x0 = x * r.block_width_uv;
+                const int count = (end - x) * r.block_width_uv;
+
+                if (c < 0)
+                {
+                    memcpy(dst_u + x0, srcc_u + x0, count * sizeof(T));
+                    memcpy(dst_v + x0, srcc_v + x0, count * sizeof(T));
+                }
+                else
+                {
+                    std::fill_n(dst_u + x0, count, colours[c * 2]);
+                    std::fill_n(dst_v + x0, count, colours[c * 2 + 1]);
+                }
+
+                x = end;
+            }
+        }
+        else
+        {
+            const uint64_t* mask_row = (mask) ? mask + r.mask_stride * static_cast<int64_t>(y) : nullptr;
+            const int full = width_uv & ~7;
+
+            for (int x0 = 0; x0 < width_uv; x0 += 8)
+            {
+                const int byte = (mask_row) ? (mask_row[x0 >> 6] >> (x0 & 63)) & 255 : 0;
+                const T* pattern = colours + byte * 16;
+
+                if (x0 < full)
+                {
+                    memcpy(dst_u + x0, pattern, 8 * sizeof(T));
+                    memcpy(dst_v + x0, pattern + 8, 8 * sizeof(T));
+                }
+                else
+                {
+                    memcpy(dst_u + x0, pattern, (width_uv - x0) * sizeof(T));
+                    memcpy(dst_v + x0, pattern + 8, (width_uv - x0) * sizeof(T));
+                }
+            }
+        }
+
+        memcpy(dst_u + width_uv, srcc_u + width_uv, r.col * sizeof(T));
+        memcpy(dst_v + width_uv, srcc_v + width_uv, r.col * sizeof(T));
+    }
+}
+
+// The layout of fields and blocks, the worker threads and dup_cache, shared by BifrostAnalyse and BifrostApply.
+class BifrostBase : public GenericVideoFilter
+{
+protected:
+    int fields;
+    int offset;
+    int height;
+    int block_width, block_height, block_width_uv, block_height_uv;
+    int blocks_x, blocks_y;
+    bool avx512, avx2, sse41, sse2;
+    bool has_at_least_v8;
+    int threads;
+    int stripe_rows;
+    std::shared_ptr<ThreadPool> pool;
+    std::unique_ptr<ScratchArenas> scratch; // per-stripe memory, laid out by each filter
+    HashPlaneFunction hashPlane;
+    int hashed_planes;                    // planes of input the output depends on
+    std::vector<const char*> hashed_props; // frame properties of input the output depends on
+    std::unique_ptr<SharedCache<uint64_t>> frame_hashes;
+    std::unique_ptr<ResultCache> results;
+
+    BifrostBase(PClip _child, bool _interlaced, int _block_width, int _block_height, int opt, int _threads, int dup_cache, std::shared_ptr<ThreadPool> _pool, IScriptEnvironment* env)
+        : GenericVideoFilter(_child), block_width(_block_width), block_height(_block_height), threads(_threads), pool(_pool), hashed_planes(3)
+    {
+        if (opt < -1 || opt > 4)
+            env->ThrowError("Bifrost: opt must be between -1..4.");
+        if (threads < 0)
+            env->ThrowError("Bifrost: threads must be greater than or equal to 0.");
+        if (dup_cache < 0)
+            env->ThrowError("Bifrost: dup_cache must be greater than or equal to 0.");
+
+        const int cpu_flags = env->GetCPUFlags();
+        if (opt == 1 && !(cpu_flags & CPUF_SSE2))
+            env->ThrowError("Bifrost: opt=1 requires SSE2.");
+        if (opt == 2 && !(cpu_flags & CPUF_SSE4_1))
+            env->ThrowError("Bifrost: opt=2 requires SSE4.1.");
+        if (opt == 3 && !(cpu_flags & CPUF_AVX2))
+            env->ThrowError("Bifrost: opt=3 requires AVX2.");
+        if (opt == 4 && !((cpu_flags & CPUF_AVX512F) && (cpu_flags & CPUF_AVX512BW)))
+            env->ThrowError("Bifrost: opt=4 requires AVX512F and AVX512BW.");
+
+        avx512 = (opt == -1 && (cpu_flags & CPUF_AVX512F) && (cpu_flags & CPUF_AVX512BW)) || opt == 4;
+        avx2 = (opt == -1 && (cpu_flags & CPUF_AVX2)) || opt == 3;
+        sse41 = (opt == -1 && (cpu_flags & CPUF_SSE4_1)) || opt == 2;
+        sse2 = (opt == -1 && (cpu_flags & CPUF_SSE2)) || opt == 1;
+
+        //fields are processed in place, unit n is frame n or field n of the separated clip
+        fields = _interlaced ? 2 : 1;
+        offset = fields;
+        height = vi.height / fields;
+        blocks_x = vi.width / block_width;
+        blocks_y = height / block_height;
+
+        if (vi.height % (fields << vi.GetPlaneHeightSubsampling(PLANAR_U)))
+            env->ThrowError("Bifrost: The clip's height must be a multiple of %d when interlaced=true.", fields << vi.GetPlaneHeightSubsampling(PLANAR_U));
+
+        block_width_uv = block_width >> vi.GetPlaneWidthSubsampling(PLANAR_U);
+        block_height_uv = block_height >> vi.GetPlaneHeightSubsampling(PLANAR_U);
+        if (block_width_uv < 2 || block_height_uv < 2)
+            env->ThrowError("Bifrost: The requested block size is too small.");
+
+        if (avx512 || avx2)
+            hashPlane = hashPlane_avx2;
+        else if (sse41 || sse2)
+            hashPlane = hashPlane_sse2;
+        else
+            hashPlane = hashPlane_c;
+
+        if (threads == 0)
+            threads = std::max(static_cast<int>(std::thread::hardware_concurrency()), 1);
+
+        const int width_uv = blocks_x * block_width_uv;
+        const size_t stripe_bytes = (static_cast<size_t>(width_uv) * block_height_uv * 2 * 7 + static_cast<size_t>(vi.width) * block_height * 2) * vi.ComponentSize();
+        stripe_rows = std::clamp(static_cast<int>(stripe_cache_size / stripe_bytes), 1, std::max(blocks_y, 1));
+
+        //Bifrost() hands the workers of its analysis on to the blending
+        if (!pool)
+            pool = std::make_shared<ThreadPool>(threads);
+
+        //the source frames of a few outputs in each direction
+        if (dup_cache)
+        {
+            frame_hashes = std::make_unique<SharedCache<uint64_t>>(64 * sizeof(uint64_t), sizeof(uint64_t));
+            results = std::make_unique<ResultCache>(dup_cache);
+        }
+
+        has_at_least_v8 = true;
+        try { env->CheckVersion(8); }
+        catch (const AvisynthError&) { has_at_least_v8 = false; };
+
+        if (fields == 2 && has_at_least_v8)
+            hashed_props.push_back("_FieldBased");
+
+        //frames n-2..n+2 are requested for frame n
+        child->SetCacheHints(CACHE_WINDOW, 5);
+    }
+
+    bool isBottomField(const PVideoFrame& frame, int unit, IScriptEnvironment* env);
+    SrcPlanes srcPlanes(const PVideoFrame& frame, bool bottom);
+    DstPlanes dstPlanes(PVideoFrame& frame, bool bottom);
+    int frameThreads(IScriptEnvironment* env);
+    uint64_t frameHash(int clip, int n, const PVideoFrame& frame, IScriptEnvironment* env);
+
+    // The key of dup_cache for frame n: how close n is to the ends of the clip and the frames n-1..n+1 of input, frame(f) returns frame f.
+    template <typename F>
+    uint64_t resultKey(int n, F frame, IScriptEnvironment* env)
+    {
+        uint64_t key = hashMix(hashMix(0, std::min(n, 2)), std::min(vi.num_frames - 1 - n, 2));
+
+        for (int f = std::max(n - 1, 0); f <= std::min(n + 1, vi.num_frames - 1); ++f)
+            key = hashMix(key, frameHash(0, f, frame(f), env));
+
+        return key;
+    }
+
+    // The output of frame n kept under key, as long as the frames n-2 and n+2 it read are the same.
+    template <typename F>
+    bool findResult(int n, uint64_t key, F frame, ResultCache::Result& cached, IScriptEnvironment* env)
+    {
+        if (!results->find(key, cached))
+            return false;
+
+        const int outer_frames[2] = { n - 2, n + 2 };
+        for (int i = 0; i < 2; ++i)
+        {
+            if (cached.outer_read[i] && frameHash(0, outer_frames[i], frame(outer_frames[i]), env) != cached.outer_hash[i])
+                return false;
+        }
+
+        return true;
+    }
+
+    // Keeps dst as the output of frame n, src holds the frames n-2..n+2 (clamped to the clip) that were requested.
+    void insertResult(int n, uint64_t key, const PVideoFrame& dst, const FrameStats& frame_stats, const PVideoFrame* src, IScriptEnvironment* env);
+
+public:
+    std::shared_ptr<ThreadPool> threadPool() const { return pool; }
+
+    int __stdcall SetCacheHints(int cachehints, int frame_range) override
+    {
+        return cachehints == CACHE_GET_MTMODE ? MT_NICE_FILTER : 0;
+    }
+};
+
+// Classifies the blocks of every frame (or field) by the luma differences to its neighbours.
+// The output is a Y8 clip of blocks_x x blocks_y * fields pixels, every pixel holds the class of one block and the fields follow each other.
+class BifrostAnalyse : public BifrostBase
+{
+    VideoInfo vi_src;
+    float luma_thresh;
+    float relativeframediff;
+    int superblock;
+    int superblock_blocks_x, superblock_blocks_y;
+    PClip roi_mask;
+    bool roi;
+    int roi_x0, roi_x1, roi_y0, roi_y1; // blocks of the region of interest
+    int ld_x0, ld_x1, ld_y0, ld_y1;     // blocks whose luma difference is measured
+    int motion_scale;
+    int ld_block_width, ld_block_height, ld_superblock; // sizes in the plane the luma difference is measured on
+    int decimated_pitch;
+    DecimateRowFunction decimateRow;
+    std::unique_ptr<DecimatedCache> decimated_cache;
+    LumaDiffRowFunction lumaDiffRow;
+    std::unique_ptr<LumaDiffCache> lumadiff_cache;
+    bool scenechange;
+    LumaDiffCache::Map cut_map;
+    bool stats;
+    std::unique_ptr<AnalysisFile> analysis;
+
+    LumaDiffCache::Map lumaDiffMap(int a, int b, const SrcPlanes& src1, const SrcPlanes& src2, int frame_threads, FrameStats* frame_stats);
+    DecimatedCache::Map decimatedLuma(int unit, const SrcPlanes& src, int frame_threads, std::atomic<int64_t>* ns);
+    void lumaDiffSuperBlockRow(const uint8_t* src1_y, const uint8_t* src2_y, int src1_pitch_y, int src2_pitch_y, int y, float* superblock_diff, float* map);
+    void classifyBlocks(const float* ldprev_map, const float* ldnext_map, const float* ldprevprev_map, const float* ldnextnext_map,
+        uint8_t* classes, int frame_threads, FrameStats* frame_stats);
+    void roiBlocks(int n, bool bottom, uint8_t* active, IScriptEnvironment* env);
+
+    template <typename T>
+    void maskBlocks(const uint8_t* maskp, int pitch, uint8_t* active);
+
+public:
+    BifrostAnalyse(PClip _child, float _luma_thresh, bool _interlaced, int _block_width, int _block_height, int opt, int _threads, bool _stats, const char* analysis_file,
+        int _superblock, int roi_left, int roi_top, int roi_width, int roi_height, PClip _roi_mask, bool _scenechange, int _motion_scale, int dup_cache,
+        std::shared_ptr<ThreadPool> _pool, IScriptEnvironment* env)
+        : BifrostBase(_child, _interlaced, _block_width, _block_height, opt, _threads, dup_cache, _pool, env), vi_src(vi), luma_thresh(_luma_thresh), superblock(_superblock),
+        roi_mask(_roi_mask), motion_scale(_motion_scale), scenechange(_scenechange), stats(_stats)
+    {
+        if (luma_thresh < 0.0f || luma_thresh > 255.0f)
+            env->ThrowError("Bifrost: luma_thresh must be between 0.0..255.0.");
+        if (superblock < 0 || (superblock && (superblock % block_width || superblock % block_height || (superblock == block_width && superblock == block_height))))
+            env->ThrowError("Bifrost: superblock must be 0 or a multiple of blockx and blocky that holds more than one block.");
+        if (motion_scale != 1 && motion_scale != 2 && motion_scale != 4)
+            env->ThrowError("Bifrost: motion_scale must be 1, 2 or 4.");
+        if (block_width % motion_scale || block_height % motion_scale)
+            env->ThrowError("Bifrost: blockx and blocky must be multiples of motion_scale.");
+
+        //a width or height of 0 reaches to the edge of the frame
+        if (roi_width == 0)
+            roi_width = vi.width - roi_left;
+        if (roi_height == 0)
+            roi_height = vi.height - roi_top;
+
+        if (roi_left < 0 || roi_top < 0 || roi_width < 0 || roi_height < 0 || roi_left + roi_width > vi.width || roi_top + roi_height > vi.height)
+            env->ThrowError("Bifrost: The region of interest must lie within the frame.");
+
+        relativeframediff = 1.2f;
+
+        superblock_blocks_x = superblock / block_width;
+        superblock_blocks_y = superblock / block_height;
+
+        //every block that overlaps the region is processed, its lines are split between the fields
+        roi_x0 = std::min(roi_left / block_width, blocks_x);
+        roi_x1 = std::min((roi_left + roi_width + block_width - 1) / block_width, blocks_x);
+        roi_y0 = std::min(roi_top / fields / block_height, blocks_y);
+        roi_y1 = std::min(((roi_top + roi_height + fields - 1) / fields + block_height - 1) / block_height, blocks_y);
+        roi = roi_mask || roi_x0 > 0 || roi_y0 > 0 || roi_x1 < blocks_x || roi_y1 < blocks_y;
+
+        //super-blocks are measured as a whole
+        ld_x0 = roi_x0;
+        ld_x1 = roi_x1;
+        ld_y0 = roi_y0;
+        ld_y1 = roi_y1;
+
+        if (superblock)
+        {
+            ld_x0 = ld_x0 / superblock_blocks_x * superblock_blocks_x;
+            ld_x1 = std::min((ld_x1 + superblock_blocks_x - 1) / superblock_blocks_x * superblock_blocks_x, blocks_x);
+            ld_y0 = ld_y0 / superblock_blocks_y * superblock_blocks_y;
+            ld_y1 = std::min((ld_y1 + superblock_blocks_y - 1) / superblock_blocks_y * superblock_blocks_y, blocks_y);
+        }
+
+        //the luma difference is an average per pixel, so luma_thresh applies to the decimated plane as it is
+        ld_block_width = block_width / motion_scale;
+        ld_block_height = block_height / motion_scale;
+        ld_superblock = superblock / motion_scale;
+        decimated_pitch = (blocks_x * ld_block_width * vi.ComponentSize() + 63) & ~63;
+
+        if (vi.ComponentSize() == 4)
+        {
+            luma_thresh /= 255.0f;
+
+            //there are no SSE2 and AVX512 float kernels
+            lumaDiffRow = (avx512 || avx2) ? lumaDiffRow_avx2<float> : lumaDiffRow_c<float>;
+            decimateRow = (motion_scale == 4) ? decimateRow_c<float, 4> : decimateRow_c<float, 2>;
+        }
+        else if (vi.ComponentSize() == 2)
+        {
+            const int peak = (1 << vi.BitsPerComponent()) - 1;
+            luma_thresh *= peak / 255;
+
+            if (avx512)
+                lumaDiffRow = lumaDiffRow_avx512<uint16_t>;
+            else if (avx2)
+                lumaDiffRow = lumaDiffRow_avx2<uint16_t>;
+            else if (sse41)
+                lumaDiffRow = lumaDiffRow_sse41;
+            else if (sse2)
+                lumaDiffRow = lumaDiffRow_sse2<uint16_t>;
+            else
+                lumaDiffRow = lumaDiffRow_c<uint16_t>;
+
+            if (avx512 || avx2)
+                decimateRow = (motion_scale == 4) ? decimateRow_avx2<uint16_t, 4> : decimateRow_avx2<uint16_t, 2>;
+            else if (sse41 || sse2)
+                decimateRow = (motion_scale == 4) ? decimateRow_sse2<uint16_t, 4> : decimateRow_sse2<uint16_t, 2>;
+            else
+                decimateRow = (motion_scale == 4) ? decimateRow_c<uint16_t, 4> : decimateRow_c<uint16_t, 2>;
+        }
+        else
+        {
+            if (avx512)
+                lumaDiffRow = lumaDiffRow_avx512<uint8_t>;
+            else if (avx2)
+                lumaDiffRow = lumaDiffRow_avx2<uint8_t>;
+            else if (sse41 || sse2)
+                lumaDiffRow = lumaDiffRow_sse2<uint8_t>;
+            else
+                lumaDiffRow = lumaDiffRow_c<uint8_t>;
+
+            if (avx512 || avx2)
+                decimateRow = (motion_scale == 4) ? decimateRow_avx2<uint8_t, 4> : decimateRow_avx2<uint8_t, 2>;
+            else if (sse41 || sse2)
+                decimateRow = (motion_scale == 4) ? decimateRow_sse2<uint8_t, 4> : decimateRow_sse2<uint8_t, 2>;
+            else
+                decimateRow = (motion_scale == 4) ? decimateRow_c<uint8_t, 4> : decimateRow_c<uint8_t, 2>;
+        }
+
+        lumadiff_cache = std::make_unique<LumaDiffCache>(64 * 1024 * 1024, blocks_x * static_cast<size_t>(blocks_y) * sizeof(float));
+        if (superblock)
+            scratch = std::make_unique<ScratchArenas>(vi_src.width / superblock * sizeof(float), threads);
+        if (motion_scale > 1)
+            decimated_cache = std::make_unique<DecimatedCache>(64 * 1024 * 1024, decimated_pitch * static_cast<size_t>(blocks_y) * ld_block_height);
+
+        if (scenechange && !has_at_least_v8)
+            env->ThrowError("Bifrost: scenechange requires AviSynth+ with interface version 8 or later.");
+
+        //the times are passed on as frame properties, which older hosts don't have
+        stats = stats && has_at_least_v8;
+
+        //only the luma and the properties read here change the classes
+        hashed_planes = 1;
+
+        //stands in for the luma differences across a scene change, every block has too much movement
+        if (scenechange)
+        {
+            cut_map = std::make_shared<const std::vector<float>>(blocks_x * static_cast<size_t>(blocks_y), std::numeric_limits<float>::infinity());
+            hashed_props.push_back("_SceneChangePrev");
+            hashed_props.push_back("_SceneChangeNext");
+        }
+
+        if (analysis_file && analysis_file[0])
+        {
+            AnalysisHeader header = {};
+            header.width = vi.width;
+            header.height = vi.height;
+            header.num_frames = vi.num_frames;
+            header.fields = fields;
+            header.bits = vi.BitsPerComponent();
+            header.block_width = block_width;
+            header.block_height = block_height;
+            header.blocks_x = blocks_x;
+            header.blocks_y = blocks_y;
+            header.offset = offset;
+            header.luma_thresh = luma_thresh;
+            header.relativeframediff = relativeframediff;
+            header.superblock = superblock;
+            header.roi[0] = roi_x0;
+            header.roi[1] = roi_y0;
+            header.roi[2] = roi_x1;
+            header.roi[3] = roi_y1;
+            header.scenechange = scenechange;
+            header.motion_scale = motion_scale;
+
+            try { analysis = std::make_unique<AnalysisFile>(analysis_file, header, vi.num_frames * fields, blocks_x * blocks_y); }
+            catch (const std::exception& e) { env->ThrowError("Bifrost: %s", e.what()); }
+        }
+
+        //one byte per block, a clip too small for a single block still has a pixel
+        vi.pixel_type = VideoInfo::CS_Y8;
+        vi.width = std::max(blocks_x, 1);
+        vi.height = std::max(blocks_y * fields, 1);
+    }
+
+    PVideoFrame __stdcall GetFrame(int n, IScriptEnvironment* env) override;
+};
+
+// Builds the chroma masks of the blocks classified by BifrostAnalyse and blends them.
+class BifrostApply : public BifrostBase
 {
-    bdNext,
-    bdPrev,
-    bdBoth
+    PClip analysis;
+    PClip child2;
+    bool has_altclip;
+    int variation;
+    float variation_f;
+    bool conservative_mask;
+    BlockRowFunction blockRow;
+    void (*streamRows)(uint8_t* dstp, int dst_pitch, const uint8_t* srcp, int src_pitch, int row_size, int height);
+    int mask_stride;
+    std::vector<uint64_t> inner_left, inner_right;
+    bool stats;
+    int show;
+    FILE* summary;
+    std::mutex summary_mtx;
+    FrameStats summary_stats;
+    int64_t summary_frames;
+
+    void writeSummary();
+    void attachStats(PVideoFrame& dst, const FrameStats& frame_stats, IScriptEnvironment* env);
+
+    template <typename T>
+    void Framedepth(const DstPlanes& dst, const SrcPlanes& altsrcc, const SrcPlanes& srcnn, const SrcPlanes& srcn, const SrcPlanes& srcc, const SrcPlanes& srcp, const SrcPlanes& srcpp,
+        const uint8_t* classes, int frame_threads, FrameStats* frame_stats, IScriptEnvironment* env);
+
+    void (BifrostApply::*depth)(const DstPlanes& dst, const SrcPlanes& altsrcc, const SrcPlanes& srcnn, const SrcPlanes& srcn, const SrcPlanes& srcc, const SrcPlanes& srcp, const SrcPlanes& srcpp,
+        const uint8_t* classes, int frame_threads, FrameStats* frame_stats, IScriptEnvironment* env);
+
+public:
+    BifrostApply(PClip _child, PClip _analysis, PClip _child2, int _variation, bool _conservative_mask, bool _interlaced, int _block_width, int _block_height, int opt, int _threads,
+        bool _stats, const char* stats_file, int dup_cache, int _show, std::shared_ptr<ThreadPool> _pool, IScriptEnvironment* env)
+        : BifrostBase(_child, _interlaced, _block_width, _block_height, opt, _threads, dup_cache, _pool, env), analysis(_analysis), child2((_child2) ? _child2 : _child), has_altclip(!!_child2),
+        variation(_variation), conservative_mask(_conservative_mask), stats(_stats), show(_show), summary(nullptr), summary_stats(), summary_frames(0)
+    {
+        if (variation < 0 || variation > 255)
+            env->ThrowError("Bifrost: variation must be between 0..255.");
+        if (show < 0 || show > 2)
+            env->ThrowError("Bifrost: show must be between 0..2.");
+
+        const VideoInfo& vi_analysis = analysis->GetVideoInfo();
+        if (!vi_analysis.IsY() || vi_analysis.BitsPerComponent() != 8 || vi_analysis.width != std::max(blocks_x, 1) || vi_analysis.height != std::max(blocks_y * fields, 1) ||
+            vi_analysis.num_frames != vi.num_frames)
+            env->ThrowError("Bifrost: analysis must come from BifrostAnalyse of clip with the same interlaced, blockx and blocky.");
+
+        variation_f = variation / 255.0f;
+
+        if (vi.ComponentSize() == 4)
+        {
+            depth = &BifrostApply::Framedepth<float>;
+
+            //there are no SSE2 and AVX512 float kernels
+            if (avx512 || avx2)
+                blockRow = blockRowFunction_avx2<float>(block_width_uv, block_height_uv);
+            else
+                blockRow = blockRowFunction_c<float>(block_width_uv, block_height_uv);
+        }
+        else if (vi.ComponentSize() == 2)
+        {
+            const int peak = (1 << vi.BitsPerComponent()) - 1;
+            variation *= peak / 255;
+
+            depth = &BifrostApply::Framedepth<uint16_t>;
+
+            if (avx512)
+                blockRow = blockRowFunction_avx512<uint16_t>(block_width_uv, block_height_uv);
+            else if (avx2)
+                blockRow = blockRowFunction_avx2<uint16_t>(block_width_uv, block_height_uv);
+            else if (sse41 || sse2)
+                blockRow = blockRowFunction_sse2<uint16_t>(block_width_uv, block_height_uv);
+            else
+                blockRow = blockRowFunction_c<uint16_t>(block_width_uv, block_height_uv);
+        }
+        else
+        {
+            depth = &BifrostApply::Framedepth<uint8_t>;
+
+            if (avx512)
+                blockRow = blockRowFunction_avx512<uint8_t>(block_width_uv, block_height_uv);
+            else if (avx2)
+                blockRow = blockRowFunction_avx2<uint8_t>(block_width_uv, block_height_uv);
+            else if (sse41 || sse2)
+                blockRow = blockRowFunction_sse2<uint8_t>(block_width_uv, block_height_uv);
+            else
+                blockRow = blockRowFunction_c<uint8_t>(block_width_uv, block_height_uv);
+        }
+
+        const int width_uv = blocks_x * block_width_uv;
+        mask_stride = (width_uv + 63) / 64 + 1;
+        inner_left.resize(mask_stride);
+        inner_right.resize(mask_stride);
+
+        for (int x = 0; x < width_uv; ++x)
+        {
+            if (x % block_width_uv != 0)
+                inner_left[x >> 6] |= 1ULL << (x & 63);
+            if (x % block_width_uv != block_width_uv - 1)
+                inner_right[x >> 6] |= 1ULL << (x & 63);
+        }
+
+        //the rainbow mask, source and direction of a row of blocks
+        scratch = std::make_unique<ScratchArenas>(ScratchArenas::align(mask_stride * static_cast<size_t>(block_height_uv) * sizeof(uint64_t)) + 2 * ScratchArenas::align(blocks_x), threads);
+
+        streamRows = ((avx512 || avx2 || sse41 || sse2) && static_cast<size_t>(vi.width) * vi.height * vi.ComponentSize() >= stream_plane_size) ? streamRows_sse2 : nullptr;
+
+        if (stats && !has_at_least_v8)
+            env->ThrowError("Bifrost: stats requires AviSynth+ with interface version 8 or later.");
+
+        if (stats_file && stats_file[0])
+        {
+            summary = fopen(stats_file, "w");
+            if (!summary)
+                env->ThrowError("Bifrost: cannot open stats_file %s.", stats_file);
+        }
+    }
+
+    ~BifrostApply()
+    {
+        if (summary)
+        {
+            writeSummary();
+            fclose(summary);
+        }
+    }
+
+    PVideoFrame __stdcall GetFrame(int n, IScriptEnvironment* env) override;
 };
 
-template <typename T>
-static void applyBlockRainbowMask(const T* srcp_u, const T* srcp_v,
-    const T* srcc_u, const T* srcc_v,
-    const T* srcn_u, const T* srcn_v,
-    T* dst_u, T* dst_v,
-    int block_width_uv, int block_height_uv,
-    int srcp_stride_uv, int srcc_stride_uv, int srcn_stride_uv, int dst_stride_uv,
-    BlendDirection blenddirection, int col)
-{
-    for (int y = 0; y < block_height_uv; ++y)
+// The field order comes from _FieldBased when it is set, otherwise from the clip's parity, like SeparateFields.
+bool BifrostBase::isBottomField(const PVideoFrame& frame, int unit, IScriptEnvironment* env)
+{
+    if (fields == 1)
+        return false;
+
+    bool tff = child->GetParity(unit >> 1);
+
+    if (has_at_least_v8)
+    {
+        int err;
+        const int64_t field_based = env->propGetInt(env->getFramePropsRO(frame), "_FieldBased", 0, &err);
+        if (!err && (field_based == 1 || field_based == 2))
+            tff = (field_based == 2);
+    }
+
+    return (unit & 1) == tff;
+}
+
+SrcPlanes BifrostBase::srcPlanes(const PVideoFrame& frame, bool bottom)
+{
+    const int planes[3] = { PLANAR_Y, PLANAR_U, PLANAR_V };
+    SrcPlanes p;
+
+    for (int i = 0; i < 3; ++i)
+    {
+        p.ptr[i] = frame->GetReadPtr(planes[i]) + ((bottom) ? frame->GetPitch(planes[i]) : 0);
+        p.pitch[i] = frame->GetPitch(planes[i]) * fields;
+    }
+
+    return p;
+}
+
+DstPlanes BifrostBase::dstPlanes(PVideoFrame& frame, bool bottom)
+{
+    const int planes[3] = { PLANAR_Y, PLANAR_U, PLANAR_V };
+    DstPlanes p;
+
+    for (int i = 0; i < 3; ++i)
+    {
+        p.ptr[i] = frame->GetWritePtr(planes[i]) + ((bottom) ? frame->GetPitch(planes[i]) : 0);
+        p.pitch[i] = frame->GetPitch(planes[i]) * fields;
+    }
+
+    return p;
+}
+
+// Only the pairs that aren't cached yet add to frame_stats->lumadiff_ns.
+LumaDiffCache::Map BifrostAnalyse::lumaDiffMap(int a, int b, const SrcPlanes& src1, const SrcPlanes& src2, int frame_threads, FrameStats* frame_stats)
+{
+    return lumadiff_cache->get(a, b, [&]()
+        {
+            std::vector<float> map(blocks_x * static_cast<size_t>(blocks_y));
+            std::atomic<int64_t> ns(0);
+
+            const uint8_t* src1_y = src1.ptr[0];
+            const uint8_t* src2_y = src2.ptr[0];
+            int src1_pitch_y = src1.pitch[0];
+            int src2_pitch_y = src2.pitch[0];
+
+            //both units are decimated once and shared with their other neighbours
+            DecimatedCache::Map decimated1, decimated2;
+            if (motion_scale > 1)
+            {
+                decimated1 = decimatedLuma(a, src1, frame_threads, (frame_stats) ? &ns : nullptr);
+                decimated2 = decimatedLuma(b, src2, frame_threads, (frame_stats) ? &ns : nullptr);
+                src1_y = decimated1->data();
+                src2_y = decimated2->data();
+                src1_pitch_y = src2_pitch_y = decimated_pitch;
+            }
+
+            //only the blocks around the region of interest are measured, stripes start at a row of super-blocks and
+            //the rows below the last full one are measured block by block
+            const int superblock_rows = (superblock) ? blocks_y / superblock_blocks_y * superblock_blocks_y : 0;
+            const int rows = (superblock) ? std::max(stripe_rows / superblock_blocks_y, 1) * superblock_blocks_y : stripe_rows;
+
+            pool->run((ld_y1 - ld_y0 + rows - 1) / rows, frame_threads, [&](int stripe)
+                {
+                    std::chrono::steady_clock::time_point start;
+                    if (frame_stats)
+                        start = std::chrono::steady_clock::now();
+
+                    const ScratchArenas::Lease arena = (superblock) ? scratch->acquire() : ScratchArenas::Lease(nullptr, nullptr);
+                    float* superblock_diff = reinterpret_cast<float*>(arena.data());
+
+                    for (int y = ld_y0 + stripe * rows; y < std::min(ld_y0 + (stripe + 1) * rows, ld_y1); ++y)
+                    {
+                        if (y < superblock_rows)
+                        {
+                            lumaDiffSuperBlockRow(src1_y, src2_y, src1_pitch_y, src2_pitch_y, y, superblock_diff, map.data());
+                            y += superblock_blocks_y - 1;
+                        }
+                        else
+                        {
+                            const int64_t offset = static_cast<int64_t>(ld_x0) * ld_block_width * vi_src.ComponentSize();
+
+                            lumaDiffRow(src1_y + ld_block_height * static_cast<int64_t>(y) * src1_pitch_y + offset, src2_y + ld_block_height * static_cast<int64_t>(y) * src2_pitch_y + offset,
+                                src1_pitch_y / vi_src.ComponentSize(), src2_pitch_y / vi_src.ComponentSize(), ld_block_width, ld_block_height, ld_x1 - ld_x0, map.data() + blocks_x * static_cast<int64_t>(y) + ld_x0);
+                        }
+                    }
+
+                    if (frame_stats)
+                        ns += elapsedNs(start);
+                });
+
+            if (frame_stats)
+                frame_stats->lumadiff_ns += ns;
+
+            return map;
+        });
+}
+
+// The luma of a unit averaged over squares of motion_scale x motion_scale pixels, only the rows and columns of the measured blocks are filled.
+// The time spent is added to ns when it is set.
+DecimatedCache::Map BifrostAnalyse::decimatedLuma(int unit, const SrcPlanes& src, int frame_threads, std::atomic<int64_t>* ns)
+{
+    return decimated_cache->get(unit, unit, [&]()
+        {
+            std::vector<uint8_t> plane(decimated_pitch * static_cast<size_t>(blocks_y) * ld_block_height);
+            const int64_t offset = static_cast<int64_t>(ld_x0) * block_width * vi_src.ComponentSize();
+            const int64_t decimated_offset = static_cast<int64_t>(ld_x0) * ld_block_width * vi_src.ComponentSize();
+
+            pool->run((ld_y1 - ld_y0 + stripe_rows - 1) / stripe_rows, frame_threads, [&](int stripe)
+                {
+                    std::chrono::steady_clock::time_point start;
+                    if (ns)
+                        start = std::chrono::steady_clock::now();
+
+                    const int y0 = (ld_y0 + stripe * stripe_rows) * ld_block_height;
+                    const int y1 = std::min(ld_y0 + (stripe + 1) * stripe_rows, ld_y1) * ld_block_height;
+
+                    for (int y = y0; y < y1; ++y)
+                        decimateRow(src.ptr[0] + src.pitch[0] * static_cast<int64_t>(y) * motion_scale + offset, src.pitch[0] / vi_src.ComponentSize(),
+                            plane.data() + decimated_pitch * static_cast<int64_t>(y) + decimated_offset, (ld_x1 - ld_x0) * ld_block_width);
+
+                    if (ns)
+                        *ns += elapsedNs(start);
+                });
+
+            return plane;
+        });
+}
+
+// Fills the blocks ld_x0..ld_x1-1 of the block rows y..y+superblock_blocks_y-1 of map. Every super-block is measured as a whole first and only the ones whose
+// difference is close to luma_thresh are measured block by block, the others pass their difference on to all their blocks.
+void BifrostAnalyse::lumaDiffSuperBlockRow(const uint8_t* src1_y, const uint8_t* src2_y, int src1_pitch_y, int src2_pitch_y, int y, float* superblock_diff, float* map)
+{
+    const int columns = vi_src.width / superblock;
+    const int stride1 = src1_pitch_y / vi_src.ComponentSize();
+    const int stride2 = src2_pitch_y / vi_src.ComponentSize();
+    const int64_t row_bytes = static_cast<int64_t>(ld_superblock) * vi_src.ComponentSize();
+
+    src1_y += ld_block_height * static_cast<int64_t>(y) * src1_pitch_y;
+    src2_y += ld_block_height * static_cast<int64_t>(y) * src2_pitch_y;
+    map += blocks_x * static_cast<int64_t>(y);
+
+    const int first = ld_x0 / superblock_blocks_x;
+    const int last = std::min(ld_x1 / superblock_blocks_x, columns);
+
+    lumaDiffRow(src1_y + first * row_bytes, src2_y + first * row_bytes, stride1, stride2, ld_superblock, ld_superblock, last - first, superblock_diff + first);
+
+    auto decided = [&](float diff)
+    {
+        return diff < luma_thresh * 0.5f || diff > luma_thresh * 2.0f;
+    };
+
+    for (int x = first; x < last;)
+    {
+        if (decided(superblock_diff[x]))
+        {
+            for (int by = 0; by < superblock_blocks_y; ++by)
+                std::fill_n(map + blocks_x * static_cast<int64_t>(by) + x * superblock_blocks_x, superblock_blocks_x, superblock_diff[x]);
+
+            ++x;
+            continue;
+        }
+
+        //neighbouring super-blocks that are split are measured together
+        int x1 = x + 1;
+        while (x1 < last && !decided(superblock_diff[x1]))
+            ++x1;
+
+        for (int by = 0; by < superblock_blocks_y; ++by)
+            lumaDiffRow(src1_y + ld_block_height * static_cast<int64_t>(by) * src1_pitch_y + x * row_bytes, src2_y + ld_block_height * static_cast<int64_t>(by) * src2_pitch_y + x * row_bytes,
+                stride1, stride2, ld_block_width, ld_block_height, (x1 - x) * superblock_blocks_x, map + blocks_x * static_cast<int64_t>(by) + x * superblock_blocks_x);
+
+        x = x1;
+    }
+
+    //the blocks right of the last full super-block
+    const int x0 = columns * superblock_blocks_x;
+    if (x0 < ld_x1)
+    {
+        for (int by = 0; by < superblock_blocks_y; ++by)
+            lumaDiffRow(src1_y + ld_block_height * static_cast<int64_t>(by) * src1_pitch_y + columns * row_bytes, src2_y + ld_block_height * static_cast<int64_t>(by) * src2_pitch_y + columns * row_bytes,
+                stride1, stride2, ld_block_width, ld_block_height, ld_x1 - x0, map + blocks_x * static_cast<int64_t>(by) + x0);
+    }
+}
+
+// Decides for every block which frames its mask is generated from and in which direction it is blended.
+// classes holds the MaskSource in bits 0-1 and the BlendDirection in bits 2-3 of every block.
+void BifrostAnalyse::classifyBlocks(const float* ldprev_map, const float* ldnext_map, const float* ldprevprev_map, const float* ldnextnext_map,
+    uint8_t* classes, int frame_threads, FrameStats* frame_stats)
+{
+    std::atomic<int64_t> ns(0);
+
+    pool->run((blocks_y + stripe_rows - 1) / stripe_rows, frame_threads, [&](int stripe)
+        {
+            std::chrono::steady_clock::time_point start;
+            if (frame_stats)
+                start = std::chrono::steady_clock::now();
+
+            for (int y = stripe * stripe_rows; y < std::min((stripe + 1) * stripe_rows, blocks_y); ++y)
+            {
+                const float* ldprev_row = ldprev_map + blocks_x * static_cast<int64_t>(y);
+                const float* ldnext_row = ldnext_map + blocks_x * static_cast<int64_t>(y);
+                uint8_t* classes_row = classes + blocks_x * static_cast<int64_t>(y);
+
+                for (int x = 0; x < blocks_x; ++x)
+                {
+                    float ldprev = ldprev_row[x];
+                    float ldnext = ldnext_row[x];
+                    float ldprevprev = 0.0f;
+                    float ldnextnext = 0.0f;
+
+                    //too much movement in both directions?
+                    if (ldnext > luma_thresh && ldprev > luma_thresh)
+                    {
+                        classes_row[x] = msFallback;
+                        continue;
+                    }
+
+                    if (ldnext > luma_thresh)
+                        ldprevprev = ldprevprev_map[blocks_x * static_cast<int64_t>(y) + x];
+                    else if (ldprev > luma_thresh)
+                        ldnextnext = ldnextnext_map[blocks_x * static_cast<int64_t>(y) + x];
+
+                    //two consecutive frames in one direction to generate mask?
+                    if ((ldnext > luma_thresh && ldprevprev > luma_thresh) ||
+                        (ldprev > luma_thresh && ldnextnext > luma_thresh))
+                    {
+                        classes_row[x] = msFallback;
+                        continue;
+                    }
+
+                    //generate mask from correct side of scenechange
+                    int source;
+                    if (ldnext > luma_thresh)
+                        source = msPrev;
+                    else if (ldprev > luma_thresh)
+                        source = msNext;
+                    else
+                        source = msCurrent;
+
+                    //determine direction to blend in
+                    int direction;
+                    if (ldprev > ldnext * relativeframediff)
+                        direction = bdNext;
+                    else if (ldnext > ldprev * relativeframediff)
+                        direction = bdPrev;
+                    else
+                        direction = bdBoth;
+
+                    classes_row[x] = static_cast<uint8_t>(source | (direction << 2));
+                }
+            }
+
+            if (frame_stats)
+                ns += elapsedNs(start);
+        });
+
+    if (frame_stats)
+        frame_stats->mask_ns += ns;
+}
+
+template <typename T>
+void BifrostApply::Framedepth(const DstPlanes& dst, const SrcPlanes& altsrcc, const SrcPlanes& srcnn, const SrcPlanes& srcn, const SrcPlanes& srcc, const SrcPlanes& srcp, const SrcPlanes& srcpp,
+    const uint8_t* classes, int frame_threads, FrameStats* frame_stats, IScriptEnvironment* env)
+{
+    const T* srcpp_u = reinterpret_cast<const T*>(srcpp.ptr[1]);
+    const T* srcpp_v = reinterpret_cast<const T*>(srcpp.ptr[2]);
+          
+    const T* srcp_u = reinterpret_cast<const T*>(srcp.ptr[1]);
+    const T* srcp_v = reinterpret_cast<const T*>(srcp.ptr[2]);
+          
+    const T* srcc_u = reinterpret_cast<const T*>(srcc.ptr[1]);
+    const T* srcc_v = reinterpret_cast<const T*>(srcc.ptr[2]);
+          
+    const T* srcn_u = reinterpret_cast<const T*>(srcn.ptr[1]);
+    const T* srcn_v = reinterpret_cast<const T*>(srcn.ptr[2]);
+          
+    const T* srcnn_u = reinterpret_cast<const T*>(srcnn.ptr[1]);
+    const T* srcnn_v = reinterpret_cast<const T*>(srcnn.ptr[2]);
+          
+    const T* altsrcc_u = reinterpret_cast<const T*>(altsrcc.ptr[1]);
+    const T* altsrcc_v = reinterpret_cast<const T*>(altsrcc.ptr[2]);
+
+    T* dst_u = reinterpret_cast<T*>(dst.ptr[1]);
+    T* dst_v = reinterpret_cast<T*>(dst.ptr[2]);
+
+    const int srcpp_pitch_uv = srcpp.pitch[1] / sizeof(T);
+    const int srcp_pitch_uv = srcp.pitch[1] / sizeof(T);
+    const int srcc_pitch_uv = srcc.pitch[1] / sizeof(T);
+    const int srcn_pitch_uv = srcn.pitch[1] / sizeof(T);
+    const int srcnn_pitch_uv = srcnn.pitch[1] / sizeof(T);
+    const int altsrcc_pitch_uv = altsrcc.pitch[1] / sizeof(T);
+
+    const int dst_pitch_uv = dst.pitch[1] / sizeof(T);
+
+    const uint8_t* srcc_y = srcc.ptr[0];
+    uint8_t* dst_y = dst.ptr[0];
+    const int srcc_pitch_y = srcc.pitch[0];
+    const int dst_pitch_y = dst.pitch[0];
+
+    const int rowsize_y = vi.width;
+    const int height_y = height;
+
+    const int col = (rowsize_y - rowsize_y / block_width * block_width) >> vi.GetPlaneWidthSubsampling(PLANAR_U);
+
+    std::vector<T> show_colours;
+    if (show)
+        showColours(show_colours, show, vi.BitsPerComponent());
+
+    //the luma is only copied, it goes along with the chroma of its row of blocks so that both pass through the cache once
+    auto copyLuma = [&](int row, int rows)
     {
-        if (blenddirection == bdNext)
-        {
-            for (int x = 0; x < block_width_uv; ++x)
-            {
-                if (dst_v[x])
-                {
-                    dst_u[x] = (srcc_u[x] + srcn_u[x] + 1) >> 1;
-                    dst_v[x] = (srcc_v[x] + srcn_v[x] + 1) >> 1;
-                }
-                else
-                {
-                    dst_u[x] = srcc_u[x];
-                    dst_v[x] = srcc_v[x];
-                }
-            }
-        }
-        else if (blenddirection == bdPrev)
+        uint8_t* dstp = dst_y + row * static_cast<int64_t>(dst_pitch_y);
+        const uint8_t* srcp = srcc_y + row * static_cast<int64_t>(srcc_pitch_y);
+
+        if (streamRows)
+            streamRows(dstp, dst_pitch_y, srcp, srcc_pitch_y, rowsize_y * sizeof(T), rows);
+        else
+            env->BitBlt(dstp, dst_pitch_y, srcp, srcc_pitch_y, rowsize_y * sizeof(T), rows);
+    };
+
+    std::mutex stats_mtx;
+
+    //every stripe of block rows is processed by one thread, the last one also copies the rows below the blocks
+    const int stripes = std::max((blocks_y + stripe_rows - 1) / stripe_rows, 1);
+
+    pool->run(stripes, frame_threads, [&](int stripe)
         {
-            for (int x = 0; x < block_width_uv; ++x)
+            const int y0 = stripe * stripe_rows;
+            const int y1 = std::min(y0 + stripe_rows, blocks_y);
+
+            const ScratchArenas::Lease arena = scratch->acquire();
+            uint64_t* mask = reinterpret_cast<uint64_t*>(arena.data());
+            uint8_t* source = arena.data() + ScratchArenas::align(mask_stride * static_cast<size_t>(block_height_uv) * sizeof(uint64_t));
+            uint8_t* direction = source + ScratchArenas::align(blocks_x);
+            BlockRowStats row_stats = {};
+            int64_t blocks[4] = {};
+            int64_t blocks_skipped = 0;
+
+            BlockRow r;
+            r.srcpp_pitch_uv = srcpp_pitch_uv;
+            r.srcp_pitch_uv = srcp_pitch_uv;
+            r.srcc_pitch_uv = srcc_pitch_uv;
+            r.srcn_pitch_uv = srcn_pitch_uv;
+            r.srcnn_pitch_uv = srcnn_pitch_uv;
+            r.altsrcc_pitch_uv = altsrcc_pitch_uv;
+            r.dst_pitch_uv = dst_pitch_uv;
+            r.source = source;
+            r.direction = direction;
+            r.blocks_x = blocks_x;
+            r.block_width_uv = block_width_uv;
+            r.block_height_uv = block_height_uv;
+            r.col = col;
+            r.variation = variation;
+            r.variation_f = variation_f;
+            r.conservative_mask = conservative_mask;
+            r.mask = mask;
+            r.mask_stride = mask_stride;
+            r.inner_left = inner_left.data();
+            r.inner_right = inner_right.data();
+            r.mask_only = show == 2;
+            r.stats = (frame_stats) ? &row_stats : nullptr;
+
+            for (int y = y0; y < y1; ++y)
             {
-                if (dst_v[x])
+                copyLuma(block_height * y, block_height);
+
+                std::chrono::steady_clock::time_point start;
+                if (frame_stats)
+                    start = std::chrono::steady_clock::now();
+
+                const uint8_t* classes_row = classes + blocks_x * static_cast<int64_t>(y);
+                bool row_active = false;
+
+                for (int x = 0; x < blocks_x; ++x)
                 {
-                    dst_u[x] = (srcc_u[x] + srcp_u[x] + 1) >> 1;
-                    dst_v[x] = (srcc_v[x] + srcp_v[x] + 1) >> 1;
+                    source[x] = classes_row[x] & 3;
+                    direction[x] = classes_row[x] >> 2;
+                    row_active |= classes_row[x] != passthrough_class;
                 }
-                else
+
+                if (frame_stats)
                 {
-                    dst_u[x] = srcc_u[x];
-                    dst_v[x] = srcc_v[x];
+                    for (int x = 0; x < blocks_x; ++x)
+                    {
+                        if (classes_row[x] == passthrough_class)
+                            ++blocks_skipped;
+                        else
+                            ++blocks[source[x]];
+                    }
+
+                    row_stats.mask_ns += elapsedNs(start);
                 }
-            }
-        }
-        else if (blenddirection == bdBoth)
-        {
-            for (int x = 0; x < block_width_uv; ++x)
-            {
-                if (dst_v[x])
+
+                const int64_t row_uv = block_height_uv * static_cast<int64_t>(y);
+
+                //rows outside the region of interest are copied as they are, the mask of show=2 paints them grey
+                if (!row_active && show != 2)
                 {
-                    dst_u[x] = (2 * srcc_u[x] + srcp_u[x] + srcn_u[x] + 3) >> 2;
-                    dst_v[x] = (2 * srcc_v[x] + srcp_v[x] + srcn_v[x] + 3) >> 2;
+                    const int rowsize_uv = (blocks_x * block_width_uv + col) * sizeof(T);
+
+                    env->BitBlt(reinterpret_cast<uint8_t*>(dst_u + row_uv * dst_pitch_uv), dst_pitch_uv * sizeof(T),
+                        reinterpret_cast<const uint8_t*>(srcc_u + row_uv * srcc_pitch_uv), srcc_pitch_uv * sizeof(T), rowsize_uv, block_height_uv);
+                    env->BitBlt(reinterpret_cast<uint8_t*>(dst_v + row_uv * dst_pitch_uv), dst_pitch_uv * sizeof(T),
+                        reinterpret_cast<const uint8_t*>(srcc_v + row_uv * srcc_pitch_uv), srcc_pitch_uv * sizeof(T), rowsize_uv, block_height_uv);
+
+                    continue;
                 }
-                else
+
+                r.srcpp_u = srcpp_u + row_uv * srcpp_pitch_uv;
+                r.srcpp_v = srcpp_v + row_uv * srcpp_pitch_uv;
+                r.srcp_u = srcp_u + row_uv * srcp_pitch_uv;
+                r.srcp_v = srcp_v + row_uv * srcp_pitch_uv;
+                r.srcc_u = srcc_u + row_uv * srcc_pitch_uv;
+                r.srcc_v = srcc_v + row_uv * srcc_pitch_uv;
+                r.srcn_u = srcn_u + row_uv * srcn_pitch_uv;
+                r.srcn_v = srcn_v + row_uv * srcn_pitch_uv;
+                r.srcnn_u = srcnn_u + row_uv * srcnn_pitch_uv;
+                r.srcnn_v = srcnn_v + row_uv * srcnn_pitch_uv;
+                r.altsrcc_u = altsrcc_u + row_uv * altsrcc_pitch_uv;
+                r.altsrcc_v = altsrcc_v + row_uv * altsrcc_pitch_uv;
+                r.dst_u = dst_u + row_uv * dst_pitch_uv;
+                r.dst_v = dst_v + row_uv * dst_pitch_uv;
+
+                if (show)
                 {
-                    dst_u[x] = srcc_u[x];
-                    dst_v[x] = srcc_v[x];
+                    if (show == 2 && row_active)
+                        blockRow(r);
+
+                    showBlockRow<T>(r, show, (row_active) ? mask : nullptr, show_colours.data());
+                    continue;
                 }
+
+                blockRow(r);
             }
-        }
 
-        if (col)
-        {
-            for (int x = block_width_uv; x < block_width_uv + col; ++x)
+            const int row = blocks_y * block_height;
+            if (stripe == stripes - 1 && row != height_y)
             {
-                dst_u[x] = srcc_u[x];
-                dst_v[x] = srcc_v[x];
+                copyLuma(row, height_y - row);
+
+                const int width_uv = (rowsize_y >> vi.GetPlaneWidthSubsampling(PLANAR_U)) * sizeof(T);
+                const int height_uv = height_y >> vi.GetPlaneHeightSubsampling(PLANAR_U);
+                const int64_t h = row >> vi.GetPlaneHeightSubsampling(PLANAR_U);
+
+                env->BitBlt(reinterpret_cast<uint8_t*>(dst_u + h * dst_pitch_uv), dst_pitch_uv * sizeof(T),
+                    reinterpret_cast<const uint8_t*>(srcc_u + h * srcc_pitch_uv), srcc_pitch_uv * sizeof(T), width_uv, height_uv - static_cast<int>(h));
+                env->BitBlt(reinterpret_cast<uint8_t*>(dst_v + h * dst_pitch_uv), dst_pitch_uv * sizeof(T),
+                    reinterpret_cast<const uint8_t*>(srcc_v + h * srcc_pitch_uv), srcc_pitch_uv * sizeof(T), width_uv, height_uv - static_cast<int>(h));
             }
-        }
 
-        srcp_u += srcp_stride_uv;
-        srcp_v += srcp_stride_uv;
+            if (frame_stats)
+            {
+                std::lock_guard<std::mutex> lock(stats_mtx);
 
-        srcc_u += srcc_stride_uv;
-        srcc_v += srcc_stride_uv;
+                for (int i = 0; i < 4; ++i)
+                    frame_stats->blocks[i] += blocks[i];
+                for (int i = 0; i < 3; ++i)
+                    frame_stats->mask_pixels[i] += row_stats.mask_pixels[i];
 
-        srcn_u += srcn_stride_uv;
-        srcn_v += srcn_stride_uv;
+                frame_stats->blocks_skipped += blocks_skipped;
 
-        dst_u += dst_stride_uv;
-        dst_v += dst_stride_uv;
-    }
+                frame_stats->mask_ns += row_stats.mask_ns;
+                frame_stats->blend_ns += row_stats.blend_ns;
+            }
+        });
 }
 
+// Marks the blocks with a pixel above 0 in the luma of mask.
 template <typename T>
-static void processBlockRainbowMask(T* dst_u, T* dst_v, int block_width_uv, int block_height_uv, int dst_stride_uv, bool conservative_mask)
+void BifrostAnalyse::maskBlocks(const uint8_t* maskp, int pitch, uint8_t* active)
 {
-    // Maybe needed later.
-    T* tmp = dst_v;
-
-    //denoise mask, remove marked pixels with no horizontal marked neighbors
-    for (int y = 0; y < block_height_uv; ++y)
+    for (int y = roi_y0; y < roi_y1; ++y)
     {
-        dst_v[0] = dst_u[0] && dst_u[1];
+        uint8_t* active_row = active + blocks_x * static_cast<int64_t>(y);
 
-        for (int x = 1; x < block_width_uv - 1; ++x)
-            dst_v[x] = dst_u[x] && (dst_u[x - 1] || dst_u[x + 1]);
+        for (int line = 0; line < block_height; ++line)
+        {
+            const T* row = reinterpret_cast<const T*>(maskp + (block_height * static_cast<int64_t>(y) + line) * pitch);
 
-        dst_v[block_width_uv - 1] = dst_u[block_width_uv - 1] && dst_u[block_width_uv - 2];
+            for (int x = roi_x0; x < roi_x1; ++x)
+            {
+                if (active_row[x])
+                    continue;
 
-        dst_u += dst_stride_uv;
-        dst_v += dst_stride_uv;
+                for (int i = 0; i < block_width; ++i)
+                {
+                    if (row[x * block_width + i] > 0)
+                    {
+                        active_row[x] = 1;
+                        break;
+                    }
+                }
+            }
+        }
     }
+}
 
-    //expand mask vertically
-    if (!conservative_mask)
-    {
-        dst_v = tmp;
-
-        for (int x = 0; x < block_width_uv; ++x)
-            dst_v[x] = dst_v[x] || dst_v[x + dst_stride_uv];
+// Marks the blocks of the region of interest that are processed: all of them, or the ones roi_mask selects.
+void BifrostAnalyse::roiBlocks(int n, bool bottom, uint8_t* active, IScriptEnvironment* env)
+{
+    std::fill_n(active, blocks_x * static_cast<size_t>(blocks_y), 0);
 
-        dst_v += dst_stride_uv;
+    if (!roi_mask)
+    {
+        for (int y = roi_y0; y < roi_y1; ++y)
+            std::fill_n(active + blocks_x * static_cast<int64_t>(y) + roi_x0, roi_x1 - roi_x0, 1);
 
-        for (int y = 1; y < block_height_uv - 1; ++y)
-        {
-            for (int x = 0; x < block_width_uv; ++x)
-                dst_v[x] = dst_v[x] || (dst_v[x + dst_stride_uv] && dst_v[x - dst_stride_uv]);
+        return;
+    }
 
-            dst_v += dst_stride_uv;
-        }
+    const PVideoFrame mask = roi_mask->GetFrame(n, env);
+    const uint8_t* maskp = mask->GetReadPtr(PLANAR_Y) + ((bottom) ? mask->GetPitch(PLANAR_Y) : 0);
+    const int pitch = mask->GetPitch(PLANAR_Y) * fields;
 
-        for (int x = 0; x < block_width_uv; ++x)
-            dst_v[x] = dst_v[x] || dst_v[x - dst_stride_uv];
+    switch (roi_mask->GetVideoInfo().ComponentSize())
+    {
+        case 1: maskBlocks<uint8_t>(maskp, pitch, active); break;
+        case 2: maskBlocks<uint16_t>(maskp, pitch, active); break;
+        default: maskBlocks<float>(maskp, pitch, active); break;
     }
 }
 
-template <typename T>
-static void makeBlockRainbowMask(const T* srcp_u, const T* srcp_v,
-    const T* srcc_u, const T* srcc_v,
-    const T* srcn_u, const T* srcn_v,
-    T* dst_u, T* dst_v,
-    int block_width_uv, int block_height_uv,
-    int srcp_stride_uv, int srcc_stride_uv, int srcn_stride_uv, int dst_stride_uv,
-    int variation)
+PVideoFrame __stdcall BifrostAnalyse::GetFrame(int n, IScriptEnvironment* env)
 {
-    for (int y = 0; y < block_height_uv; ++y)
-    {
-        for (int x = 0; x < block_width_uv; ++x)
-        {
-            int up = srcp_u[x];
-            int uc = srcc_u[x];
-            int un = srcn_u[x];
+    //the units of both fields lie within two frames of n, the outer ones are only fetched when a block needs them
+    const int first = std::max(n - 2, 0);
 
-            int vp = srcp_v[x];
-            int vc = srcc_v[x];
-            int vn = srcn_v[x];
+    PVideoFrame src[5];
 
-            int ucup = uc - up;
-            int ucun = uc - un;
+    auto frame = [&](int f) -> PVideoFrame&
+    {
+        PVideoFrame& src_frame = src[f - first];
+        if (!src_frame)
+            src_frame = child->GetFrame(f, env);
 
-            int vcvp = vc - vp;
-            int vcvn = vc - vn;
+        return src_frame;
+    };
 
-            dst_u[x] = (((ucup + variation) & (ucun + variation)) < 0)
-                || (((-ucup + variation) & (-ucun + variation)) < 0)
-                || (((vcvp + variation) & (vcvn + variation)) < 0)
-                || (((-vcvp + variation) & (-vcvn + variation)) < 0);
-        }
+    auto unitPlanes = [&](int unit)
+    {
+        const PVideoFrame& src_frame = frame(unit / fields);
+        return srcPlanes(src_frame, isBottomField(src_frame, unit, env));
+    };
 
-        srcp_u += srcp_stride_uv;
-        srcp_v += srcp_stride_uv;
+    auto sceneChangeProp = [&](int unit, const char* key)
+    {
+        if (!scenechange)
+            return false;
 
-        srcc_u += srcc_stride_uv;
-        srcc_v += srcc_stride_uv;
+        int err;
+        const int64_t value = env->propGetInt(env->getFramePropsRO(frame(unit / fields)), key, 0, &err);
 
-        srcn_u += srcn_stride_uv;
-        srcn_v += srcn_stride_uv;
+        return value == 1 && !err;
+    };
 
-        dst_u += dst_stride_uv;
-        dst_v += dst_stride_uv;
-    }
-}
+    //scene changes before and after the frame of unit
+    auto cutBefore = [&](int unit) { return sceneChangeProp(unit, "_SceneChangePrev"); };
+    auto cutAfter = [&](int unit) { return sceneChangeProp(unit, "_SceneChangeNext"); };
 
-template <typename T>
-static void copyChromaBlock(T* dst_u, T* dst_v,
-    const T* src_u, const T* src_v,
-    int block_width_uv, int block_height_uv,
-    int dst_stride_uv, int src_stride_uv, int col)
-{
-    for (int y = 0; y < block_height_uv; ++y)
-    {
-        memcpy(dst_u, src_u, (block_width_uv + static_cast<int64_t>(col)) * sizeof(T));
-        memcpy(dst_v, src_v, (block_width_uv + static_cast<int64_t>(col)) * sizeof(T));
+    const int frame_threads = frameThreads(env);
 
-        dst_u += dst_stride_uv;
-        dst_v += dst_stride_uv;
-        src_u += src_stride_uv;
-        src_v += src_stride_uv;
-    }
-}
+    PVideoFrame& srcc_frame = frame(n);
 
-template <typename T>
-static float blockLumaDiff(const T* src1_y, const T* src2_y, int block_width, int block_height, int src1_stride_y, int src2_stride_y)
-{
-    int diff = 0;
+    //the analysis doesn't carry the properties of input
+    PVideoFrame dst = env->NewVideoFrame(vi);
+    uint8_t* dstp = dst->GetWritePtr(PLANAR_Y);
+    const int dst_pitch = dst->GetPitch(PLANAR_Y);
 
-    for (int y = 0; y < block_height; ++y)
+    FrameStats frame_stats = {};
+    FrameStats* fs = (stats) ? &frame_stats : nullptr;
+
+    auto attachTimes = [&]()
     {
-        for (int x = 0; x < block_width; ++x)
+        if (stats)
         {
-            diff += abs(src1_y[x] - src2_y[x]);
+            AVSMap* props = env->getFramePropsRW(dst);
+            env->propSetInt(props, "BifrostLumaDiffTime", frame_stats.lumadiff_ns, PROPAPPENDMODE_REPLACE);
+            env->propSetInt(props, "BifrostMaskTime", frame_stats.mask_ns, PROPAPPENDMODE_REPLACE);
         }
+    };
 
-        src1_y += src1_stride_y;
-        src2_y += src2_stride_y;
-    }
+    //the classes depend on the luma of frames n-1..n+1, roi_mask, how close n is to the ends of the clip
+    //and on the frames n-2 and n+2 when a block reads them
+    uint64_t result_key = 0;
+    if (results)
+    {
+        result_key = resultKey(n, frame, env);
+        if (roi_mask)
+            result_key = hashMix(result_key, frameHash(2, n, roi_mask->GetFrame(n, env), env));
 
-    return static_cast<float>(diff) / (block_width * block_height);
-}
+        ResultCache::Result cached;
+        if (findResult(n, result_key, frame, cached, env))
+        {
+            env->BitBlt(dstp, dst_pitch, cached.frame->GetReadPtr(PLANAR_Y), cached.frame->GetPitch(PLANAR_Y), vi.width, vi.height);
 
-class Bifrost : public GenericVideoFilter
-{
-    int offset;
-    PClip child2;
-    float luma_thresh;
-    int variation;
-    bool conservative_mask;
-    int block_width, block_height, block_width_uv, block_height_uv;
-    int blocks_x, blocks_y;
-    float relativeframediff;
-    bool has_at_least_v8;
+            attachTimes();
+            return dst;
+        }
+    }
 
-    template <typename T>
-    PVideoFrame Framedepth(PVideoFrame& dst, PVideoFrame& altsrcc, PVideoFrame& srcnn, PVideoFrame& srcn, PVideoFrame& srcc, PVideoFrame& srcp, PVideoFrame& srcpp, IScriptEnvironment* env);
+    std::vector<uint8_t> classes(blocks_x * static_cast<size_t>(blocks_y));
+    std::vector<uint8_t> active((roi) ? classes.size() : 0);
 
-    PVideoFrame (Bifrost::*depth)(PVideoFrame& dst, PVideoFrame& altsrcc, PVideoFrame& srcnn, PVideoFrame& srcn, PVideoFrame& srcc, PVideoFrame& srcp, PVideoFrame& srcpp, IScriptEnvironment* env);
+    const int units = vi.num_frames * fields;
 
-public:
-    Bifrost(PClip _child, PClip _child2, float _luma_thresh, int _variation, bool _conservative_mask, bool _interlaced, int _block_width, int _block_height, IScriptEnvironment* env)
-        : GenericVideoFilter(_child), child2(_child2), luma_thresh(_luma_thresh), variation(_variation), conservative_mask(_conservative_mask), block_width(_block_width), block_height(_block_height)
+    for (int field = 0; field < fields; ++field)
     {
-        if (luma_thresh < 0.0f || luma_thresh > 255.0f)
-            env->ThrowError("Bifrost: luma_thresh must be between 0.0..255.0.");
-        if (variation < 0 || variation > 255)
-            env->ThrowError("Bifrost: variation must be between 0..255.");
+        const int u = n * fields + field;
+        const int upp = std::max(u - offset * 2, 0);
+        const int up = std::max(u - offset, 0);
+        const int un = std::min(u + offset, units - 1);
+        const int unn = std::min(u + offset * 2, units - 1);
 
-        relativeframediff = 1.2f;
-        offset = _interlaced ? 2 : 1;
-        blocks_x = vi.width / block_width;
-        blocks_y = vi.height / block_height;
+        const SrcPlanes srcc = unitPlanes(u);
 
-        if (vi.ComponentSize() == 2)
-        {
-            const int peak = (1 << vi.BitsPerComponent()) - 1;
-            luma_thresh *= peak / 255;
-            variation *= peak / 255;
+        //roi_mask uses the lines of the current field
+        const bool bottom = isBottomField(srcc_frame, u, env);
 
-            depth = &Bifrost::Framedepth<uint16_t>;
+        //a field without blocks in the region of interest doesn't need its neighbours
+        bool any_active = true;
+        if (roi)
+        {
+            roiBlocks(n, bottom, active.data(), env);
+            any_active = std::find(active.begin(), active.end(), 1) != active.end();
         }
-        else
-            depth = &Bifrost::Framedepth<uint8_t>;
 
-        block_width_uv = block_width >> vi.GetPlaneWidthSubsampling(PLANAR_U);
-        block_height_uv = block_height >> vi.GetPlaneHeightSubsampling(PLANAR_U);
-        if (block_width_uv < 2 || block_height_uv < 2)
-            env->ThrowError("Bifrost: The requested block size is too small.");
+        //the frames across a scene change marked by the source aren't compared and aren't requested
+        const bool cut_prev = cutBefore(u);
+        const bool cut_next = cutAfter(u);
 
-        has_at_least_v8 = true;
-        try { env->CheckVersion(8); }
-        catch (const AvisynthError&) { has_at_least_v8 = false; };
-    }
+        //blocks recorded by an earlier run don't need the luma differences
+        if (!any_active)
+            std::fill(classes.begin(), classes.end(), passthrough_class);
+        else if (!analysis || !analysis->read(u, classes.data()))
+        {
+            const SrcPlanes srcp = (!cut_prev) ? unitPlanes(up) : srcc;
+            const SrcPlanes srcn = (!cut_next) ? unitPlanes(un) : srcc;
 
-    int __stdcall SetCacheHints(int cachehints, int frame_range) override
-    {
-        return cachehints == CACHE_GET_MTMODE ? MT_NICE_FILTER : 0;
-    }
+            const LumaDiffCache::Map ldprev = (cut_prev) ? cut_map : lumaDiffMap(up, u, srcp, srcc, frame_threads, fs);
+            const LumaDiffCache::Map ldnext = (cut_next) ? cut_map : lumaDiffMap(u, un, srcc, srcn, frame_threads, fs);
 
-    PVideoFrame __stdcall GetFrame(int n, IScriptEnvironment* env) override;
-};
+            //the second neighbour is only needed by blocks with movement on exactly one side
+            bool need_prevprev = false;
+            bool need_nextnext = false;
 
-template <typename T>
-PVideoFrame Bifrost::Framedepth(PVideoFrame& dst, PVideoFrame& altsrcc, PVideoFrame& srcnn, PVideoFrame& srcn, PVideoFrame& srcc, PVideoFrame& srcp, PVideoFrame& srcpp, IScriptEnvironment* env)
-{
-    const T* srcpp_y = reinterpret_cast<const T*>(srcpp->GetReadPtr(PLANAR_Y));
-    const T* srcpp_u = reinterpret_cast<const T*>(srcpp->GetReadPtr(PLANAR_U));
-    const T* srcpp_v = reinterpret_cast<const T*>(srcpp->GetReadPtr(PLANAR_V));
-          
-    const T* srcp_y = reinterpret_cast<const T*>(srcp->GetReadPtr(PLANAR_Y));
-    const T* srcp_u = reinterpret_cast<const T*>(srcp->GetReadPtr(PLANAR_U));
-    const T* srcp_v = reinterpret_cast<const T*>(srcp->GetReadPtr(PLANAR_V));
-          
-    const T* srcc_y = reinterpret_cast<const T*>(srcc->GetReadPtr(PLANAR_Y));
-    const T* srcc_u = reinterpret_cast<const T*>(srcc->GetReadPtr(PLANAR_U));
-    const T* srcc_v = reinterpret_cast<const T*>(srcc->GetReadPtr(PLANAR_V));
-          
-    const T* srcn_y = reinterpret_cast<const T*>(srcn->GetReadPtr(PLANAR_Y));
-    const T* srcn_u = reinterpret_cast<const T*>(srcn->GetReadPtr(PLANAR_U));
-    const T* srcn_v = reinterpret_cast<const T*>(srcn->GetReadPtr(PLANAR_V));
-          
-    const T* srcnn_y = reinterpret_cast<const T*>(srcnn->GetReadPtr(PLANAR_Y));
-    const T* srcnn_u = reinterpret_cast<const T*>(srcnn->GetReadPtr(PLANAR_U));
-    const T* srcnn_v = reinterpret_cast<const T*>(srcnn->GetReadPtr(PLANAR_V));
-          
-    const T* altsrcc_u = reinterpret_cast<const T*>(altsrcc->GetReadPtr(PLANAR_U));
-    const T* altsrcc_v = reinterpret_cast<const T*>(altsrcc->GetReadPtr(PLANAR_V));
+            for (size_t i = 0; i < ldprev->size(); ++i)
+            {
+                if ((*ldnext)[i] > luma_thresh && !((*ldprev)[i] > luma_thresh))
+                    need_prevprev = true;
+                else if ((*ldprev)[i] > luma_thresh && !((*ldnext)[i] > luma_thresh))
+                    need_nextnext = true;
+            }
+
+            const LumaDiffCache::Map ldprevprev = (!need_prevprev) ? LumaDiffCache::Map() : (cutBefore(up)) ? cut_map : lumaDiffMap(upp, up, unitPlanes(upp), srcp, frame_threads, fs);
+            const LumaDiffCache::Map ldnextnext = (!need_nextnext) ? LumaDiffCache::Map() : (cutAfter(un)) ? cut_map : lumaDiffMap(un, unn, srcn, unitPlanes(unn), frame_threads, fs);
+
+            classifyBlocks(ldprev->data(), ldnext->data(), ldprevprev ? ldprevprev->data() : nullptr, ldnextnext ? ldnextnext->data() : nullptr, classes.data(), frame_threads, fs);
+
+            if (analysis)
+                analysis->write(u, classes.data());
+        }
+
+        //the blocks outside the region are classified like the others, so the analysis file doesn't depend on roi_mask
+        if (roi)
+        {
+            for (size_t i = 0; i < classes.size(); ++i)
+            {
+                if (!active[i])
+                    classes[i] = passthrough_class;
+            }
+        }
+
+        if (blocks_x)
+            env->BitBlt(dstp + blocks_y * static_cast<int64_t>(field) * dst_pitch, dst_pitch, classes.data(), blocks_x, blocks_x, blocks_y);
+    }
 
-    T* dst_u = reinterpret_cast<T*>(dst->GetWritePtr(PLANAR_U));
-    T* dst_v = reinterpret_cast<T*>(dst->GetWritePtr(PLANAR_V));
+    if (results)
+        insertResult(n, result_key, dst, frame_stats, src, env);
 
-    const int srcpp_pitch_y = srcpp->GetPitch(PLANAR_Y) / sizeof(T);
-    const int srcpp_pitch_uv = srcpp->GetPitch(PLANAR_U) / sizeof(T);
+    attachTimes();
 
-    const int srcp_pitch_y = srcp->GetPitch(PLANAR_Y) / sizeof(T);
-    const int srcp_pitch_uv = srcp->GetPitch(PLANAR_U) / sizeof(T);
+    return dst;
+}
 
-    const int srcc_pitch_y = srcc->GetPitch(PLANAR_Y) / sizeof(T);
-    const int srcc_pitch_uv = srcc->GetPitch(PLANAR_U) / sizeof(T);
+PVideoFrame __stdcall BifrostApply::GetFrame(int n, IScriptEnvironment* env)
+{
+    //the units of both fields lie within two frames of n, only the ones and altclip a block needs are fetched
+    const int first = std::max(n - 2, 0);
 
-    const int srcn_pitch_y = srcn->GetPitch(PLANAR_Y) / sizeof(T);
-    const int srcn_pitch_uv = srcn->GetPitch(PLANAR_U) / sizeof(T);
+    PVideoFrame src[5];
+    PVideoFrame altsrcc;
 
-    const int srcnn_pitch_y = srcnn->GetPitch(PLANAR_Y) / sizeof(T);
-    const int srcnn_pitch_uv = srcnn->GetPitch(PLANAR_U) / sizeof(T);
+    auto frame = [&](int f) -> PVideoFrame&
+    {
+        PVideoFrame& src_frame = src[f - first];
+        if (!src_frame)
+            src_frame = child->GetFrame(f, env);
 
-    const int altsrcc_pitch_uv = srcc->GetPitch(PLANAR_U) / sizeof(T);
+        return src_frame;
+    };
 
-    const int dst_pitch_uv = dst->GetPitch(PLANAR_U) / sizeof(T);
+    auto unitPlanes = [&](int unit)
+    {
+        const PVideoFrame& src_frame = frame(unit / fields);
+        return srcPlanes(src_frame, isBottomField(src_frame, unit, env));
+    };
 
-    const int rowsize_y = srcc->GetRowSize(PLANAR_Y) / sizeof(T);
-    const int height_y = srcc->GetHeight(PLANAR_Y);
+    const int frame_threads = frameThreads(env);
 
-    env->BitBlt(dst->GetWritePtr(PLANAR_Y), dst->GetPitch(PLANAR_Y), srcc->GetReadPtr(PLANAR_Y), srcc->GetPitch(PLANAR_Y), srcc->GetRowSize(PLANAR_Y), height_y);
+    const PVideoFrame classes_frame = analysis->GetFrame(n, env);
+    PVideoFrame& srcc_frame = frame(n);
+    PVideoFrame dst = (has_at_least_v8) ? env->NewVideoFrameP(vi, &srcc_frame) : env->NewVideoFrame(vi);
 
-    const int col = (rowsize_y - rowsize_y / block_width * block_width) >> vi.GetPlaneWidthSubsampling(PLANAR_U);
+    FrameStats frame_stats = {};
+    FrameStats* fs = (stats || summary) ? &frame_stats : nullptr;
 
-    for (int y = 0; y < blocks_y; ++y)
+    //the time BifrostAnalyse spent on the classes
+    if (fs && has_at_least_v8)
     {
-        for (int x = 0; x < blocks_x; ++x)
+        const AVSMap* props = env->getFramePropsRO(classes_frame);
+        int err;
+        frame_stats.lumadiff_ns = env->propGetInt(props, "BifrostLumaDiffTime", 0, &err);
+        frame_stats.mask_ns = env->propGetInt(props, "BifrostMaskTime", 0, &err);
+    }
+
+    //the output depends on the classes, the source frames n-1..n+1, altclip, how close n is to the ends of the clip
+    //and on the frames n-2 and n+2 when a block reads them
+    uint64_t result_key = 0;
+    if (results)
+    {
+        result_key = hashMix(resultKey(n, frame, env), frameHash(2, n, classes_frame, env));
+        if (has_altclip)
         {
-            float ldprev = blockLumaDiff<T>(srcp_y + block_width * static_cast<int64_t>(x), srcc_y + block_width * static_cast<int64_t>(x), block_width, block_height, srcp_pitch_y, srcc_pitch_y);
-            float ldnext = blockLumaDiff<T>(srcc_y + block_width * static_cast<int64_t>(x), srcn_y + block_width * static_cast<int64_t>(x), block_width, block_height, srcc_pitch_y, srcn_pitch_y);
-            float ldprevprev = 0.0f;
-            float ldnextnext = 0.0f;
+            altsrcc = child2->GetFrame(n, env);
+            result_key = hashMix(result_key, frameHash(1, n, altsrcc, env));
+        }
 
-            //too much movement in both directions?
-            if (ldnext > luma_thresh && ldprev > luma_thresh)
+        ResultCache::Result cached;
+        if (findResult(n, result_key, frame, cached, env))
+        {
+            const int planes[3] = { PLANAR_Y, PLANAR_U, PLANAR_V };
+            for (int i = 0; i < 3; ++i)
             {
-                copyChromaBlock<T>(dst_u + block_width_uv * static_cast<int64_t>(x), dst_v + block_width_uv * static_cast<int64_t>(x),
-                    altsrcc_u + block_width_uv * static_cast<int64_t>(x), altsrcc_v + block_width_uv * static_cast<int64_t>(x),
-                    block_width_uv, block_height_uv, dst_pitch_uv, altsrcc_pitch_uv, (x == blocks_x - 1) ? col : 0);
-                continue;
+                const PVideoFrame& src_frame = (i) ? cached.frame : srcc_frame;
+                env->BitBlt(dst->GetWritePtr(planes[i]), dst->GetPitch(planes[i]), src_frame->GetReadPtr(planes[i]), src_frame->GetPitch(planes[i]),
+                    src_frame->GetRowSize(planes[i]), src_frame->GetHeight(planes[i]));
             }
 
-            if (ldnext > luma_thresh)
-            {
-                ldprevprev = blockLumaDiff<T>(srcpp_y + block_width * static_cast<int64_t>(x), srcp_y + block_width * static_cast<int64_t>(x), block_width, block_height, srcpp_pitch_y, srcp_pitch_y);
-            }
-            else if (ldprev > luma_thresh)
-            {
-                ldnextnext = blockLumaDiff<T>(srcn_y + block_width * static_cast<int64_t>(x), srcnn_y + block_width * static_cast<int64_t>(x), block_width, block_height, srcn_pitch_y, srcnn_pitch_y);
-            }
+            //the classes of the cached frame, the only time spent is the one of the analysis
+            const int64_t lumadiff_ns = frame_stats.lumadiff_ns;
+            const int64_t mask_ns = frame_stats.mask_ns;
+            frame_stats = cached.stats;
+            frame_stats.lumadiff_ns = lumadiff_ns;
+            frame_stats.mask_ns = mask_ns;
+            frame_stats.blend_ns = 0;
+            frame_stats.dup_hits = 1;
+            frame_stats.dup_misses = 0;
+
+            attachStats(dst, frame_stats, env);
+            return dst;
+        }
 
-            //two consecutive frames in one direction to generate mask?
-            if ((ldnext > luma_thresh && ldprevprev > luma_thresh) ||
-                (ldprev > luma_thresh && ldnextnext > luma_thresh))
-            {
-                copyChromaBlock<T>(dst_u + block_width_uv * static_cast<int64_t>(x), dst_v + block_width_uv * static_cast<int64_t>(x),
-                    altsrcc_u + block_width_uv * static_cast<int64_t>(x), altsrcc_v + block_width_uv * static_cast<int64_t>(x),
-                    block_width_uv, block_height_uv, dst_pitch_uv, altsrcc_pitch_uv, (x == blocks_x - 1) ? col : 0);
-                continue;
-            }
+        frame_stats.dup_misses = 1;
+    }
 
-            //generate mask from correct side of scenechange
-            if (ldnext > luma_thresh)
-            {
-                makeBlockRainbowMask<T>(srcpp_u + block_width_uv * static_cast<int64_t>(x), srcpp_v + block_width_uv * static_cast<int64_t>(x),
-                    srcp_u + block_width_uv * static_cast<int64_t>(x), srcp_v + block_width_uv * static_cast<int64_t>(x),
-                    srcc_u + block_width_uv * static_cast<int64_t>(x), srcc_v + block_width_uv * static_cast<int64_t>(x),
-                    dst_u + block_width_uv * static_cast<int64_t>(x), dst_v + block_width_uv * static_cast<int64_t>(x),
-                    block_width_uv, block_height_uv,
-                    srcpp_pitch_uv, srcp_pitch_uv, srcc_pitch_uv, dst_pitch_uv,
-                    variation);
-            }
-            else if (ldprev > luma_thresh)
-            {
-                makeBlockRainbowMask<T>(srcc_u + block_width_uv * static_cast<int64_t>(x), srcc_v + block_width_uv * static_cast<int64_t>(x),
-                    srcn_u + block_width_uv * static_cast<int64_t>(x), srcn_v + block_width_uv * static_cast<int64_t>(x),
-                    srcnn_u + block_width_uv * static_cast<int64_t>(x), srcnn_v + block_width_uv * static_cast<int64_t>(x),
-                    dst_u + block_width_uv * static_cast<int64_t>(x), dst_v + block_width_uv * static_cast<int64_t>(x),
-                    block_width_uv, block_height_uv,
-                    srcc_pitch_uv, srcn_pitch_uv, srcnn_pitch_uv, dst_pitch_uv,
-                    variation);
-            }
-            else
-            {
-                makeBlockRainbowMask<T>(srcp_u + block_width_uv * static_cast<int64_t>(x), srcp_v + block_width_uv * static_cast<int64_t>(x),
-                    srcc_u + block_width_uv * static_cast<int64_t>(x), srcc_v + block_width_uv * static_cast<int64_t>(x),
-                    srcn_u + block_width_uv * static_cast<int64_t>(x), srcn_v + block_width_uv * static_cast<int64_t>(x),
-                    dst_u + block_width_uv * static_cast<int64_t>(x), dst_v + block_width_uv * static_cast<int64_t>(x),
-                    block_width_uv, block_height_uv,
-                    srcp_pitch_uv, srcc_pitch_uv, srcn_pitch_uv, dst_pitch_uv,
-                    variation);
-            }
+    std::vector<uint8_t> classes(blocks_x * static_cast<size_t>(blocks_y));
 
-            //denoise and expand mask
-            processBlockRainbowMask<T>(dst_u + block_width_uv * static_cast<int64_t>(x), dst_v + block_width_uv * static_cast<int64_t>(x),
-                block_width_uv, block_height_uv, dst_pitch_uv, conservative_mask);
+    const int units = vi.num_frames * fields;
 
-            //determine direction to blend in
-            BlendDirection direction;
-            if (ldprev > ldnext * relativeframediff)
-                direction = bdNext;
-            else if (ldnext > ldprev * relativeframediff)
-                direction = bdPrev;
-            else
-                direction = bdBoth;
+    for (int field = 0; field < fields; ++field)
+    {
+        const int u = n * fields + field;
+        const int upp = std::max(u - offset * 2, 0);
+        const int up = std::max(u - offset, 0);
+        const int un = std::min(u + offset, units - 1);
+        const int unn = std::min(u + offset * 2, units - 1);
+
+        const SrcPlanes srcc = unitPlanes(u);
+
+        //altclip and the output use the lines of the current field
+        const bool bottom = isBottomField(srcc_frame, u, env);
+
+        if (blocks_x)
+            env->BitBlt(classes.data(), blocks_x, classes_frame->GetReadPtr(PLANAR_Y) + blocks_y * static_cast<int64_t>(field) * classes_frame->GetPitch(PLANAR_Y),
+                classes_frame->GetPitch(PLANAR_Y), blocks_x, blocks_y);
+
+        //only the frames the masks and blends of the blocks read are requested: a block next to a scene change doesn't read the other side of it
+        //and altclip is only read by the blocks with too much movement
+        //show=1 reads only the current frame, show=2 only the frames of the masks
+        bool need_prevprev = false;
+        bool need_prev = false;
+        bool need_next = false;
+        bool need_nextnext = false;
+        bool need_altclip = false;
+
+        if (show != 1)
+        {
+            for (uint8_t c : classes)
+            {
+                const int source = c & 3;
+                const int direction = c >> 2;
+
+                if (source == msFallback)
+                {
+                    need_altclip |= direction != bdNone && !show;
+                    continue;
+                }
 
-            applyBlockRainbowMask<T>(srcp_u + block_width_uv * static_cast<int64_t>(x), srcp_v + block_width_uv * static_cast<int64_t>(x),
-                srcc_u + block_width_uv * static_cast<int64_t>(x), srcc_v + block_width_uv * static_cast<int64_t>(x),
-                srcn_u + block_width_uv * static_cast<int64_t>(x), srcn_v + block_width_uv * static_cast<int64_t>(x),
-                dst_u + block_width_uv * static_cast<int64_t>(x), dst_v + block_width_uv * static_cast<int64_t>(x),
-                block_width_uv, block_height_uv,
-                srcp_pitch_uv, srcc_pitch_uv, srcn_pitch_uv, dst_pitch_uv,
-                direction, (x == blocks_x - 1) ? col : 0);
+                need_prevprev |= source == msPrev;
+                need_prev |= source != msNext || (direction != bdNext && !show);
+                need_next |= source != msPrev || (direction != bdPrev && !show);
+                need_nextnext |= source == msNext;
+            }
         }
 
-        srcpp_y += block_height * static_cast<int64_t>(srcpp_pitch_y);
-        srcpp_u += block_height_uv * static_cast<int64_t>(srcpp_pitch_uv);
-        srcpp_v += block_height_uv * static_cast<int64_t>(srcpp_pitch_uv);
+        //unused source pointers are never read, they just point at a valid frame
+        const SrcPlanes srcp = need_prev ? unitPlanes(up) : srcc;
+        const SrcPlanes srcn = need_next ? unitPlanes(un) : srcc;
+        const SrcPlanes srcpp = need_prevprev ? unitPlanes(upp) : srcp;
+        const SrcPlanes srcnn = need_nextnext ? unitPlanes(unn) : srcn;
 
-        srcp_y += block_height * static_cast<int64_t>(srcp_pitch_y);
-        srcp_u += block_height_uv * static_cast<int64_t>(srcp_pitch_uv);
-        srcp_v += block_height_uv * static_cast<int64_t>(srcp_pitch_uv);
+        if (need_altclip && !altsrcc)
+            altsrcc = child2->GetFrame(n, env);
 
-        srcc_y += block_height * static_cast<int64_t>(srcc_pitch_y);
-        srcc_u += block_height_uv * static_cast<int64_t>(srcc_pitch_uv);
-        srcc_v += block_height_uv * static_cast<int64_t>(srcc_pitch_uv);
+        (this->*depth)(dstPlanes(dst, bottom), (need_altclip) ? srcPlanes(altsrcc, bottom) : srcc, srcnn, srcn, srcc, srcp, srcpp,
+            classes.data(), frame_threads, fs, env);
+    }
 
-        srcn_y += block_height * static_cast<int64_t>(srcn_pitch_y);
-        srcn_u += block_height_uv * static_cast<int64_t>(srcn_pitch_uv);
-        srcn_v += block_height_uv * static_cast<int64_t>(srcn_pitch_uv);
+    if (results)
+        insertResult(n, result_key, dst, frame_stats, src, env);
 
-        srcnn_y += block_height * static_cast<int64_t>(srcnn_pitch_y);
-        srcnn_u += block_height_uv * static_cast<int64_t>(srcnn_pitch_uv);
-        srcnn_v += block_height_uv * static_cast<int64_t>(srcnn_pitch_uv);
+    attachStats(dst, frame_stats, env);
 
-        altsrcc_u += block_height_uv * static_cast<int64_t>(altsrcc_pitch_uv);
-        altsrcc_v += block_height_uv * static_cast<int64_t>(altsrcc_pitch_uv);
+    return dst;
+}
 
-        dst_u += block_height_uv * static_cast<int64_t>(dst_pitch_uv);
-        dst_v += block_height_uv * static_cast<int64_t>(dst_pitch_uv);
+// Frame properties of stats and the totals of stats_file.
+void BifrostApply::attachStats(PVideoFrame& dst, const FrameStats& frame_stats, IScriptEnvironment* env)
+{
+    if (stats)
+    {
+        AVSMap* props = env->getFramePropsRW(dst);
+
+        env->propSetInt(props, "BifrostBlocksStatic", frame_stats.blocks[msCurrent], PROPAPPENDMODE_REPLACE);
+        env->propSetInt(props, "BifrostBlocksOneSided", frame_stats.blocks[msPrev] + frame_stats.blocks[msNext], PROPAPPENDMODE_REPLACE);
+        env->propSetInt(props, "BifrostBlocksFallback", frame_stats.blocks[msFallback], PROPAPPENDMODE_REPLACE);
+        env->propSetInt(props, "BifrostBlocksSkipped", frame_stats.blocks_skipped, PROPAPPENDMODE_REPLACE);
+        env->propSetInt(props, "BifrostMaskNext", frame_stats.mask_pixels[bdNext], PROPAPPENDMODE_REPLACE);
+        env->propSetInt(props, "BifrostMaskPrev", frame_stats.mask_pixels[bdPrev], PROPAPPENDMODE_REPLACE);
+        env->propSetInt(props, "BifrostMaskBoth", frame_stats.mask_pixels[bdBoth], PROPAPPENDMODE_REPLACE);
+        env->propSetInt(props, "BifrostLumaDiffTime", frame_stats.lumadiff_ns, PROPAPPENDMODE_REPLACE);
+        env->propSetInt(props, "BifrostMaskTime", frame_stats.mask_ns, PROPAPPENDMODE_REPLACE);
+        env->propSetInt(props, "BifrostBlendTime", frame_stats.blend_ns, PROPAPPENDMODE_REPLACE);
+        if (results)
+            env->propSetInt(props, "BifrostDupCacheHit", frame_stats.dup_hits, PROPAPPENDMODE_REPLACE);
     }
 
-    const int row = height_y / block_height * block_height;
-    if (row != height_y)
+    if (summary)
     {
-        const int width_uv = srcc->GetRowSize(PLANAR_U);
-        const int height_uv = srcc->GetHeight(PLANAR_U);
-        const int h = row >> vi.GetPlaneHeightSubsampling(PLANAR_U);
+        std::lock_guard<std::mutex> lock(summary_mtx);
+        summary_stats.add(frame_stats);
+        ++summary_frames;
+    }
+}
+
+// Shares the workers with the frames the host is already processing in parallel.
+int BifrostBase::frameThreads(IScriptEnvironment* env)
+{
+    if (has_at_least_v8 && threads > 1)
+        return std::max(threads / std::max(static_cast<int>(env->GetEnvProperty(AEP_FILTERCHAIN_THREADS)), 1), 1);
 
-        for (int y = h; y < height_uv; ++y)
+    return threads;
+}
+
+// The hash of frame n of input (clip 0), altclip (1) or roi_mask or analysis (2, luma only), computed once per frame.
+// For input it includes the planes and the properties the output depends on and the field order.
+uint64_t BifrostBase::frameHash(int clip, int n, const PVideoFrame& frame, IScriptEnvironment* env)
+{
+    return *frame_hashes->get(n, clip, [&]()
         {
-            memcpy(dst_u, srcc_u, width_uv);
-            memcpy(dst_v, srcc_v, width_uv);
+            const int planes[3] = { PLANAR_Y, PLANAR_U, PLANAR_V };
+            const int num_planes = (clip == 0) ? hashed_planes : (clip == 1) ? 3 : 1;
+            uint64_t h = 0;
 
-            srcc_u += srcc_pitch_uv;
-            srcc_v += srcc_pitch_uv;
-            dst_u += dst_pitch_uv;
-            dst_v += dst_pitch_uv;
-        }
+            for (int i = 0; i < num_planes; ++i)
+                h = hashMix(h, hashPlane(frame->GetReadPtr(planes[i]), frame->GetPitch(planes[i]), frame->GetRowSize(planes[i]), frame->GetHeight(planes[i])));
+
+            if (clip == 0)
+            {
+                if (fields == 2)
+                    h = hashMix(h, child->GetParity(n));
+
+                for (const char* key : hashed_props)
+                {
+                    int err;
+                    h = hashMix(h, env->propGetInt(env->getFramePropsRO(frame), key, 0, &err));
+                }
+            }
+
+            return h;
+        });
+}
+
+void BifrostBase::insertResult(int n, uint64_t key, const PVideoFrame& dst, const FrameStats& frame_stats, const PVideoFrame* src, IScriptEnvironment* env)
+{
+    const int first = std::max(n - 2, 0);
+    const int outer_frames[2] = { n - 2, (n + 2 < vi.num_frames) ? n + 2 : -1 };
+
+    ResultCache::Result result{};
+    result.frame = dst;
+    result.stats = frame_stats;
+
+    //the frames that weren't requested can't have changed the output
+    for (int i = 0; i < 2; ++i)
+    {
+        result.outer_read[i] = outer_frames[i] >= 0 && src[outer_frames[i] - first];
+        result.outer_hash[i] = (result.outer_read[i]) ? frameHash(0, outer_frames[i], src[outer_frames[i] - first], env) : 0;
     }
 
-    return dst;
+    results->insert(key, result);
+}
+
+// Totals of every frame requested from the filter, one "key=value" per line.
+void BifrostApply::writeSummary()
+{
+    std::lock_guard<std::mutex> lock(summary_mtx);
+
+    fprintf(summary, "frames=%lld\n", static_cast<long long>(summary_frames));
+    fprintf(summary, "blocks_static=%lld\n", static_cast<long long>(summary_stats.blocks[msCurrent]));
+    fprintf(summary, "blocks_one_sided=%lld\n", static_cast<long long>(summary_stats.blocks[msPrev] + summary_stats.blocks[msNext]));
+    fprintf(summary, "blocks_fallback=%lld\n", static_cast<long long>(summary_stats.blocks[msFallback]));
+    fprintf(summary, "blocks_skipped=%lld\n", static_cast<long long>(summary_stats.blocks_skipped));
+    fprintf(summary, "mask_next=%lld\n", static_cast<long long>(summary_stats.mask_pixels[bdNext]));
+    fprintf(summary, "mask_prev=%lld\n", static_cast<long long>(summary_stats.mask_pixels[bdPrev]));
+    fprintf(summary, "mask_both=%lld\n", static_cast<long long>(summary_stats.mask_pixels[bdBoth]));
+    fprintf(summary, "lumadiff_ns=%lld\n", static_cast<long long>(summary_stats.lumadiff_ns));
+    fprintf(summary, "mask_ns=%lld\n", static_cast<long long>(summary_stats.mask_ns));
+    fprintf(summary, "blend_ns=%lld\n", static_cast<long long>(summary_stats.blend_ns));
+
+    if (results)
+    {
+        fprintf(summary, "dup_cache_hits=%lld\n", static_cast<long long>(summary_stats.dup_hits));
+        fprintf(summary, "dup_cache_misses=%lld\n", static_cast<long long>(summary_stats.dup_misses));
+    }
 }
 
+// Checks the format of input and the block size, the same for the three filters.
+static void checkInput(const VideoInfo& vi, int blockx, int blocky, IScriptEnvironment* env)
+{
+    if (!vi.IsPlanar() || vi.IsRGB() || vi.NumComponents() != 3)
+        env->ThrowError("Bifrost: clip must be in YUV planar format and must have 3 planes.");
+
+    if (blockx % (1 << vi.GetPlaneWidthSubsampling(PLANAR_U)) || blocky % (1 << vi.GetPlaneHeightSubsampling(PLANAR_U)))
+        env->ThrowError("Bifrost: The requested block size is incompatible with the clip's subsampling.");
+}
 
-PVideoFrame __stdcall Bifrost::GetFrame(int n, IScriptEnvironment* env)
+static PClip roiMaskArg(const AVSValue& arg, const VideoInfo& vi, IScriptEnvironment* env)
 {
-    PVideoFrame srcpp = child->GetFrame(std::max(n - offset * 2, 0), env);
-    PVideoFrame srcp = child->GetFrame(std::max(n - offset, 0), env);
-    PVideoFrame srcc = child->GetFrame(n, env);
-    PVideoFrame srcn = child->GetFrame(std::min(n + offset, vi.num_frames - 1), env);
-    PVideoFrame srcnn = child->GetFrame(std::min(n + offset * 2, vi.num_frames - 1), env);
+    if (!arg.Defined())
+        return PClip();
 
-    PVideoFrame altsrcc = child2->GetFrame(n, env);
+    const VideoInfo& vi_mask = arg.AsClip()->GetVideoInfo();
+    if (!vi_mask.IsPlanar() || vi_mask.IsRGB() || vi_mask.width != vi.width || vi_mask.height != vi.height || vi_mask.num_frames != vi.num_frames)
+        env->ThrowError("Bifrost: roi_mask must be in Y or YUV planar format and must have the same dimensions and length as clip.");
 
-    PVideoFrame dst = (has_at_least_v8) ? env->NewVideoFrameP(vi, &srcc) : env->NewVideoFrame(vi);
+    return arg.AsClip();
+}
+
+static PClip altclipArg(const AVSValue& arg, const VideoInfo& vi, IScriptEnvironment* env)
+{
+    if (!arg.Defined())
+        return PClip();
+
+    const VideoInfo& vi2 = arg.AsClip()->GetVideoInfo();
+    if (!vi.IsSameColorspace(vi2) || vi.width != vi2.width || vi.height != vi2.height || vi.num_frames != vi2.num_frames)
+        env->ThrowError("Bifrost: The two clips must have the same pixel type, dimensions and length.");
 
-    return (this->*depth)(dst, altsrcc, srcnn, srcn, srcc, srcp, srcpp, env);
+    return arg.AsClip();
 }
 
 AVSValue __cdecl Create_Bifrost(AVSValue args, void* user_data, IScriptEnvironment* env)
@@ -496,37 +1991,57 @@ AVSValue __cdecl Create_Bifrost(AVSValue args, void* user_data, IScriptEnvironme
     PClip clip = args[0].AsClip();
     const VideoInfo& vi = clip->GetVideoInfo();
 
-    if (!vi.IsPlanar() || vi.IsRGB() || vi.NumComponents() != 3 || vi.BitsPerComponent() == 32)
-        env->ThrowError("Bifrost: clip must be in YUV 8..16-bit planar format and must have 3 planes.");
-
+    const bool interlaced = args[5].AsBool(true);
     const int blockx = args[6].AsInt(4);
     const int blocky = args[7].AsInt(4);
+    const int opt = args[8].AsInt(-1);
+    const int threads = args[9].AsInt(1);
+    const bool stats = args[10].AsBool(false);
+    const char* stats_file = args[11].AsString(nullptr);
+    const int dup_cache = args[21].AsInt(0);
 
-    if (blockx % (1 << vi.GetPlaneWidthSubsampling(PLANAR_U)) || blocky % (1 << vi.GetPlaneHeightSubsampling(PLANAR_U)))
-        env->ThrowError("Bifrost: The requested block size is incompatible with the clip's subsampling.");
+    checkInput(vi, blockx, blocky, env);
 
-    PClip InClip = [&]()
-    {
-        if (args[1].Defined())
-        {
-            const VideoInfo& vi2 = args[1].AsClip()->GetVideoInfo();
+    const PClip roi_mask = roiMaskArg(args[18], vi, env);
+    const PClip altclip = altclipArg(args[1], vi, env);
 
-            if (vi.IsSameColorspace(vi2) || vi.width != vi2.width || vi.height != vi2.height || vi.num_frames != vi2.num_frames)
-                env->ThrowError("Bifrost: The two clips must have the same pixel type, dimensions and length.");
+    //the analysis only measures its times when they are reported, and shares its workers with the blending
+    BifrostAnalyse* analyse = new BifrostAnalyse(clip, (float)args[2].AsFloat(10.0), interlaced, blockx, blocky, opt, threads, stats || (stats_file && stats_file[0]),
+        args[12].AsString(nullptr), args[13].AsInt(0), args[14].AsInt(0), args[15].AsInt(0), args[16].AsInt(0), args[17].AsInt(0), roi_mask,
+        args[19].AsBool(false), args[20].AsInt(1), dup_cache, nullptr, env);
+    const PClip analysis = analyse;
 
-            return args[1].AsClip();
-        }
-        else
-            return clip;
-    }();
+    return new BifrostApply(clip, analysis, altclip, args[3].AsInt(5), args[4].AsBool(false), interlaced, blockx, blocky, opt, threads, stats, stats_file, dup_cache,
+        args[22].AsInt(0), analyse->threadPool(), env);
+}
 
-    if (args[5].AsBool(true))
-    {
-        InClip = env->Invoke("SeparateFields", InClip).AsClip();
-        return env->Invoke("Weave", new Bifrost(env->Invoke("SeparateFields", clip).AsClip(), InClip, (float)args[2].AsFloat(10.0), args[3].AsInt(5), args[4].AsBool(false), true, blockx, blocky, env));
-    }
-    else
-        return new Bifrost(clip, InClip, (float)args[2].AsFloat(10.0), args[3].AsInt(5), args[4].AsBool(false), false, blockx, blocky, env);
+AVSValue __cdecl Create_BifrostAnalyse(AVSValue args, void* user_data, IScriptEnvironment* env)
+{
+    PClip clip = args[0].AsClip();
+    const VideoInfo& vi = clip->GetVideoInfo();
+
+    const int blockx = args[3].AsInt(4);
+    const int blocky = args[4].AsInt(4);
+
+    checkInput(vi, blockx, blocky, env);
+
+    return new BifrostAnalyse(clip, (float)args[1].AsFloat(10.0), args[2].AsBool(true), blockx, blocky, args[5].AsInt(-1), args[6].AsInt(1), args[7].AsBool(false),
+        args[8].AsString(nullptr), args[9].AsInt(0), args[10].AsInt(0), args[11].AsInt(0), args[12].AsInt(0), args[13].AsInt(0), roiMaskArg(args[14], vi, env),
+        args[15].AsBool(false), args[16].AsInt(1), args[17].AsInt(0), nullptr, env);
+}
+
+AVSValue __cdecl Create_BifrostApply(AVSValue args, void* user_data, IScriptEnvironment* env)
+{
+    PClip clip = args[0].AsClip();
+    const VideoInfo& vi = clip->GetVideoInfo();
+
+    const int blockx = args[6].AsInt(4);
+    const int blocky = args[7].AsInt(4);
+
+    checkInput(vi, blockx, blocky, env);
+
+    return new BifrostApply(clip, args[1].AsClip(), altclipArg(args[2], vi, env), args[3].AsInt(5), args[4].AsBool(false), args[5].AsBool(true), blockx, blocky,
+        args[8].AsInt(-1), args[9].AsInt(1), args[10].AsBool(false), args[11].AsString(nullptr), args[12].AsInt(0), args[13].AsInt(0), nullptr, env);
 }
 
 const AVS_Linkage* AVS_linkage;
@@ -536,8 +2051,9 @@ const char* __stdcall AvisynthPluginInit3(IScriptEnvironment * env, const AVS_Li
 {
     AVS_linkage = vectors;
 
-    env->AddFunction("Bifrost", "c[altclip]c[luma_thresh]f[variation]i[conservative_mask]b[interlaced]b[blockx]i[blocky]i", Create_Bifrost, 0);
+    env->AddFunction("Bifrost", "c[altclip]c[luma_thresh]f[variation]i[conservative_mask]b[interlaced]b[blockx]i[blocky]i[opt]i[threads]i[stats]b[stats_file]s[analysis_file]s[superblock]i[roi_left]i[roi_top]i[roi_width]i[roi_height]i[roi_mask]c[scenechange]b[motion_scale]i[dup_cache]i[show]i", Create_Bifrost, 0);
+    env->AddFunction("BifrostAnalyse", "c[luma_thresh]f[interlaced]b[blockx]i[blocky]i[opt]i[threads]i[stats]b[analysis_file]s[superblock]i[roi_left]i[roi_top]i[roi_width]i[roi_height]i[roi_mask]c[scenechange]b[motion_scale]i[dup_cache]i", Create_BifrostAnalyse, 0);
+    env->AddFunction("BifrostApply", "cc[altclip]c[variation]i[conservative_mask]b[interlaced]b[blockx]i[blocky]i[opt]i[threads]i[stats]b[stats_file]s[dup_cache]i[show]i", Create_BifrostApply, 0);
 
     return 0;
 };
-
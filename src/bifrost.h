@@ -0,0 +1,725 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+enum BlendDirection
+{
+    bdNext,
+    bdPrev,
+    bdBoth,
+    bdNone  // with msFallback: outside the region of interest, the chroma is copied from srcc
+};
+
+// Computes the average absolute luma difference of every block in one row of blocks.
+// Strides are in pixels. diff must hold blocks_x values.
+typedef void (*LumaDiffRowFunction)(const void* src1_y, const void* src2_y, int src1_stride_y, int src2_stride_y,
+    int block_width, int block_height, int blocks_x, float* diff);
+
+// Averages every Scale x Scale square of luma into one pixel of a row of width pixels, rounded to the nearest for integers.
+// The stride is in pixels.
+typedef void (*DecimateRowFunction)(const void* src_y, int src_stride_y, void* dst, int width);
+
+// The helpers below are compiled into every instruction set's translation unit,
+// so they must not have external linkage.
+namespace
+{
+
+// Column sums are produced left to right by the SIMD kernels and folded into per-block results here,
+// so the result is identical to summing each block on its own. Float sums are always added in this order,
+// so every instruction set gives the same result.
+template <typename Sum = int>
+class LumaDiffAccumulator
+{
+    float* diff;
+    int block_width;
+    int area;
+    Sum sum;
+    int col;
+
+public:
+    LumaDiffAccumulator(float* _diff, int _block_width, int _block_height)
+        : diff(_diff), block_width(_block_width), area(_block_width * _block_height), sum(0), col(0)
+    {
+    }
+
+    inline void add(Sum colsum)
+    {
+        sum += colsum;
+
+        if (++col == block_width)
+        {
+            *diff++ = static_cast<float>(sum) / area;
+            sum = 0;
+            col = 0;
+        }
+    }
+};
+
+} // namespace
+
+// Column and block sums are integers, or floats for 32-bit clips.
+template <typename T>
+using LumaSum = typename std::conditional<std::is_same<T, float>::value, float, int>::type;
+
+template <typename T>
+static inline LumaSum<T> lumaColumnDiff(const T* src1_y, const T* src2_y, int src1_stride_y, int src2_stride_y, int block_height)
+{
+    LumaSum<T> diff = 0;
+
+    for (int y = 0; y < block_height; ++y)
+    {
+        diff += (src1_y[0] > src2_y[0]) ? src1_y[0] - src2_y[0] : src2_y[0] - src1_y[0];
+
+        src1_y += src1_stride_y;
+        src2_y += src2_stride_y;
+    }
+
+    return diff;
+}
+
+// Pixels x0..width-1 of a decimated row, the tail of the SIMD versions.
+template <typename T, int Scale>
+static inline void decimatePixels(const T* src_y, int src_stride_y, T* dst, int x0, int width)
+{
+    for (int x = x0; x < width; ++x)
+    {
+        LumaSum<T> sum = 0;
+
+        for (int y = 0; y < Scale; ++y)
+        {
+            for (int i = 0; i < Scale; ++i)
+                sum += src_y[src_stride_y * static_cast<int64_t>(y) + x * Scale + i];
+        }
+
+        if constexpr (std::is_same<T, float>::value)
+            dst[x] = sum * (1.0f / (Scale * Scale));
+        else
+            dst[x] = static_cast<T>((sum + Scale * Scale / 2) / (Scale * Scale));
+    }
+}
+
+template <typename T, int Scale>
+void decimateRow_c(const void* src_y, int src_stride_y, void* dst, int width);
+template <typename T, int Scale>
+void decimateRow_sse2(const void* src_y, int src_stride_y, void* dst, int width);
+template <typename T, int Scale>
+void decimateRow_avx2(const void* src_y, int src_stride_y, void* dst, int width);
+
+template <typename T>
+void lumaDiffRow_c(const void* src1_y, const void* src2_y, int src1_stride_y, int src2_stride_y, int block_width, int block_height, int blocks_x, float* diff);
+template <typename T>
+void lumaDiffRow_sse2(const void* src1_y, const void* src2_y, int src1_stride_y, int src2_stride_y, int block_width, int block_height, int blocks_x, float* diff);
+void lumaDiffRow_sse41(const void* src1_y, const void* src2_y, int src1_stride_y, int src2_stride_y, int block_width, int block_height, int blocks_x, float* diff);
+template <typename T>
+void lumaDiffRow_avx2(const void* src1_y, const void* src2_y, int src1_stride_y, int src2_stride_y, int block_width, int block_height, int blocks_x, float* diff);
+template <>
+void lumaDiffRow_avx2<float>(const void* src1_y, const void* src2_y, int src1_stride_y, int src2_stride_y, int block_width, int block_height, int blocks_x, float* diff);
+template <typename T>
+void lumaDiffRow_avx512(const void* src1_y, const void* src2_y, int src1_stride_y, int src2_stride_y, int block_width, int block_height, int blocks_x, float* diff);
+
+// 64-bit hash of row_size bytes of every line of a plane, the same for every instruction set.
+// Every line is split into stripes of 32 bytes, the last one padded with zeros. Four 64-bit lanes accumulate
+// lo32(v ^ key) * hi32(v ^ key) + v of their 8 bytes with a key for each of 16 stripes, and are scrambled
+// after every 16 stripes and at the end of every line, so the order of the stripes matters.
+typedef uint64_t (*HashPlaneFunction)(const uint8_t* srcp, int pitch, int row_size, int height);
+
+struct HashKeys
+{
+    uint64_t stripe[16][4];
+    uint64_t scramble[4];
+};
+
+static constexpr HashKeys makeHashKeys()
+{
+    //splitmix64
+    HashKeys keys = {};
+    uint64_t x = 0;
+
+    for (int i = 0; i < 17 * 4; ++i)
+    {
+        x += 0x9E3779B97F4A7C15ULL;
+        uint64_t z = x;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        z ^= z >> 31;
+
+        if (i < 16 * 4)
+            keys.stripe[i / 4][i % 4] = z;
+        else
+            keys.scramble[i % 4] = z;
+    }
+
+    return keys;
+}
+
+static constexpr HashKeys hash_keys = makeHashKeys();
+static constexpr uint32_t hash_prime = 0x9E3779B1U;
+static constexpr int hash_stripe = 32;
+
+static inline void hashStripe(uint64_t acc[4], const uint8_t* p, const uint64_t* key)
+{
+    for (int i = 0; i < 4; ++i)
+    {
+        uint64_t v;
+        memcpy(&v, p + 8 * i, 8);
+        const uint64_t k = v ^ key[i];
+        acc[i] += (k & 0xFFFFFFFF) * (k >> 32) + v;
+    }
+}
+
+static inline void hashScramble(uint64_t acc[4])
+{
+    for (int i = 0; i < 4; ++i)
+        acc[i] = (acc[i] ^ (acc[i] >> 47) ^ hash_keys.scramble[i]) * hash_prime;
+}
+
+static inline uint64_t hashMix(uint64_t h, uint64_t v)
+{
+    h = (h ^ v) * 0x9FB21C651E98DF25ULL;
+    return h ^ (h >> 32);
+}
+
+static inline uint64_t hashFinish(const uint64_t acc[4], int row_size, int height)
+{
+    uint64_t h = hashMix(static_cast<uint64_t>(row_size) << 32 | static_cast<uint32_t>(height), 0);
+    for (int i = 0; i < 4; ++i)
+        h = hashMix(h, acc[i]);
+
+    //murmur3 finalizer
+    h = (h ^ (h >> 33)) * 0xFF51AFD7ED558CCDULL;
+    h = (h ^ (h >> 33)) * 0xC4CEB9FE1A85EC53ULL;
+    return h ^ (h >> 33);
+}
+
+// The initial lanes and the zero padded last stripe of a line.
+static inline void hashInit(uint64_t acc[4])
+{
+    for (int i = 0; i < 4; ++i)
+        acc[i] = hash_keys.scramble[3 - i];
+}
+
+static inline const uint8_t* hashTail(const uint8_t* srcp, int x, int row_size, uint8_t* buffer)
+{
+    memset(buffer, 0, hash_stripe);
+    memcpy(buffer, srcp + x, row_size - x);
+    return buffer;
+}
+
+uint64_t hashPlane_c(const uint8_t* srcp, int pitch, int row_size, int height);
+uint64_t hashPlane_sse2(const uint8_t* srcp, int pitch, int row_size, int height);
+uint64_t hashPlane_avx2(const uint8_t* srcp, int pitch, int row_size, int height);
+
+// Copies rows with non-temporal stores, for a plane that isn't read back. The stores are fenced before it returns.
+void streamRows_sse2(uint8_t* dstp, int dst_pitch, const uint8_t* srcp, int src_pitch, int row_size, int height);
+
+// Frames a block's rainbow mask is generated from.
+enum MaskSource : uint8_t
+{
+    msFallback, // too much movement, the chroma is copied from altclip
+    msCurrent,  // srcp, srcc, srcn
+    msPrev,     // srcpp, srcp, srcc: movement after the current frame
+    msNext      // srcc, srcn, srcnn: movement before the current frame
+};
+
+// Filled by a block row when statistics are collected. Times are in nanoseconds.
+struct BlockRowStats
+{
+    int64_t mask_ns;
+    int64_t blend_ns;
+    int64_t mask_pixels[3]; // blended pixels of every BlendDirection
+};
+
+// One row of blocks. All chroma pointers point at the first pixel of the row, pitches are in pixels.
+struct BlockRow
+{
+    const void* srcpp_u;
+    const void* srcpp_v;
+    const void* srcp_u;
+    const void* srcp_v;
+    const void* srcc_u;
+    const void* srcc_v;
+    const void* srcn_u;
+    const void* srcn_v;
+    const void* srcnn_u;
+    const void* srcnn_v;
+    const void* altsrcc_u;
+    const void* altsrcc_v;
+    void* dst_u;
+    void* dst_v;
+
+    int srcpp_pitch_uv;
+    int srcp_pitch_uv;
+    int srcc_pitch_uv;
+    int srcn_pitch_uv;
+    int srcnn_pitch_uv;
+    int altsrcc_pitch_uv;
+    int dst_pitch_uv;
+
+    const uint8_t* source;    // MaskSource of every block
+    const uint8_t* direction; // BlendDirection of every block
+
+    int blocks_x;
+    int block_width_uv;
+    int block_height_uv;
+    int col;
+    int variation;
+    float variation_f; // used instead of variation by the float kernels
+    bool conservative_mask;
+
+    // Scratch rainbow mask, one bit per chroma pixel. Every row is mask_stride words long,
+    // the last word is padding so that 64 bits can always be read at any position.
+    uint64_t* mask;
+    int mask_stride;
+    // Pixels that have a left/right neighbour inside their own block.
+    const uint64_t* inner_left;
+    const uint64_t* inner_right;
+
+    // Stop once the mask is built, dst is left untouched.
+    bool mask_only;
+
+    // Added to when not null.
+    BlockRowStats* stats;
+};
+
+typedef void (*BlockRowFunction)(const BlockRow& row);
+
+static inline void orMaskBits(uint64_t* mask, int pos, uint64_t bits, int count)
+{
+    const int shift = pos & 63;
+    mask += pos >> 6;
+
+    mask[0] |= bits << shift;
+
+    if (shift + count > 64)
+        mask[1] |= bits >> (64 - shift);
+}
+
+static inline uint64_t getMaskBits(const uint64_t* mask, int pos)
+{
+    const int shift = pos & 63;
+    mask += pos >> 6;
+
+    return (shift) ? (mask[0] >> shift) | (mask[1] << (64 - shift)) : mask[0];
+}
+
+static inline int popcount64(uint64_t x)
+{
+    x -= (x >> 1) & 0x5555555555555555ULL;
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+
+    return static_cast<int>((x * 0x0101010101010101ULL) >> 56);
+}
+
+static inline int countMaskBits(const uint64_t* mask, int pos, int count)
+{
+    int bits = 0;
+
+    for (; count >= 64; pos += 64, count -= 64)
+        bits += popcount64(getMaskBits(mask, pos));
+
+    if (count)
+        bits += popcount64(getMaskBits(mask, pos) & ((1ULL << count) - 1));
+
+    return bits;
+}
+
+namespace
+{
+
+// Scalar mask generation and blending, also used for the remainders of the SIMD versions.
+template <typename T>
+struct BlockRowOps_c
+{
+    static void makeMask(const T* srcp_u, const T* srcp_v,
+        const T* srcc_u, const T* srcc_v,
+        const T* srcn_u, const T* srcn_v,
+        int width, int variation, uint64_t* mask, int pos)
+    {
+        for (int x = 0; x < width; ++x)
+        {
+            int up = srcp_u[x];
+            int uc = srcc_u[x];
+            int un = srcn_u[x];
+
+            int vp = srcp_v[x];
+            int vc = srcc_v[x];
+            int vn = srcn_v[x];
+
+            int ucup = uc - up;
+            int ucun = uc - un;
+
+            int vcvp = vc - vp;
+            int vcvn = vc - vn;
+
+            if ((((ucup + variation) & (ucun + variation)) < 0)
+                || (((-ucup + variation) & (-ucun + variation)) < 0)
+                || (((vcvp + variation) & (vcvn + variation)) < 0)
+                || (((-vcvp + variation) & (-vcvn + variation)) < 0))
+                mask[(pos + x) >> 6] |= 1ULL << ((pos + x) & 63);
+        }
+    }
+
+    template <BlendDirection blenddirection>
+    static void blend(const T* srcp_u, const T* srcp_v,
+        const T* srcc_u, const T* srcc_v,
+        const T* srcn_u, const T* srcn_v,
+        T* dst_u, T* dst_v,
+        int width, const uint64_t* mask, int pos)
+    {
+        for (int x = 0; x < width; ++x)
+        {
+            if (mask[(pos + x) >> 6] & (1ULL << ((pos + x) & 63)))
+            {
+                if (blenddirection == bdNext)
+                {
+                    dst_u[x] = (srcc_u[x] + srcn_u[x] + 1) >> 1;
+                    dst_v[x] = (srcc_v[x] + srcn_v[x] + 1) >> 1;
+                }
+                else if (blenddirection == bdPrev)
+                {
+                    dst_u[x] = (srcc_u[x] + srcp_u[x] + 1) >> 1;
+                    dst_v[x] = (srcc_v[x] + srcp_v[x] + 1) >> 1;
+                }
+                else
+                {
+                    dst_u[x] = (2 * srcc_u[x] + srcp_u[x] + srcn_u[x] + 3) >> 2;
+                    dst_v[x] = (2 * srcc_v[x] + srcp_v[x] + srcn_v[x] + 3) >> 2;
+                }
+            }
+            else
+            {
+                dst_u[x] = srcc_u[x];
+                dst_v[x] = srcc_v[x];
+            }
+        }
+    }
+};
+
+// Floats are blended without rounding.
+template <>
+struct BlockRowOps_c<float>
+{
+    static void makeMask(const float* srcp_u, const float* srcp_v,
+        const float* srcc_u, const float* srcc_v,
+        const float* srcn_u, const float* srcn_v,
+        int width, float variation, uint64_t* mask, int pos)
+    {
+        for (int x = 0; x < width; ++x)
+        {
+            const float up = srcp_u[x], uc = srcc_u[x], un = srcn_u[x];
+            const float vp = srcp_v[x], vc = srcc_v[x], vn = srcn_v[x];
+            //no std::min/std::max: their out-of-line copies from the AVX units could be the ones linked into the C path
+            const float umin = (un < up) ? un : up, umax = (up < un) ? un : up;
+            const float vmin = (vn < vp) ? vn : vp, vmax = (vp < vn) ? vn : vp;
+
+            if ((uc + variation < umin) || (uc - variation > umax) || (vc + variation < vmin) || (vc - variation > vmax))
+                mask[(pos + x) >> 6] |= 1ULL << ((pos + x) & 63);
+        }
+    }
+
+    template <BlendDirection blenddirection>
+    static void blend(const float* srcp_u, const float* srcp_v,
+        const float* srcc_u, const float* srcc_v,
+        const float* srcn_u, const float* srcn_v,
+        float* dst_u, float* dst_v,
+        int width, const uint64_t* mask, int pos)
+    {
+        for (int x = 0; x < width; ++x)
+        {
+            if (mask[(pos + x) >> 6] & (1ULL << ((pos + x) & 63)))
+            {
+                if (blenddirection == bdNext)
+                {
+                    dst_u[x] = (srcc_u[x] + srcn_u[x]) * 0.5f;
+                    dst_v[x] = (srcc_v[x] + srcn_v[x]) * 0.5f;
+                }
+                else if (blenddirection == bdPrev)
+                {
+                    dst_u[x] = (srcc_u[x] + srcp_u[x]) * 0.5f;
+                    dst_v[x] = (srcc_v[x] + srcp_v[x]) * 0.5f;
+                }
+                else
+                {
+                    dst_u[x] = (srcc_u[x] * 2.0f + srcp_u[x] + srcn_u[x]) * 0.25f;
+                    dst_v[x] = (srcc_v[x] * 2.0f + srcp_v[x] + srcn_v[x]) * 0.25f;
+                }
+            }
+            else
+            {
+                dst_u[x] = srcc_u[x];
+                dst_v[x] = srcc_v[x];
+            }
+        }
+    }
+};
+
+} // namespace
+
+template <typename T>
+static inline auto maskVariation(const BlockRow& r)
+{
+    if constexpr (std::is_same<T, float>::value)
+        return r.variation_f;
+    else
+        return r.variation;
+}
+
+// Copies the chroma of a run of blocks from altclip or srcc.
+template <typename T>
+static inline void copyRun(const BlockRow& r, const void* src_u_, const void* src_v_, int src_pitch_uv, int x0, int count, int block_height_uv)
+{
+    const T* src_u = reinterpret_cast<const T*>(src_u_) + x0;
+    const T* src_v = reinterpret_cast<const T*>(src_v_) + x0;
+    T* dst_u = reinterpret_cast<T*>(r.dst_u) + x0;
+    T* dst_v = reinterpret_cast<T*>(r.dst_v) + x0;
+
+    for (int y = 0; y < block_height_uv; ++y)
+    {
+        for (int i = 0; i < count; ++i)
+        {
+            dst_u[i] = src_u[i];
+            dst_v[i] = src_v[i];
+        }
+
+        src_u += src_pitch_uv;
+        src_v += src_pitch_uv;
+        dst_u += r.dst_pitch_uv;
+        dst_v += r.dst_pitch_uv;
+    }
+}
+
+// Blends the masked pixels of a run of blocks with the same direction, the pixels right of the last block are copied.
+template <typename T, typename Ops, BlendDirection blenddirection>
+static inline void blendRun(const BlockRow& r, int x0, int blend_count, int count, int block_height_uv)
+{
+    const T* srcp_u = reinterpret_cast<const T*>(r.srcp_u) + x0;
+    const T* srcp_v = reinterpret_cast<const T*>(r.srcp_v) + x0;
+    const T* srcc_u = reinterpret_cast<const T*>(r.srcc_u) + x0;
+    const T* srcc_v = reinterpret_cast<const T*>(r.srcc_v) + x0;
+    const T* srcn_u = reinterpret_cast<const T*>(r.srcn_u) + x0;
+    const T* srcn_v = reinterpret_cast<const T*>(r.srcn_v) + x0;
+    T* dst_u = reinterpret_cast<T*>(r.dst_u) + x0;
+    T* dst_v = reinterpret_cast<T*>(r.dst_v) + x0;
+    const uint64_t* mask = r.mask;
+
+    for (int y = 0; y < block_height_uv; ++y)
+    {
+        if (r.stats)
+            r.stats->mask_pixels[blenddirection] += countMaskBits(mask, x0, blend_count);
+
+        Ops::template blend<blenddirection>(srcp_u, srcp_v, srcc_u, srcc_v, srcn_u, srcn_v, dst_u, dst_v, blend_count, mask, x0);
+
+        for (int i = blend_count; i < count; ++i)
+        {
+            dst_u[i] = srcc_u[i];
+            dst_v[i] = srcc_v[i];
+        }
+
+        srcp_u += r.srcp_pitch_uv;
+        srcp_v += r.srcp_pitch_uv;
+        srcc_u += r.srcc_pitch_uv;
+        srcc_v += r.srcc_pitch_uv;
+        srcn_u += r.srcn_pitch_uv;
+        srcn_v += r.srcn_pitch_uv;
+        dst_u += r.dst_pitch_uv;
+        dst_v += r.dst_pitch_uv;
+        mask += r.mask_stride;
+    }
+}
+
+// Mask generation and blending are done by Ops on runs of blocks that share the same source frames
+// and blend direction. Denoising and expanding the mask work on whole 64-pixel words.
+// BlockWidth and BlockHeight are the chroma block size when it is known at compile time, 0 otherwise.
+template <typename T, typename Ops, int BlockWidth = 0, int BlockHeight = 0>
+static inline void processBlockRow(const BlockRow& r)
+{
+    const int mask_words = r.mask_stride - 1;
+    const int block_width_uv = (BlockWidth) ? BlockWidth : r.block_width_uv;
+    const int block_height_uv = (BlockHeight) ? BlockHeight : r.block_height_uv;
+
+    std::chrono::steady_clock::time_point start;
+    if (r.stats)
+        start = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < r.mask_stride * block_height_uv; ++i)
+        r.mask[i] = 0;
+
+    //generate mask
+    for (int x = 0; x < r.blocks_x;)
+    {
+        const int source = r.source[x];
+        int end = x + 1;
+        while (end < r.blocks_x && r.source[end] == source)
+            ++end;
+
+        if (source != msFallback)
+        {
+            const T* src1_u; const T* src1_v; int src1_pitch;
+            const T* src2_u; const T* src2_v; int src2_pitch;
+            const T* src3_u; const T* src3_v; int src3_pitch;
+
+            if (source == msPrev)
+            {
+                src1_u = reinterpret_cast<const T*>(r.srcpp_u); src1_v = reinterpret_cast<const T*>(r.srcpp_v); src1_pitch = r.srcpp_pitch_uv;
+                src2_u = reinterpret_cast<const T*>(r.srcp_u); src2_v = reinterpret_cast<const T*>(r.srcp_v); src2_pitch = r.srcp_pitch_uv;
+                src3_u = reinterpret_cast<const T*>(r.srcc_u); src3_v = reinterpret_cast<const T*>(r.srcc_v); src3_pitch = r.srcc_pitch_uv;
+            }
+            else if (source == msNext)
+            {
+                src1_u = reinterpret_cast<const T*>(r.srcc_u); src1_v = reinterpret_cast<const T*>(r.srcc_v); src1_pitch = r.srcc_pitch_uv;
+                src2_u = reinterpret_cast<const T*>(r.srcn_u); src2_v = reinterpret_cast<const T*>(r.srcn_v); src2_pitch = r.srcn_pitch_uv;
+                src3_u = reinterpret_cast<const T*>(r.srcnn_u); src3_v = reinterpret_cast<const T*>(r.srcnn_v); src3_pitch = r.srcnn_pitch_uv;
+            }
+            else
+            {
+                src1_u = reinterpret_cast<const T*>(r.srcp_u); src1_v = reinterpret_cast<const T*>(r.srcp_v); src1_pitch = r.srcp_pitch_uv;
+                src2_u = reinterpret_cast<const T*>(r.srcc_u); src2_v = reinterpret_cast<const T*>(r.srcc_v); src2_pitch = r.srcc_pitch_uv;
+                src3_u = reinterpret_cast<const T*>(r.srcn_u); src3_v = reinterpret_cast<const T*>(r.srcn_v); src3_pitch = r.srcn_pitch_uv;
+            }
+
+            const int x0 = x * block_width_uv;
+            const int count = (end - x) * block_width_uv;
+
+            for (int y = 0; y < block_height_uv; ++y)
+            {
+                Ops::makeMask(src1_u + src1_pitch * static_cast<int64_t>(y) + x0, src1_v + src1_pitch * static_cast<int64_t>(y) + x0,
+                    src2_u + src2_pitch * static_cast<int64_t>(y) + x0, src2_v + src2_pitch * static_cast<int64_t>(y) + x0,
+                    src3_u + src3_pitch * static_cast<int64_t>(y) + x0, src3_v + src3_pitch * static_cast<int64_t>(y) + x0,
+                    count, maskVariation<T>(r), r.mask + r.mask_stride * static_cast<int64_t>(y), x0);
+            }
+        }
+
+        x = end;
+    }
+
+    //denoise mask, remove marked pixels with no horizontal marked neighbors
+    for (int y = 0; y < block_height_uv; ++y)
+    {
+        uint64_t* mask = r.mask + r.mask_stride * static_cast<int64_t>(y);
+        uint64_t prev = 0;
+
+        for (int w = 0; w < mask_words; ++w)
+        {
+            const uint64_t cur = mask[w];
+            const uint64_t left = (cur << 1) | (prev >> 63);
+            const uint64_t right = (cur >> 1) | (mask[w + 1] << 63);
+
+            mask[w] = cur & ((left & r.inner_left[w]) | (right & r.inner_right[w]));
+            prev = cur;
+        }
+    }
+
+    //expand mask vertically, every row already sees the expanded row above it
+    if (!r.conservative_mask)
+    {
+        uint64_t* mask = r.mask;
+
+        for (int w = 0; w < mask_words; ++w)
+            mask[w] |= mask[w + r.mask_stride];
+
+        mask += r.mask_stride;
+
+        for (int y = 1; y < block_height_uv - 1; ++y)
+        {
+            for (int w = 0; w < mask_words; ++w)
+                mask[w] |= mask[w + r.mask_stride] & mask[w - r.mask_stride];
+
+            mask += r.mask_stride;
+        }
+
+        for (int w = 0; w < mask_words; ++w)
+            mask[w] |= mask[w - r.mask_stride];
+    }
+
+    if (r.stats)
+    {
+        const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        r.stats->mask_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(now - start).count();
+        start = now;
+    }
+
+    if (r.mask_only)
+        return;
+
+    //blend, or copy the blocks that can't be processed or are outside the region of interest, one run of blocks at a time
+    auto operation = [&](int i)
+    {
+        return (r.source[i] != msFallback) ? r.direction[i] : (r.direction[i] == bdNone) ? -2 : -1;
+    };
+
+    for (int x = 0; x < r.blocks_x;)
+    {
+        const int op = operation(x);
+        int end = x + 1;
+        while (end < r.blocks_x && operation(end) == op)
+            ++end;
+
+        const int x0 = x * block_width_uv;
+        const int count = (end - x) * block_width_uv + ((end == r.blocks_x) ? r.col : 0);
+        const int blend_count = (end - x) * block_width_uv;
+
+        if (op == -2)
+            copyRun<T>(r, r.srcc_u, r.srcc_v, r.srcc_pitch_uv, x0, count, block_height_uv);
+        else if (op == -1)
+            copyRun<T>(r, r.altsrcc_u, r.altsrcc_v, r.altsrcc_pitch_uv, x0, count, block_height_uv);
+        else if (op == bdNext)
+            blendRun<T, Ops, bdNext>(r, x0, blend_count, count, block_height_uv);
+        else if (op == bdPrev)
+            blendRun<T, Ops, bdPrev>(r, x0, blend_count, count, block_height_uv);
+        else
+            blendRun<T, Ops, bdBoth>(r, x0, blend_count, count, block_height_uv);
+
+        x = end;
+    }
+
+    if (r.stats)
+        r.stats->blend_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+// processBlockRow for the chroma block sizes of 4x4, 8x8 and 16x16 blocks at 4:2:0, 4:2:2 and 4:4:4,
+// or the generic one for other sizes.
+template <typename T, typename Ops>
+static inline BlockRowFunction selectBlockRow(int block_width_uv, int block_height_uv)
+{
+    static const struct
+    {
+        int width;
+        int height;
+        BlockRowFunction func;
+    } table[] =
+    {
+        { 2, 2, processBlockRow<T, Ops, 2, 2> },
+        { 2, 4, processBlockRow<T, Ops, 2, 4> },
+        { 4, 4, processBlockRow<T, Ops, 4, 4> },
+        { 4, 8, processBlockRow<T, Ops, 4, 8> },
+        { 8, 8, processBlockRow<T, Ops, 8, 8> },
+        { 8, 16, processBlockRow<T, Ops, 8, 16> },
+        { 16, 16, processBlockRow<T, Ops, 16, 16> }
+    };
+
+    for (const auto& entry : table)
+    {
+        if (entry.width == block_width_uv && entry.height == block_height_uv)
+            return entry.func;
+    }
+
+    return processBlockRow<T, Ops>;
+}
+
+// The generic C version, also the reference of the tests.
+template <typename T>
+void processBlockRow_c(const BlockRow& row);
+
+template <typename T>
+BlockRowFunction blockRowFunction_c(int block_width_uv, int block_height_uv);
+template <typename T>
+BlockRowFunction blockRowFunction_sse2(int block_width_uv, int block_height_uv);
+template <typename T>
+BlockRowFunction blockRowFunction_avx2(int block_width_uv, int block_height_uv);
+template <typename T>
+BlockRowFunction blockRowFunction_avx512(int block_width_uv, int block_height_uv);
@@ -0,0 +1,465 @@
+#include <algorithm>
+
+#include <immintrin.h>
+
+#include "bifrost.h"
+
+template <typename T>
+void lumaDiffRow_avx2(const void* src1_y_, const void* src2_y_, int src1_stride_y, int src2_stride_y, int block_width, int block_height, int blocks_x, float* diff)
+{
+    const T* src1_y = reinterpret_cast<const T*>(src1_y_);
+    const T* src2_y = reinterpret_cast<const T*>(src2_y_);
+
+    const int width = block_width * blocks_x;
+    const int step = 32 / sizeof(T);
+
+    LumaDiffAccumulator<> acc(diff, block_width, block_height);
+    alignas(32) uint32_t colsum[32];
+
+    int x = 0;
+    for (; x + step <= width; x += step)
+    {
+        const T* s1 = src1_y + x;
+        const T* s2 = src2_y + x;
+
+        if constexpr (sizeof(T) == 1)
+        {
+            __m256i sum0 = _mm256_setzero_si256(), sum1 = _mm256_setzero_si256(), sum2 = _mm256_setzero_si256(), sum3 = _mm256_setzero_si256();
+
+            // 16-bit accumulators can't overflow within 256 rows.
+            for (int y0 = 0; y0 < block_height; y0 += 256)
+            {
+                __m256i acc_lo = _mm256_setzero_si256(), acc_hi = _mm256_setzero_si256();
+
+                for (int y = y0; y < std::min(y0 + 256, block_height); ++y)
+                {
+                    const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s1));
+                    const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s2));
+                    const __m256i d = _mm256_or_si256(_mm256_subs_epu8(a, b), _mm256_subs_epu8(b, a));
+
+                    acc_lo = _mm256_add_epi16(acc_lo, _mm256_cvtepu8_epi16(_mm256_castsi256_si128(d)));
+                    acc_hi = _mm256_add_epi16(acc_hi, _mm256_cvtepu8_epi16(_mm256_extracti128_si256(d, 1)));
+
+                    s1 += src1_stride_y;
+                    s2 += src2_stride_y;
+                }
+
+                sum0 = _mm256_add_epi32(sum0, _mm256_cvtepu16_epi32(_mm256_castsi256_si128(acc_lo)));
+                sum1 = _mm256_add_epi32(sum1, _mm256_cvtepu16_epi32(_mm256_extracti128_si256(acc_lo, 1)));
+                sum2 = _mm256_add_epi32(sum2, _mm256_cvtepu16_epi32(_mm256_castsi256_si128(acc_hi)));
+                sum3 = _mm256_add_epi32(sum3, _mm256_cvtepu16_epi32(_mm256_extracti128_si256(acc_hi, 1)));
+            }
+
+            _mm256_store_si256(reinterpret_cast<__m256i*>(colsum), sum0);
+            _mm256_store_si256(reinterpret_cast<__m256i*>(colsum + 8), sum1);
+            _mm256_store_si256(reinterpret_cast<__m256i*>(colsum + 16), sum2);
+            _mm256_store_si256(reinterpret_cast<__m256i*>(colsum + 24), sum3);
+        }
+        else
+        {
+            __m256i sum0 = _mm256_setzero_si256(), sum1 = _mm256_setzero_si256();
+
+            for (int y = 0; y < block_height; ++y)
+            {
+                const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s1));
+                const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s2));
+                const __m256i d = _mm256_sub_epi16(_mm256_max_epu16(a, b), _mm256_min_epu16(a, b));
+
+                sum0 = _mm256_add_epi32(sum0, _mm256_cvtepu16_epi32(_mm256_castsi256_si128(d)));
+                sum1 = _mm256_add_epi32(sum1, _mm256_cvtepu16_epi32(_mm256_extracti128_si256(d, 1)));
+
+                s1 += src1_stride_y;
+                s2 += src2_stride_y;
+            }
+
+            _mm256_store_si256(reinterpret_cast<__m256i*>(colsum), sum0);
+            _mm256_store_si256(reinterpret_cast<__m256i*>(colsum + 8), sum1);
+        }
+
+        for (int i = 0; i < step; ++i)
+            acc.add(colsum[i]);
+    }
+
+    for (; x < width; ++x)
+        acc.add(lumaColumnDiff<T>(src1_y + x, src2_y + x, src1_stride_y, src2_stride_y, block_height));
+}
+
+template void lumaDiffRow_avx2<uint8_t>(const void* src1_y, const void* src2_y, int src1_stride_y, int src2_stride_y, int block_width, int block_height, int blocks_x, float* diff);
+template void lumaDiffRow_avx2<uint16_t>(const void* src1_y, const void* src2_y, int src1_stride_y, int src2_stride_y, int block_width, int block_height, int blocks_x, float* diff);
+
+// Every column is summed top to bottom like lumaColumnDiff, so the result matches the C version exactly.
+template <>
+void lumaDiffRow_avx2<float>(const void* src1_y_, const void* src2_y_, int src1_stride_y, int src2_stride_y, int block_width, int block_height, int blocks_x, float* diff)
+{
+    const float* src1_y = reinterpret_cast<const float*>(src1_y_);
+    const float* src2_y = reinterpret_cast<const float*>(src2_y_);
+
+    const int width = block_width * blocks_x;
+    const __m256 abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF));
+
+    LumaDiffAccumulator<float> acc(diff, block_width, block_height);
+    alignas(32) float colsum[16];
+
+    int x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+        const float* s1 = src1_y + x;
+        const float* s2 = src2_y + x;
+        __m256 sum0 = _mm256_setzero_ps(), sum1 = _mm256_setzero_ps();
+
+        for (int y = 0; y < block_height; ++y)
+        {
+            sum0 = _mm256_add_ps(sum0, _mm256_and_ps(_mm256_sub_ps(_mm256_loadu_ps(s1), _mm256_loadu_ps(s2)), abs_mask));
+            sum1 = _mm256_add_ps(sum1, _mm256_and_ps(_mm256_sub_ps(_mm256_loadu_ps(s1 + 8), _mm256_loadu_ps(s2 + 8)), abs_mask));
+
+            s1 += src1_stride_y;
+            s2 += src2_stride_y;
+        }
+
+        _mm256_store_ps(colsum, sum0);
+        _mm256_store_ps(colsum + 8, sum1);
+
+        for (int i = 0; i < 16; ++i)
+            acc.add(colsum[i]);
+    }
+
+    for (; x < width; ++x)
+        acc.add(lumaColumnDiff<float>(src1_y + x, src2_y + x, src1_stride_y, src2_stride_y, block_height));
+}
+
+uint64_t hashPlane_avx2(const uint8_t* srcp, int pitch, int row_size, int height)
+{
+    alignas(32) uint64_t acc_lanes[4];
+    uint8_t tail[hash_stripe];
+    hashInit(acc_lanes);
+
+    const __m256i prime = _mm256_set1_epi64x(hash_prime);
+    const __m256i scramble_key = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(hash_keys.scramble));
+    __m256i acc = _mm256_load_si256(reinterpret_cast<const __m256i*>(acc_lanes));
+
+    // hashStripe and hashScramble on all four lanes
+    auto stripe = [&](const uint8_t* p, const uint64_t* key)
+    {
+        const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        const __m256i k = _mm256_xor_si256(v, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(key)));
+        acc = _mm256_add_epi64(acc, _mm256_add_epi64(_mm256_mul_epu32(k, _mm256_srli_epi64(k, 32)), v));
+    };
+
+    auto scramble = [&]()
+    {
+        const __m256i a = _mm256_xor_si256(_mm256_xor_si256(acc, _mm256_srli_epi64(acc, 47)), scramble_key);
+        acc = _mm256_add_epi64(_mm256_mul_epu32(a, prime), _mm256_slli_epi64(_mm256_mul_epu32(_mm256_srli_epi64(a, 32), prime), 32));
+    };
+
+    for (int y = 0; y < height; ++y)
+    {
+        int x = 0, s = 0;
+        for (; x + hash_stripe <= row_size; x += hash_stripe, ++s)
+        {
+            stripe(srcp + x, hash_keys.stripe[s & 15]);
+            if ((s & 15) == 15)
+                scramble();
+        }
+
+        if (x < row_size)
+            stripe(hashTail(srcp, x, row_size, tail), hash_keys.stripe[s & 15]);
+
+        scramble();
+        srcp += pitch;
+    }
+
+    _mm256_store_si256(reinterpret_cast<__m256i*>(acc_lanes), acc);
+
+    return hashFinish(acc_lanes, row_size, height);
+}
+
+template <typename T, int Scale>
+void decimateRow_avx2(const void* src_y_, int src_stride_y, void* dst_, int width)
+{
+    const T* src_y = reinterpret_cast<const T*>(src_y_);
+    T* dst = reinterpret_cast<T*>(dst_);
+
+    int x = 0;
+
+    if constexpr (sizeof(T) == 1)
+    {
+        const __m256i ones8 = _mm256_set1_epi8(1);
+        const __m256i round = _mm256_set1_epi16(Scale * Scale / 2);
+
+        //16 pixels at a time, columns are added in pairs in 16-bit lanes
+        for (; x + 16 <= width; x += 16)
+        {
+            __m256i sum0 = _mm256_setzero_si256(), sum1 = _mm256_setzero_si256();
+
+            for (int y = 0; y < Scale; ++y)
+            {
+                const T* s = src_y + src_stride_y * static_cast<int64_t>(y) + x * Scale;
+                const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s));
+                sum0 = _mm256_add_epi16(sum0, _mm256_maddubs_epi16(a, ones8));
+
+                if constexpr (Scale == 4)
+                {
+                    const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + 32));
+                    sum1 = _mm256_add_epi16(sum1, _mm256_maddubs_epi16(b, ones8));
+                }
+            }
+
+            if constexpr (Scale == 4)
+            {
+                const __m256i ones = _mm256_set1_epi16(1);
+                sum0 = _mm256_permute4x64_epi64(_mm256_packs_epi32(_mm256_madd_epi16(sum0, ones), _mm256_madd_epi16(sum1, ones)), _MM_SHUFFLE(3, 1, 2, 0));
+            }
+
+            sum0 = _mm256_srli_epi16(_mm256_add_epi16(sum0, round), (Scale == 2) ? 2 : 4);
+            sum0 = _mm256_permute4x64_epi64(_mm256_packus_epi16(sum0, sum0), _MM_SHUFFLE(3, 1, 2, 0));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x), _mm256_castsi256_si128(sum0));
+        }
+    }
+    else
+    {
+        const __m256i low = _mm256_set1_epi32(0xFFFF);
+        const __m256i round = _mm256_set1_epi32(Scale * Scale / 2);
+
+        //16 pixels at a time, columns are added in pairs in 32-bit lanes
+        for (; x + 16 <= width; x += 16)
+        {
+            __m256i sum[Scale] = {};
+
+            for (int y = 0; y < Scale; ++y)
+            {
+                const T* s = src_y + src_stride_y * static_cast<int64_t>(y) + x * Scale;
+
+                for (int i = 0; i < Scale; ++i)
+                {
+                    const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i * 16));
+                    sum[i] = _mm256_add_epi32(sum[i], _mm256_add_epi32(_mm256_and_si256(a, low), _mm256_srli_epi32(a, 16)));
+                }
+            }
+
+            __m256i lo = sum[0], hi = sum[1];
+
+            if constexpr (Scale == 4)
+            {
+                lo = _mm256_hadd_epi32(sum[0], sum[1]);
+                hi = _mm256_hadd_epi32(sum[2], sum[3]);
+            }
+
+            lo = _mm256_srli_epi32(_mm256_add_epi32(lo, round), (Scale == 2) ? 2 : 4);
+            hi = _mm256_srli_epi32(_mm256_add_epi32(hi, round), (Scale == 2) ? 2 : 4);
+            __m256i out = _mm256_packus_epi32(lo, hi);
+
+            if constexpr (Scale == 2)
+                out = _mm256_permute4x64_epi64(out, _MM_SHUFFLE(3, 1, 2, 0));
+            else
+                out = _mm256_permutevar8x32_epi32(out, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + x), out);
+        }
+    }
+
+    decimatePixels<T, Scale>(src_y, src_stride_y, dst, x, width);
+}
+
+template void decimateRow_avx2<uint8_t, 2>(const void* src_y, int src_stride_y, void* dst, int width);
+template void decimateRow_avx2<uint8_t, 4>(const void* src_y, int src_stride_y, void* dst, int width);
+template void decimateRow_avx2<uint16_t, 2>(const void* src_y, int src_stride_y, void* dst, int width);
+template void decimateRow_avx2<uint16_t, 4>(const void* src_y, int src_stride_y, void* dst, int width);
+
+namespace
+{
+
+template <typename T>
+struct BlockRowOps_avx2
+{
+    static inline __m256i rainbow(const __m256i& p, const __m256i& c, const __m256i& n, const __m256i& var)
+    {
+        // c + variation < min(p, n) || c > max(p, n) + variation
+        if constexpr (sizeof(T) == 1)
+            return _mm256_or_si256(_mm256_subs_epu8(_mm256_min_epu8(p, n), _mm256_adds_epu8(c, var)), _mm256_subs_epu8(c, _mm256_adds_epu8(_mm256_max_epu8(p, n), var)));
+        else
+            return _mm256_or_si256(_mm256_subs_epu16(_mm256_min_epu16(p, n), _mm256_adds_epu16(c, var)), _mm256_subs_epu16(c, _mm256_adds_epu16(_mm256_max_epu16(p, n), var)));
+    }
+
+    static inline __m256i rainbowUV(const T* srcp_u, const T* srcp_v, const T* srcc_u, const T* srcc_v, const T* srcn_u, const T* srcn_v, const __m256i& var)
+    {
+        return _mm256_or_si256(
+            rainbow(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(srcp_u)), _mm256_loadu_si256(reinterpret_cast<const __m256i*>(srcc_u)), _mm256_loadu_si256(reinterpret_cast<const __m256i*>(srcn_u)), var),
+            rainbow(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(srcp_v)), _mm256_loadu_si256(reinterpret_cast<const __m256i*>(srcc_v)), _mm256_loadu_si256(reinterpret_cast<const __m256i*>(srcn_v)), var));
+    }
+
+    static void makeMask(const T* srcp_u, const T* srcp_v,
+        const T* srcc_u, const T* srcc_v,
+        const T* srcn_u, const T* srcn_v,
+        int width, int variation, uint64_t* mask, int pos)
+    {
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256i var = (sizeof(T) == 1) ? _mm256_set1_epi8(static_cast<char>(variation)) : _mm256_set1_epi16(static_cast<short>(variation));
+        const int step = 32 / sizeof(T);
+
+        int x = 0;
+        for (; x + 32 <= width; x += 32)
+        {
+            __m256i m = rainbowUV(srcp_u + x, srcp_v + x, srcc_u + x, srcc_v + x, srcn_u + x, srcn_v + x, var);
+
+            if constexpr (sizeof(T) == 1)
+                m = _mm256_cmpeq_epi8(m, zero);
+            else
+            {
+                const __m256i m2 = rainbowUV(srcp_u + x + step, srcp_v + x + step, srcc_u + x + step, srcc_v + x + step, srcn_u + x + step, srcn_v + x + step, var);
+                m = _mm256_permute4x64_epi64(_mm256_packs_epi16(_mm256_cmpeq_epi16(m, zero), _mm256_cmpeq_epi16(m2, zero)), 0xD8);
+            }
+
+            orMaskBits(mask, pos + x, ~static_cast<uint32_t>(_mm256_movemask_epi8(m)), 32);
+        }
+
+        if (x < width)
+            BlockRowOps_c<T>::makeMask(srcp_u + x, srcp_v + x, srcc_u + x, srcc_v + x, srcn_u + x, srcn_v + x, width - x, variation, mask, pos + x);
+    }
+
+    template <BlendDirection blenddirection>
+    static inline __m256i blendPixels(const __m256i& p, const __m256i& c, const __m256i& n, const __m256i& m)
+    {
+        // (2 * c + p + n + 3) >> 2 == avg(c, avg(p, n))
+        __m256i b;
+        if constexpr (sizeof(T) == 1)
+            b = (blenddirection == bdNext) ? _mm256_avg_epu8(c, n) : (blenddirection == bdPrev) ? _mm256_avg_epu8(c, p) : _mm256_avg_epu8(c, _mm256_avg_epu8(p, n));
+        else
+            b = (blenddirection == bdNext) ? _mm256_avg_epu16(c, n) : (blenddirection == bdPrev) ? _mm256_avg_epu16(c, p) : _mm256_avg_epu16(c, _mm256_avg_epu16(p, n));
+
+        return _mm256_blendv_epi8(c, b, m);
+    }
+
+    template <BlendDirection blenddirection>
+    static void blend(const T* srcp_u, const T* srcp_v,
+        const T* srcc_u, const T* srcc_v,
+        const T* srcn_u, const T* srcn_v,
+        T* dst_u, T* dst_v,
+        int width, const uint64_t* mask, int pos)
+    {
+        const int step = 32 / sizeof(T);
+        const __m256i sel = (sizeof(T) == 1)
+            ? _mm256_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128)
+            : _mm256_setr_epi16(1, 2, 4, 8, 16, 32, 64, 128, 256, 512, 1024, 2048, 4096, 8192, 16384, -32768);
+        const __m256i shuf = _mm256_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1, 2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3);
+
+        int x = 0;
+        for (; x + step <= width; x += step)
+        {
+            const uint64_t bits = getMaskBits(mask, pos + x);
+            __m256i m;
+
+            if constexpr (sizeof(T) == 1)
+                m = _mm256_cmpeq_epi8(_mm256_and_si256(_mm256_shuffle_epi8(_mm256_set1_epi32(static_cast<int>(bits)), shuf), sel), sel);
+            else
+                m = _mm256_cmpeq_epi16(_mm256_and_si256(_mm256_set1_epi16(static_cast<short>(bits)), sel), sel);
+
+            const __m256i c_u = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(srcc_u + x));
+            const __m256i c_v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(srcc_v + x));
+            const __m256i p_u = (blenddirection != bdNext) ? _mm256_loadu_si256(reinterpret_cast<const __m256i*>(srcp_u + x)) : c_u;
+            const __m256i p_v = (blenddirection != bdNext) ? _mm256_loadu_si256(reinterpret_cast<const __m256i*>(srcp_v + x)) : c_v;
+            const __m256i n_u = (blenddirection != bdPrev) ? _mm256_loadu_si256(reinterpret_cast<const __m256i*>(srcn_u + x)) : c_u;
+            const __m256i n_v = (blenddirection != bdPrev) ? _mm256_loadu_si256(reinterpret_cast<const __m256i*>(srcn_v + x)) : c_v;
+
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst_u + x), blendPixels<blenddirection>(p_u, c_u, n_u, m));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst_v + x), blendPixels<blenddirection>(p_v, c_v, n_v, m));
+        }
+
+        if (x < width)
+            BlockRowOps_c<T>::template blend<blenddirection>(srcp_u + x, srcp_v + x, srcc_u + x, srcc_v + x, srcn_u + x, srcn_v + x, dst_u + x, dst_v + x, width - x, mask, pos + x);
+    }
+};
+
+// Floats are compared and blended in the same order as BlockRowOps_c<float>.
+template <>
+struct BlockRowOps_avx2<float>
+{
+    static inline __m256 rainbow(const __m256& p, const __m256& c, const __m256& n, const __m256& var)
+    {
+        // c + variation < min(p, n) || c - variation > max(p, n)
+        return _mm256_or_ps(_mm256_cmp_ps(_mm256_add_ps(c, var), _mm256_min_ps(p, n), _CMP_LT_OQ), _mm256_cmp_ps(_mm256_sub_ps(c, var), _mm256_max_ps(p, n), _CMP_GT_OQ));
+    }
+
+    static inline uint32_t rainbowUV(const float* srcp_u, const float* srcp_v, const float* srcc_u, const float* srcc_v, const float* srcn_u, const float* srcn_v, const __m256& var)
+    {
+        return _mm256_movemask_ps(_mm256_or_ps(
+            rainbow(_mm256_loadu_ps(srcp_u), _mm256_loadu_ps(srcc_u), _mm256_loadu_ps(srcn_u), var),
+            rainbow(_mm256_loadu_ps(srcp_v), _mm256_loadu_ps(srcc_v), _mm256_loadu_ps(srcn_v), var)));
+    }
+
+    static void makeMask(const float* srcp_u, const float* srcp_v,
+        const float* srcc_u, const float* srcc_v,
+        const float* srcn_u, const float* srcn_v,
+        int width, float variation, uint64_t* mask, int pos)
+    {
+        const __m256 var = _mm256_set1_ps(variation);
+
+        int x = 0;
+        for (; x + 32 <= width; x += 32)
+        {
+            uint32_t bits = 0;
+            for (int i = 0; i < 32; i += 8)
+                bits |= rainbowUV(srcp_u + x + i, srcp_v + x + i, srcc_u + x + i, srcc_v + x + i, srcn_u + x + i, srcn_v + x + i, var) << i;
+
+            orMaskBits(mask, pos + x, bits, 32);
+        }
+
+        if (x < width)
+            BlockRowOps_c<float>::makeMask(srcp_u + x, srcp_v + x, srcc_u + x, srcc_v + x, srcn_u + x, srcn_v + x, width - x, variation, mask, pos + x);
+    }
+
+    template <BlendDirection blenddirection>
+    static inline __m256 blendPixels(const __m256& p, const __m256& c, const __m256& n, const __m256& m)
+    {
+        __m256 b;
+        if (blenddirection == bdNext)
+            b = _mm256_mul_ps(_mm256_add_ps(c, n), _mm256_set1_ps(0.5f));
+        else if (blenddirection == bdPrev)
+            b = _mm256_mul_ps(_mm256_add_ps(c, p), _mm256_set1_ps(0.5f));
+        else
+            b = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_add_ps(c, c), p), n), _mm256_set1_ps(0.25f));
+
+        return _mm256_blendv_ps(c, b, m);
+    }
+
+    template <BlendDirection blenddirection>
+    static void blend(const float* srcp_u, const float* srcp_v,
+        const float* srcc_u, const float* srcc_v,
+        const float* srcn_u, const float* srcn_v,
+        float* dst_u, float* dst_v,
+        int width, const uint64_t* mask, int pos)
+    {
+        const __m256i sel = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+
+        int x = 0;
+        for (; x + 8 <= width; x += 8)
+        {
+            const __m256i bits = _mm256_set1_epi32(static_cast<int>(getMaskBits(mask, pos + x)));
+            const __m256 m = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(bits, sel), sel));
+
+            const __m256 c_u = _mm256_loadu_ps(srcc_u + x);
+            const __m256 c_v = _mm256_loadu_ps(srcc_v + x);
+            const __m256 p_u = (blenddirection != bdNext) ? _mm256_loadu_ps(srcp_u + x) : c_u;
+            const __m256 p_v = (blenddirection != bdNext) ? _mm256_loadu_ps(srcp_v + x) : c_v;
+            const __m256 n_u = (blenddirection != bdPrev) ? _mm256_loadu_ps(srcn_u + x) : c_u;
+            const __m256 n_v = (blenddirection != bdPrev) ? _mm256_loadu_ps(srcn_v + x) : c_v;
+
+            _mm256_storeu_ps(dst_u + x, blendPixels<blenddirection>(p_u, c_u, n_u, m));
+            _mm256_storeu_ps(dst_v + x, blendPixels<blenddirection>(p_v, c_v, n_v, m));
+        }
+
+        if (x < width)
+            BlockRowOps_c<float>::blend<blenddirection>(srcp_u + x, srcp_v + x, srcc_u + x, srcc_v + x, srcn_u + x, srcn_v + x, dst_u + x, dst_v + x, width - x, mask, pos + x);
+    }
+};
+
+} // namespace
+
+template <typename T>
+BlockRowFunction blockRowFunction_avx2(int block_width_uv, int block_height_uv)
+{
+    return selectBlockRow<T, BlockRowOps_avx2<T>>(block_width_uv, block_height_uv);
+}
+
+template BlockRowFunction blockRowFunction_avx2<uint8_t>(int block_width_uv, int block_height_uv);
+template BlockRowFunction blockRowFunction_avx2<uint16_t>(int block_width_uv, int block_height_uv);
+template BlockRowFunction blockRowFunction_avx2<float>(int block_width_uv, int block_height_uv);
@@ -0,0 +1,192 @@
+#include <algorithm>
+
+#include <immintrin.h>
+
+#include "bifrost.h"
+
+template <typename T>
+void lumaDiffRow_avx512(const void* src1_y_, const void* src2_y_, int src1_stride_y, int src2_stride_y, int block_width, int block_height, int blocks_x, float* diff)
+{
+    const T* src1_y = reinterpret_cast<const T*>(src1_y_);
+    const T* src2_y = reinterpret_cast<const T*>(src2_y_);
+
+    const int width = block_width * blocks_x;
+    const int step = 64 / sizeof(T);
+
+    LumaDiffAccumulator<> acc(diff, block_width, block_height);
+    alignas(64) uint32_t colsum[64];
+
+    // The right edge is handled with masked loads, so there is no scalar tail.
+    for (int x = 0; x < width; x += step)
+    {
+        const T* s1 = src1_y + x;
+        const T* s2 = src2_y + x;
+        const int count = std::min(step, width - x);
+
+        if constexpr (sizeof(T) == 1)
+        {
+            const __mmask64 mask = (count == 64) ? ~0ULL : (1ULL << count) - 1;
+            __m512i sum0 = _mm512_setzero_si512(), sum1 = _mm512_setzero_si512(), sum2 = _mm512_setzero_si512(), sum3 = _mm512_setzero_si512();
+
+            // 16-bit accumulators can't overflow within 256 rows.
+            for (int y0 = 0; y0 < block_height; y0 += 256)
+            {
+                __m512i acc_lo = _mm512_setzero_si512(), acc_hi = _mm512_setzero_si512();
+
+                for (int y = y0; y < std::min(y0 + 256, block_height); ++y)
+                {
+                    const __m512i a = _mm512_maskz_loadu_epi8(mask, s1);
+                    const __m512i b = _mm512_maskz_loadu_epi8(mask, s2);
+                    const __m512i d = _mm512_or_si512(_mm512_subs_epu8(a, b), _mm512_subs_epu8(b, a));
+
+                    acc_lo = _mm512_add_epi16(acc_lo, _mm512_cvtepu8_epi16(_mm512_castsi512_si256(d)));
+                    acc_hi = _mm512_add_epi16(acc_hi, _mm512_cvtepu8_epi16(_mm512_extracti64x4_epi64(d, 1)));
+
+                    s1 += src1_stride_y;
+                    s2 += src2_stride_y;
+                }
+
+                sum0 = _mm512_add_epi32(sum0, _mm512_cvtepu16_epi32(_mm512_castsi512_si256(acc_lo)));
+                sum1 = _mm512_add_epi32(sum1, _mm512_cvtepu16_epi32(_mm512_extracti64x4_epi64(acc_lo, 1)));
+                sum2 = _mm512_add_epi32(sum2, _mm512_cvtepu16_epi32(_mm512_castsi512_si256(acc_hi)));
+                sum3 = _mm512_add_epi32(sum3, _mm512_cvtepu16_epi32(_mm512_extracti64x4_epi64(acc_hi, 1)));
+            }
+
+            _mm512_store_si512(colsum, sum0);
+            _mm512_store_si512(colsum + 16, sum1);
+            _mm512_store_si512(colsum + 32, sum2);
+            _mm512_store_si512(colsum + 48, sum3);
+        }
+        else
+        {
+            const __mmask32 mask = (count == 32) ? ~0U : (1U << count) - 1;
+            __m512i sum0 = _mm512_setzero_si512(), sum1 = _mm512_setzero_si512();
+
+            for (int y = 0; y < block_height; ++y)
+            {
+                const __m512i a = _mm512_maskz_loadu_epi16(mask, s1);
+                const __m512i b = _mm512_maskz_loadu_epi16(mask, s2);
+                const __m512i d = _mm512_sub_epi16(_mm512_max_epu16(a, b), _mm512_min_epu16(a, b));
+
+                sum0 = _mm512_add_epi32(sum0, _mm512_cvtepu16_epi32(_mm512_castsi512_si256(d)));
+                sum1 = _mm512_add_epi32(sum1, _mm512_cvtepu16_epi32(_mm512_extracti64x4_epi64(d, 1)));
+
+                s1 += src1_stride_y;
+                s2 += src2_stride_y;
+            }
+
+            _mm512_store_si512(colsum, sum0);
+            _mm512_store_si512(colsum + 16, sum1);
+        }
+
+        for (int i = 0; i < count; ++i)
+            acc.add(colsum[i]);
+    }
+}
+
+template void lumaDiffRow_avx512<uint8_t>(const void* src1_y, const void* src2_y, int src1_stride_y, int src2_stride_y, int block_width, int block_height, int blocks_x, float* diff);
+template void lumaDiffRow_avx512<uint16_t>(const void* src1_y, const void* src2_y, int src1_stride_y, int src2_stride_y, int block_width, int block_height, int blocks_x, float* diff);
+
+namespace
+{
+
+// Mask bits map directly onto AVX-512 lane masks, so the remainders are handled with masked loads and stores.
+template <typename T>
+struct BlockRowOps_avx512
+{
+    static constexpr int step = 64 / sizeof(T);
+
+    static inline uint64_t lanes(int count)
+    {
+        return (count >= 64) ? ~0ULL : (1ULL << count) - 1;
+    }
+
+    static inline __m512i load(const T* p, uint64_t m)
+    {
+        if constexpr (sizeof(T) == 1)
+            return _mm512_maskz_loadu_epi8(m, p);
+        else
+            return _mm512_maskz_loadu_epi16(static_cast<__mmask32>(m), p);
+    }
+
+    static inline void store(T* p, uint64_t m, const __m512i& v)
+    {
+        if constexpr (sizeof(T) == 1)
+            _mm512_mask_storeu_epi8(p, m, v);
+        else
+            _mm512_mask_storeu_epi16(p, static_cast<__mmask32>(m), v);
+    }
+
+    static inline uint64_t rainbow(const __m512i& p, const __m512i& c, const __m512i& n, const __m512i& var)
+    {
+        // c + variation < min(p, n) || c > max(p, n) + variation
+        if constexpr (sizeof(T) == 1)
+            return _mm512_cmplt_epu8_mask(_mm512_adds_epu8(c, var), _mm512_min_epu8(p, n)) | _mm512_cmpgt_epu8_mask(c, _mm512_adds_epu8(_mm512_max_epu8(p, n), var));
+        else
+            return _mm512_cmplt_epu16_mask(_mm512_adds_epu16(c, var), _mm512_min_epu16(p, n)) | _mm512_cmpgt_epu16_mask(c, _mm512_adds_epu16(_mm512_max_epu16(p, n), var));
+    }
+
+    static void makeMask(const T* srcp_u, const T* srcp_v,
+        const T* srcc_u, const T* srcc_v,
+        const T* srcn_u, const T* srcn_v,
+        int width, int variation, uint64_t* mask, int pos)
+    {
+        const __m512i var = (sizeof(T) == 1) ? _mm512_set1_epi8(static_cast<char>(variation)) : _mm512_set1_epi16(static_cast<short>(variation));
+
+        for (int x = 0; x < width; x += step)
+        {
+            const int count = std::min(step, width - x);
+            const uint64_t m = lanes(count);
+
+            const uint64_t bits = rainbow(load(srcp_u + x, m), load(srcc_u + x, m), load(srcn_u + x, m), var)
+                | rainbow(load(srcp_v + x, m), load(srcc_v + x, m), load(srcn_v + x, m), var);
+
+            orMaskBits(mask, pos + x, bits & m, count);
+        }
+    }
+
+    template <BlendDirection blenddirection>
+    static inline __m512i blendPixels(const __m512i& p, const __m512i& c, const __m512i& n, uint64_t m)
+    {
+        // (2 * c + p + n + 3) >> 2 == avg(c, avg(p, n))
+        if constexpr (sizeof(T) == 1)
+            return _mm512_mask_blend_epi8(m, c, (blenddirection == bdNext) ? _mm512_avg_epu8(c, n) : (blenddirection == bdPrev) ? _mm512_avg_epu8(c, p) : _mm512_avg_epu8(c, _mm512_avg_epu8(p, n)));
+        else
+            return _mm512_mask_blend_epi16(static_cast<__mmask32>(m), c, (blenddirection == bdNext) ? _mm512_avg_epu16(c, n) : (blenddirection == bdPrev) ? _mm512_avg_epu16(c, p) : _mm512_avg_epu16(c, _mm512_avg_epu16(p, n)));
+    }
+
+    template <BlendDirection blenddirection>
+    static void blend(const T* srcp_u, const T* srcp_v,
+        const T* srcc_u, const T* srcc_v,
+        const T* srcn_u, const T* srcn_v,
+        T* dst_u, T* dst_v,
+        int width, const uint64_t* mask, int pos)
+    {
+        for (int x = 0; x < width; x += step)
+        {
+            const uint64_t m = lanes(std::min(step, width - x));
+            const uint64_t bits = getMaskBits(mask, pos + x);
+
+            const __m512i c_u = load(srcc_u + x, m);
+            const __m512i c_v = load(srcc_v + x, m);
+            const __m512i p_u = (blenddirection != bdNext) ? load(srcp_u + x, m) : c_u;
+            const __m512i p_v = (blenddirection != bdNext) ? load(srcp_v + x, m) : c_v;
+            const __m512i n_u = (blenddirection != bdPrev) ? load(srcn_u + x, m) : c_u;
+            const __m512i n_v = (blenddirection != bdPrev) ? load(srcn_v + x, m) : c_v;
+
+            store(dst_u + x, m, blendPixels<blenddirection>(p_u, c_u, n_u, bits));
+            store(dst_v + x, m, blendPixels<blenddirection>(p_v, c_v, n_v, bits));
+        }
+    }
+};
+
+} // namespace
+
+template <typename T>
+BlockRowFunction blockRowFunction_avx512(int block_width_uv, int block_height_uv)
+{
+    return selectBlockRow<T, BlockRowOps_avx512<T>>(block_width_uv, block_height_uv);
+}
+
+template BlockRowFunction blockRowFunction_avx512<uint8_t>(int block_width_uv, int block_height_uv);
+template BlockRowFunction blockRowFunction_avx512<uint16_t>(int block_width_uv, int block_height_uv);
@@ -0,0 +1,397 @@
+#include <algorithm>
+
+#include <emmintrin.h>
+
+#include "bifrost.h"
+
+template <typename T>
+void lumaDiffRow_sse2(const void* src1_y_, const void* src2_y_, int src1_stride_y, int src2_stride_y, int block_width, int block_height, int blocks_x, float* diff)
+{
+    const T* src1_y = reinterpret_cast<const T*>(src1_y_);
+    const T* src2_y = reinterpret_cast<const T*>(src2_y_);
+
+    const int width = block_width * blocks_x;
+    const int step = 16 / sizeof(T);
+    const __m128i zero = _mm_setzero_si128();
+
+    LumaDiffAccumulator<> acc(diff, block_width, block_height);
+    alignas(16) uint32_t colsum[16];
+
+    int x = 0;
+    for (; x + step <= width; x += step)
+    {
+        const T* s1 = src1_y + x;
+        const T* s2 = src2_y + x;
+
+        if constexpr (sizeof(T) == 1)
+        {
+            __m128i sum0 = zero, sum1 = zero, sum2 = zero, sum3 = zero;
+
+            // 16-bit accumulators can't overflow within 256 rows.
+            for (int y0 = 0; y0 < block_height; y0 += 256)
+            {
+                __m128i acc_lo = zero, acc_hi = zero;
+
+                for (int y = y0; y < std::min(y0 + 256, block_height); ++y)
+                {
+                    const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s1));
+                    const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s2));
+                    const __m128i d = _mm_or_si128(_mm_subs_epu8(a, b), _mm_subs_epu8(b, a));
+
+                    acc_lo = _mm_add_epi16(acc_lo, _mm_unpacklo_epi8(d, zero));
+                    acc_hi = _mm_add_epi16(acc_hi, _mm_unpackhi_epi8(d, zero));
+
+                    s1 += src1_stride_y;
+                    s2 += src2_stride_y;
+                }
+
+                sum0 = _mm_add_epi32(sum0, _mm_unpacklo_epi16(acc_lo, zero));
+                sum1 = _mm_add_epi32(sum1, _mm_unpackhi_epi16(acc_lo, zero));
+                sum2 = _mm_add_epi32(sum2, _mm_unpacklo_epi16(acc_hi, zero));
+                sum3 = _mm_add_epi32(sum3, _mm_unpackhi_epi16(acc_hi, zero));
+            }
+
+            _mm_store_si128(reinterpret_cast<__m128i*>(colsum), sum0);
+            _mm_store_si128(reinterpret_cast<__m128i*>(colsum + 4), sum1);
+            _mm_store_si128(reinterpret_cast<__m128i*>(colsum + 8), sum2);
+            _mm_store_si128(reinterpret_cast<__m128i*>(colsum + 12), sum3);
+        }
+        else
+        {
+            __m128i sum0 = zero, sum1 = zero;
+
+            for (int y = 0; y < block_height; ++y)
+            {
+                const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s1));
+                const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s2));
+                const __m128i d = _mm_or_si128(_mm_subs_epu16(a, b), _mm_subs_epu16(b, a));
+
+                sum0 = _mm_add_epi32(sum0, _mm_unpacklo_epi16(d, zero));
+                sum1 = _mm_add_epi32(sum1, _mm_unpackhi_epi16(d, zero));
+
+                s1 += src1_stride_y;
+                s2 += src2_stride_y;
+            }
+
+            _mm_store_si128(reinterpret_cast<__m128i*>(colsum), sum0);
+            _mm_store_si128(reinterpret_cast<__m128i*>(colsum + 4), sum1);
+        }
+
+        for (int i = 0; i < step; ++i)
+            acc.add(colsum[i]);
+    }
+
+    for (; x < width; ++x)
+        acc.add(lumaColumnDiff<T>(src1_y + x, src2_y + x, src1_stride_y, src2_stride_y, block_height));
+}
+
+uint64_t hashPlane_sse2(const uint8_t* srcp, int pitch, int row_size, int height)
+{
+    alignas(16) uint64_t acc_lanes[4];
+    uint8_t tail[hash_stripe];
+    hashInit(acc_lanes);
+
+    const __m128i prime = _mm_set1_epi64x(hash_prime);
+    __m128i acc[2] = { _mm_load_si128(reinterpret_cast<const __m128i*>(acc_lanes)), _mm_load_si128(reinterpret_cast<const __m128i*>(acc_lanes + 2)) };
+
+    // hashStripe and hashScramble on lanes 0-1 and 2-3
+    auto stripe = [&](const uint8_t* p, const uint64_t* key)
+    {
+        for (int i = 0; i < 2; ++i)
+        {
+            const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 16 * i));
+            const __m128i k = _mm_xor_si128(v, _mm_loadu_si128(reinterpret_cast<const __m128i*>(key + 2 * i)));
+            acc[i] = _mm_add_epi64(acc[i], _mm_add_epi64(_mm_mul_epu32(k, _mm_srli_epi64(k, 32)), v));
+        }
+    };
+
+    auto scramble = [&]()
+    {
+        for (int i = 0; i < 2; ++i)
+        {
+            const __m128i a = _mm_xor_si128(_mm_xor_si128(acc[i], _mm_srli_epi64(acc[i], 47)), _mm_loadu_si128(reinterpret_cast<const __m128i*>(hash_keys.scramble + 2 * i)));
+            //64-bit product with a 32-bit multiplier
+            acc[i] = _mm_add_epi64(_mm_mul_epu32(a, prime), _mm_slli_epi64(_mm_mul_epu32(_mm_srli_epi64(a, 32), prime), 32));
+        }
+    };
+
+    for (int y = 0; y < height; ++y)
+    {
+        int x = 0, s = 0;
+        for (; x + hash_stripe <= row_size; x += hash_stripe, ++s)
+        {
+            stripe(srcp + x, hash_keys.stripe[s & 15]);
+            if ((s & 15) == 15)
+                scramble();
+        }
+
+        if (x < row_size)
+            stripe(hashTail(srcp, x, row_size, tail), hash_keys.stripe[s & 15]);
+
+        scramble();
+        srcp += pitch;
+    }
+
+    _mm_store_si128(reinterpret_cast<__m128i*>(acc_lanes), acc[0]);
+    _mm_store_si128(reinterpret_cast<__m128i*>(acc_lanes + 2), acc[1]);
+
+    return hashFinish(acc_lanes, row_size, height);
+}
+
+void streamRows_sse2(uint8_t* dstp, int dst_pitch, const uint8_t* srcp, int src_pitch, int row_size, int height)
+{
+    for (int y = 0; y < height; ++y)
+    {
+        uint8_t* dst = dstp + static_cast<int64_t>(y) * dst_pitch;
+        const uint8_t* src = srcp + static_cast<int64_t>(y) * src_pitch;
+
+        //streaming stores need 16-byte aligned destinations, the head and the tail are copied as usual
+        const int head = std::min(static_cast<int>((16 - reinterpret_cast<uintptr_t>(dst) % 16) % 16), row_size);
+        memcpy(dst, src, head);
+
+        int x = head;
+        for (; x + 64 <= row_size; x += 64)
+        {
+            const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x));
+            const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x + 16));
+            const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x + 32));
+            const __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x + 48));
+            _mm_stream_si128(reinterpret_cast<__m128i*>(dst + x), a);
+            _mm_stream_si128(reinterpret_cast<__m128i*>(dst + x + 16), b);
+            _mm_stream_si128(reinterpret_cast<__m128i*>(dst + x + 32), c);
+            _mm_stream_si128(reinterpret_cast<__m128i*>(dst + x + 48), d);
+        }
+
+        for (; x + 16 <= row_size; x += 16)
+            _mm_stream_si128(reinterpret_cast<__m128i*>(dst + x), _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x)));
+
+        memcpy(dst + x, src + x, row_size - x);
+    }
+
+    _mm_sfence();
+}
+
+// Packs unsigned 32-bit values below 65536 into 16 bits, SSE2 only has the signed pack.
+static inline __m128i packus32(__m128i a, __m128i b)
+{
+    const __m128i bias = _mm_set1_epi32(0x8000);
+    return _mm_xor_si128(_mm_packs_epi32(_mm_sub_epi32(a, bias), _mm_sub_epi32(b, bias)), _mm_set1_epi16(-0x8000));
+}
+
+template <typename T, int Scale>
+void decimateRow_sse2(const void* src_y_, int src_stride_y, void* dst_, int width)
+{
+    const T* src_y = reinterpret_cast<const T*>(src_y_);
+    T* dst = reinterpret_cast<T*>(dst_);
+
+    int x = 0;
+
+    if constexpr (sizeof(T) == 1)
+    {
+        const __m128i low = _mm_set1_epi16(0x00FF);
+        const __m128i round = _mm_set1_epi16(Scale * Scale / 2);
+
+        //8 pixels at a time, columns are added in pairs in 16-bit lanes
+        for (; x + 8 <= width; x += 8)
+        {
+            __m128i sum0 = _mm_setzero_si128(), sum1 = _mm_setzero_si128();
+
+            for (int y = 0; y < Scale; ++y)
+            {
+                const T* s = src_y + src_stride_y * static_cast<int64_t>(y) + x * Scale;
+                const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s));
+                sum0 = _mm_add_epi16(sum0, _mm_add_epi16(_mm_and_si128(a, low), _mm_srli_epi16(a, 8)));
+
+                if constexpr (Scale == 4)
+                {
+                    const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + 16));
+                    sum1 = _mm_add_epi16(sum1, _mm_add_epi16(_mm_and_si128(b, low), _mm_srli_epi16(b, 8)));
+                }
+            }
+
+            if constexpr (Scale == 4)
+            {
+                const __m128i ones = _mm_set1_epi16(1);
+                sum0 = _mm_packs_epi32(_mm_madd_epi16(sum0, ones), _mm_madd_epi16(sum1, ones));
+            }
+
+            sum0 = _mm_srli_epi16(_mm_add_epi16(sum0, round), (Scale == 2) ? 2 : 4);
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + x), _mm_packus_epi16(sum0, sum0));
+        }
+    }
+    else
+    {
+        const __m128i low = _mm_set1_epi32(0xFFFF);
+        const __m128i round = _mm_set1_epi32(Scale * Scale / 2);
+
+        //8 pixels at a time, columns are added in pairs in 32-bit lanes
+        for (; x + 8 <= width; x += 8)
+        {
+            __m128i sum[4] = { _mm_setzero_si128(), _mm_setzero_si128(), _mm_setzero_si128(), _mm_setzero_si128() };
+
+            for (int y = 0; y < Scale; ++y)
+            {
+                const T* s = src_y + src_stride_y * static_cast<int64_t>(y) + x * Scale;
+
+                for (int i = 0; i < Scale; ++i)
+                {
+                    const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i * 8));
+                    sum[i] = _mm_add_epi32(sum[i], _mm_add_epi32(_mm_and_si128(a, low), _mm_srli_epi32(a, 16)));
+                }
+            }
+
+            __m128i lo = sum[0], hi = sum[1];
+
+            if constexpr (Scale == 4)
+            {
+                //pairs of pairs, the sums end up in the even lanes
+                for (int i = 0; i < 4; ++i)
+                    sum[i] = _mm_add_epi32(sum[i], _mm_srli_epi64(sum[i], 32));
+
+                lo = _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(sum[0]), _mm_castsi128_ps(sum[1]), _MM_SHUFFLE(2, 0, 2, 0)));
+                hi = _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(sum[2]), _mm_castsi128_ps(sum[3]), _MM_SHUFFLE(2, 0, 2, 0)));
+            }
+
+            lo = _mm_srli_epi32(_mm_add_epi32(lo, round), (Scale == 2) ? 2 : 4);
+            hi = _mm_srli_epi32(_mm_add_epi32(hi, round), (Scale == 2) ? 2 : 4);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x), packus32(lo, hi));
+        }
+    }
+
+    decimatePixels<T, Scale>(src_y, src_stride_y, dst, x, width);
+}
+
+template void decimateRow_sse2<uint8_t, 2>(const void* src_y, int src_stride_y, void* dst, int width);
+template void decimateRow_sse2<uint8_t, 4>(const void* src_y, int src_stride_y, void* dst, int width);
+template void decimateRow_sse2<uint16_t, 2>(const void* src_y, int src_stride_y, void* dst, int width);
+template void decimateRow_sse2<uint16_t, 4>(const void* src_y, int src_stride_y, void* dst, int width);
+
+template void lumaDiffRow_sse2<uint8_t>(const void* src1_y, const void* src2_y, int src1_stride_y, int src2_stride_y, int block_width, int block_height, int blocks_x, float* diff);
+template void lumaDiffRow_sse2<uint16_t>(const void* src1_y, const void* src2_y, int src1_stride_y, int src2_stride_y, int block_width, int block_height, int blocks_x, float* diff);
+
+namespace
+{
+
+template <typename T>
+struct BlockRowOps_sse2
+{
+    static inline __m128i rainbow(const __m128i& p, const __m128i& c, const __m128i& n, const __m128i& var)
+    {
+        // c + variation < min(p, n) || c > max(p, n) + variation
+        if constexpr (sizeof(T) == 1)
+        {
+            const __m128i lo = _mm_min_epu8(p, n);
+            const __m128i hi = _mm_max_epu8(p, n);
+
+            return _mm_or_si128(_mm_subs_epu8(lo, _mm_adds_epu8(c, var)), _mm_subs_epu8(c, _mm_adds_epu8(hi, var)));
+        }
+        else
+        {
+            const __m128i d = _mm_subs_epu16(p, n);
+            const __m128i lo = _mm_sub_epi16(p, d);
+            const __m128i hi = _mm_add_epi16(n, d);
+
+            return _mm_or_si128(_mm_subs_epu16(lo, _mm_adds_epu16(c, var)), _mm_subs_epu16(c, _mm_adds_epu16(hi, var)));
+        }
+    }
+
+    static void makeMask(const T* srcp_u, const T* srcp_v,
+        const T* srcc_u, const T* srcc_v,
+        const T* srcn_u, const T* srcn_v,
+        int width, int variation, uint64_t* mask, int pos)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i var = (sizeof(T) == 1) ? _mm_set1_epi8(static_cast<char>(variation)) : _mm_set1_epi16(static_cast<short>(variation));
+        const int step = 16 / sizeof(T);
+
+        int x = 0;
+        for (; x + 16 <= width; x += 16)
+        {
+            __m128i m = _mm_or_si128(
+                rainbow(_mm_loadu_si128(reinterpret_cast<const __m128i*>(srcp_u + x)), _mm_loadu_si128(reinterpret_cast<const __m128i*>(srcc_u + x)), _mm_loadu_si128(reinterpret_cast<const __m128i*>(srcn_u + x)), var),
+                rainbow(_mm_loadu_si128(reinterpret_cast<const __m128i*>(srcp_v + x)), _mm_loadu_si128(reinterpret_cast<const __m128i*>(srcc_v + x)), _mm_loadu_si128(reinterpret_cast<const __m128i*>(srcn_v + x)), var));
+
+            if constexpr (sizeof(T) == 1)
+                m = _mm_cmpeq_epi8(m, zero);
+            else
+            {
+                const __m128i m2 = _mm_or_si128(
+                    rainbow(_mm_loadu_si128(reinterpret_cast<const __m128i*>(srcp_u + x + step)), _mm_loadu_si128(reinterpret_cast<const __m128i*>(srcc_u + x + step)), _mm_loadu_si128(reinterpret_cast<const __m128i*>(srcn_u + x + step)), var),
+                    rainbow(_mm_loadu_si128(reinterpret_cast<const __m128i*>(srcp_v + x + step)), _mm_loadu_si128(reinterpret_cast<const __m128i*>(srcc_v + x + step)), _mm_loadu_si128(reinterpret_cast<const __m128i*>(srcn_v + x + step)), var));
+
+                m = _mm_packs_epi16(_mm_cmpeq_epi16(m, zero), _mm_cmpeq_epi16(m2, zero));
+            }
+
+            orMaskBits(mask, pos + x, ~_mm_movemask_epi8(m) & 0xFFFF, 16);
+        }
+
+        if (x < width)
+            BlockRowOps_c<T>::makeMask(srcp_u + x, srcp_v + x, srcc_u + x, srcc_v + x, srcn_u + x, srcn_v + x, width - x, variation, mask, pos + x);
+    }
+
+    template <BlendDirection blenddirection>
+    static inline __m128i blendPixels(const __m128i& p, const __m128i& c, const __m128i& n, const __m128i& m)
+    {
+        // (2 * c + p + n + 3) >> 2 == avg(c, avg(p, n))
+        __m128i b;
+        if constexpr (sizeof(T) == 1)
+            b = (blenddirection == bdNext) ? _mm_avg_epu8(c, n) : (blenddirection == bdPrev) ? _mm_avg_epu8(c, p) : _mm_avg_epu8(c, _mm_avg_epu8(p, n));
+        else
+            b = (blenddirection == bdNext) ? _mm_avg_epu16(c, n) : (blenddirection == bdPrev) ? _mm_avg_epu16(c, p) : _mm_avg_epu16(c, _mm_avg_epu16(p, n));
+
+        return _mm_or_si128(_mm_and_si128(m, b), _mm_andnot_si128(m, c));
+    }
+
+    template <BlendDirection blenddirection>
+    static void blend(const T* srcp_u, const T* srcp_v,
+        const T* srcc_u, const T* srcc_v,
+        const T* srcn_u, const T* srcn_v,
+        T* dst_u, T* dst_v,
+        int width, const uint64_t* mask, int pos)
+    {
+        const int step = 16 / sizeof(T);
+        const __m128i sel = (sizeof(T) == 1) ? _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128) : _mm_setr_epi16(1, 2, 4, 8, 16, 32, 64, 128);
+
+        int x = 0;
+        for (; x + step <= width; x += step)
+        {
+            const uint64_t bits = getMaskBits(mask, pos + x);
+            __m128i m;
+
+            if constexpr (sizeof(T) == 1)
+            {
+                m = _mm_unpacklo_epi64(_mm_set1_epi8(static_cast<char>(bits)), _mm_set1_epi8(static_cast<char>(bits >> 8)));
+                m = _mm_cmpeq_epi8(_mm_and_si128(m, sel), sel);
+            }
+            else
+            {
+                m = _mm_set1_epi16(static_cast<short>(bits & 0xFF));
+                m = _mm_cmpeq_epi16(_mm_and_si128(m, sel), sel);
+            }
+
+            const __m128i c_u = _mm_loadu_si128(reinterpret_cast<const __m128i*>(srcc_u + x));
+            const __m128i c_v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(srcc_v + x));
+            const __m128i p_u = (blenddirection != bdNext) ? _mm_loadu_si128(reinterpret_cast<const __m128i*>(srcp_u + x)) : c_u;
+            const __m128i p_v = (blenddirection != bdNext) ? _mm_loadu_si128(reinterpret_cast<const __m128i*>(srcp_v + x)) : c_v;
+            const __m128i n_u = (blenddirection != bdPrev) ? _mm_loadu_si128(reinterpret_cast<const __m128i*>(srcn_u + x)) : c_u;
+            const __m128i n_v = (blenddirection != bdPrev) ? _mm_loadu_si128(reinterpret_cast<const __m128i*>(srcn_v + x)) : c_v;
+
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst_u + x), blendPixels<blenddirection>(p_u, c_u, n_u, m));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst_v + x), blendPixels<blenddirection>(p_v, c_v, n_v, m));
+        }
+
+        if (x < width)
+            BlockRowOps_c<T>::template blend<blenddirection>(srcp_u + x, srcp_v + x, srcc_u + x, srcc_v + x, srcn_u + x, srcn_v + x, dst_u + x, dst_v + x, width - x, mask, pos + x);
+    }
+};
+
+} // namespace
+
+template <typename T>
+BlockRowFunction blockRowFunction_sse2(int block_width_uv, int block_height_uv)
+{
+    return selectBlockRow<T, BlockRowOps_sse2<T>>(block_width_uv, block_height_uv);
+}
+
+template BlockRowFunction blockRowFunction_sse2<uint8_t>(int block_width_uv, int block_height_uv);
+template BlockRowFunction blockRowFunction_sse2<uint16_t>(int block_width_uv, int block_height_uv);
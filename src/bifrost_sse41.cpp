@@ -0,0 +1,46 @@
+#include <smmintrin.h>
+
+#include "bifrost.h"
+
+// Only the 16-bit kernel benefits from SSE4.1 (unsigned 16-bit min/max); 8-bit input uses the SSE2 kernel.
+void lumaDiffRow_sse41(const void* src1_y_, const void* src2_y_, int src1_stride_y, int src2_stride_y, int block_width, int block_height, int blocks_x, float* diff)
+{
+    const uint16_t* src1_y = reinterpret_cast<const uint16_t*>(src1_y_);
+    const uint16_t* src2_y = reinterpret_cast<const uint16_t*>(src2_y_);
+
+    const int width = block_width * blocks_x;
+
+    LumaDiffAccumulator<> acc(diff, block_width, block_height);
+    alignas(16) uint32_t colsum[8];
+
+    int x = 0;
+    for (; x + 8 <= width; x += 8)
+    {
+        const uint16_t* s1 = src1_y + x;
+        const uint16_t* s2 = src2_y + x;
+
+        __m128i sum0 = _mm_setzero_si128(), sum1 = _mm_setzero_si128();
+
+        for (int y = 0; y < block_height; ++y)
+        {
+            const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s1));
+            const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s2));
+            const __m128i d = _mm_sub_epi16(_mm_max_epu16(a, b), _mm_min_epu16(a, b));
+
+            sum0 = _mm_add_epi32(sum0, _mm_cvtepu16_epi32(d));
+            sum1 = _mm_add_epi32(sum1, _mm_cvtepu16_epi32(_mm_srli_si128(d, 8)));
+
+            s1 += src1_stride_y;
+            s2 += src2_stride_y;
+        }
+
+        _mm_store_si128(reinterpret_cast<__m128i*>(colsum), sum0);
+        _mm_store_si128(reinterpret_cast<__m128i*>(colsum + 4), sum1);
+
+        for (int i = 0; i < 8; ++i)
+            acc.add(colsum[i]);
+    }
+
+    for (; x < width; ++x)
+        acc.add(lumaColumnDiff<uint16_t>(src1_y + x, src2_y + x, src1_stride_y, src2_stride_y, block_height));
+}
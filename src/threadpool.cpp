@@ -0,0 +1,102 @@
+#include <algorithm>
+
+#include "threadpool.h"
+
+ThreadPool::ThreadPool(int threads)
+    : stop(false)
+{
+    for (int i = 1; i < threads; ++i)
+        workers.emplace_back(&ThreadPool::worker, this);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        stop = true;
+    }
+
+    work_cv.notify_all();
+
+    for (auto& t : workers)
+        t.join();
+}
+
+void ThreadPool::execute(Job* job)
+{
+    int i;
+    while ((i = job->next.fetch_add(1, std::memory_order_relaxed)) < job->count)
+        (*job->func)(i);
+}
+
+void ThreadPool::worker()
+{
+    std::unique_lock<std::mutex> lock(mtx);
+
+    for (;;)
+    {
+        work_cv.wait(lock, [this]() { return stop || !jobs.empty(); });
+
+        if (stop)
+            return;
+
+        Job* job = jobs.front();
+        if (++job->helpers >= job->max_helpers)
+            jobs.pop_front();
+        ++job->active;
+
+        lock.unlock();
+        execute(job);
+        lock.lock();
+
+        if (--job->active == 0)
+            done_cv.notify_all();
+    }
+}
+
+void ThreadPool::run(int count, int max_threads, const std::function<void(int)>& func)
+{
+    const int max_helpers = std::min(std::min(max_threads, count) - 1, static_cast<int>(workers.size()));
+
+    if (max_helpers <= 0)
+    {
+        for (int i = 0; i < count; ++i)
+            func(i);
+
+        return;
+    }
+
+    Job job;
+    job.func = &func;
+    job.count = count;
+    job.next = 0;
+    job.helpers = 0;
+    job.max_helpers = max_helpers;
+    job.active = 0;
+
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        jobs.push_back(&job);
+    }
+
+    if (max_helpers == 1)
+        work_cv.notify_one();
+    else
+        work_cv.notify_all();
+
+    execute(&job);
+
+    // All tasks are claimed, wait for the helpers that are still running theirs.
+    std::unique_lock<std::mutex> lock(mtx);
+
+    for (auto it = jobs.begin(); it != jobs.end(); ++it)
+    {
+        if (*it == &job)
+        {
+            jobs.erase(it);
+            break;
+        }
+    }
+
+    done_cv.wait(lock, [&job]() { return job.active == 0; });
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Persistent workers shared by all GetFrame calls of one filter instance.
+// Several frames may be processed at the same time (MT_NICE_FILTER), every call of run() is a separate job
+// and idle workers help with the oldest job that still accepts helpers.
+class ThreadPool
+{
+    struct Job
+    {
+        const std::function<void(int)>* func;
+        int count;
+        std::atomic<int> next;
+        int helpers;
+        int max_helpers;
+        int active;
+    };
+
+    std::mutex mtx;
+    std::condition_variable work_cv;
+    std::condition_variable done_cv;
+    std::deque<Job*> jobs;
+    std::vector<std::thread> workers;
+    bool stop;
+
+    static void execute(Job* job);
+    void worker();
+
+public:
+    // threads includes the calling thread, so threads - 1 workers are started.
+    explicit ThreadPool(int threads);
+    ~ThreadPool();
+
+    int size() const { return static_cast<int>(workers.size()) + 1; }
+
+    // Calls func(i) for every i in [0, count) on at most max_threads threads, the calling thread included.
+    // Tasks are claimed one at a time, so a thread that finishes early takes over the remaining ones.
+    void run(int count, int max_threads, const std::function<void(int)>& func);
+};
@@ -0,0 +1,437 @@
+// Throughput of the whole filter and of the individual kernels on generated clips.
+// Usage: bifrost_bench [width height [frames]]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include "avisynth.h"
+#include "bifrost.h"
+#include "invoke.h"
+#include "kernels.h"
+#include "synthetic_clip.h"
+
+typedef std::chrono::steady_clock Clock;
+
+static double seconds(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+struct Format
+{
+    const char* name;
+    int bits;
+    int ssw;
+    int ssh;
+};
+
+static const Format formats[] =
+{
+    { "420p8", 8, 1, 1 }, { "422p8", 8, 1, 0 }, { "444p8", 8, 0, 0 },
+    { "420p10", 10, 1, 1 }, { "422p10", 10, 1, 0 }, { "444p10", 10, 0, 0 },
+    { "420p16", 16, 1, 1 }, { "422p16", 16, 1, 0 }, { "444p16", 16, 0, 0 },
+    { "420ps", 32, 1, 1 }, { "422ps", 32, 1, 0 }, { "444ps", 32, 0, 0 }
+};
+
+static const int block_sizes[][2] = { { 4, 4 }, { 8, 8 }, { 16, 16 } };
+
+// Runs the kernels over whole frames like Framedepth does and returns ns per block for the luma difference
+// and the block row (mask + blend) stages.
+template <typename T>
+static void benchKernels(const KernelSet& set, const PVideoFrame& f1, const PVideoFrame& f2, const PVideoFrame& f3, PVideoFrame& dst,
+    const VideoInfo& vi, int block_width, int block_height, double& luma_ns, double& row_ns)
+{
+    const int blocks_x = vi.width / block_width;
+    const int blocks_y = vi.height / block_height;
+    const int block_width_uv = block_width >> vi.GetPlaneWidthSubsampling(PLANAR_U);
+    const int block_height_uv = block_height >> vi.GetPlaneHeightSubsampling(PLANAR_U);
+    const int width_uv = blocks_x * block_width_uv;
+    const double blocks = static_cast<double>(blocks_x) * blocks_y;
+
+    const LumaDiffRowFunction lumaDiffRow = lumaDiffRowOf<T>(set);
+    const BlockRowFunction blockRow = blockRowOf<T>(set)(block_width_uv, block_height_uv);
+
+    std::vector<float> diff(blocks_x);
+    int repeats = 0;
+    Clock::time_point start = Clock::now();
+
+    do
+    {
+        for (int y = 0; y < blocks_y; ++y)
+            lumaDiffRow(f1->GetReadPtr(PLANAR_Y) + static_cast<int64_t>(y) * block_height * f1->GetPitch(PLANAR_Y),
+                f2->GetReadPtr(PLANAR_Y) + static_cast<int64_t>(y) * block_height * f2->GetPitch(PLANAR_Y),
+                f1->GetPitch(PLANAR_Y) / sizeof(T), f2->GetPitch(PLANAR_Y) / sizeof(T), block_width, block_height, blocks_x, diff.data());
+
+        ++repeats;
+    } while (seconds(start) < 0.2);
+
+    luma_ns = seconds(start) * 1e9 / (blocks * repeats);
+
+    // A typical mix: mostly static blocks, some with motion on one side and some that fall back.
+    std::vector<uint8_t> source(blocks_x), direction(blocks_x);
+    for (int x = 0; x < blocks_x; ++x)
+    {
+        source[x] = (x % 11 == 0) ? msFallback : (x % 7 == 0) ? msPrev : (x % 13 == 0) ? msNext : msCurrent;
+        direction[x] = static_cast<uint8_t>((x / 3) % 3);
+    }
+
+    BlockRow r;
+    r.mask_stride = (width_uv + 63) / 64 + 1;
+    std::vector<uint64_t> mask(static_cast<size_t>(r.mask_stride) * block_height_uv);
+    std::vector<uint64_t> inner_left(r.mask_stride), inner_right(r.mask_stride);
+    for (int x = 0; x < width_uv; ++x)
+    {
+        if (x % block_width_uv != 0)
+            inner_left[x >> 6] |= 1ULL << (x & 63);
+        if (x % block_width_uv != block_width_uv - 1)
+            inner_right[x >> 6] |= 1ULL << (x & 63);
+    }
+
+    r.srcpp_pitch_uv = r.srcp_pitch_uv = f1->GetPitch(PLANAR_U) / sizeof(T);
+    r.srcc_pitch_uv = r.altsrcc_pitch_uv = f2->GetPitch(PLANAR_U) / sizeof(T);
+    r.srcn_pitch_uv = r.srcnn_pitch_uv = f3->GetPitch(PLANAR_U) / sizeof(T);
+    r.dst_pitch_uv = dst->GetPitch(PLANAR_U) / sizeof(T);
+    r.source = source.data();
+    r.direction = direction.data();
+    r.blocks_x = blocks_x;
+    r.block_width_uv = block_width_uv;
+    r.block_height_uv = block_height_uv;
+    r.col = (vi.width - blocks_x * block_width) >> vi.GetPlaneWidthSubsampling(PLANAR_U);
+    r.variation = (vi.ComponentSize() == 4) ? 0 : 5 << (vi.BitsPerComponent() - 8);
+    r.variation_f = 5 / 255.0f;
+    r.conservative_mask = false;
+    r.mask_only = false;
+    r.mask = mask.data();
+    r.inner_left = inner_left.data();
+    r.inner_right = inner_right.data();
+    r.stats = nullptr;
+
+    repeats = 0;
+    start = Clock::now();
+
+    do
+    {
+        for (int y = 0; y < blocks_y; ++y)
+        {
+            const int64_t line = static_cast<int64_t>(y) * block_height_uv;
+
+            r.srcpp_u = r.srcp_u = f1->GetReadPtr(PLANAR_U) + line * f1->GetPitch(PLANAR_U);
+            r.srcpp_v = r.srcp_v = f1->GetReadPtr(PLANAR_V) + line * f1->GetPitch(PLANAR_V);
+            r.srcc_u = r.altsrcc_u = f2->GetReadPtr(PLANAR_U) + line * f2->GetPitch(PLANAR_U);
+            r.srcc_v = r.altsrcc_v = f2->GetReadPtr(PLANAR_V) + line * f2->GetPitch(PLANAR_V);
+            r.srcn_u = r.srcnn_u = f3->GetReadPtr(PLANAR_U) + line * f3->GetPitch(PLANAR_U);
+            r.srcn_v = r.srcnn_v = f3->GetReadPtr(PLANAR_V) + line * f3->GetPitch(PLANAR_V);
+            r.dst_u = dst->GetWritePtr(PLANAR_U) + line * dst->GetPitch(PLANAR_U);
+            r.dst_v = dst->GetWritePtr(PLANAR_V) + line * dst->GetPitch(PLANAR_V);
+
+            blockRow(r);
+        }
+
+        ++repeats;
+    } while (seconds(start) < 0.2);
+
+    row_ns = seconds(start) * 1e9 / (blocks * repeats);
+}
+
+int main(int argc, char** argv)
+{
+    const int width = (argc > 2) ? atoi(argv[1]) : 1920;
+    const int height = (argc > 2) ? atoi(argv[2]) : 1080;
+    const int num_frames = (argc > 3) ? atoi(argv[3]) : 30;
+    const int max_threads = std::max(static_cast<int>(std::thread::hardware_concurrency()), 1);
+
+    IScriptEnvironment env;
+    AvisynthPluginInit3(&env, nullptr);
+
+    const int cpu_flags = env.GetCPUFlags();
+
+    std::vector<int> thread_counts = { 1 };
+    for (int threads : { 2, 4, max_threads })
+        if (threads <= max_threads && threads > thread_counts.back())
+            thread_counts.push_back(threads);
+
+    printf("%dx%d, %d frames, %d logical processors\n\n", width, height, num_frames, max_threads);
+    printf("%-8s %-6s %-8s %-8s %12s %12s\n", "format", "block", "opt", "threads", "frames/s", "ns/block");
+
+    for (const Format& f : formats)
+    {
+        PClip src = new SyntheticClip(width, height, f.bits, f.ssw, f.ssh, num_frames);
+
+        for (int n = 0; n < num_frames; ++n)
+            src->GetFrame(n, &env);
+
+        for (auto& bs : block_sizes)
+        {
+            if (bs[0] % (1 << f.ssw) || bs[1] % (1 << f.ssh) || (bs[0] >> f.ssw) < 2 || (bs[1] >> f.ssh) < 2)
+                continue;
+
+            const double blocks = static_cast<double>(width / bs[0]) * (height / bs[1]);
+
+            for (int threads : thread_counts)
+            {
+                BifrostArgs args;
+                args.clip = src;
+                args.interlaced = false;
+                args.blockx = bs[0];
+                args.blocky = bs[1];
+                args.threads = threads;
+                const PClip clip = invoke(&env, args);
+
+                const Clock::time_point start = Clock::now();
+                for (int n = 0; n < num_frames; ++n)
+                    clip->GetFrame(n, &env);
+                const double elapsed = seconds(start);
+
+                printf("%-8s %2dx%-3d %-8s %-8d %12.1f %12.2f\n", f.name, bs[0], bs[1], "auto", threads, num_frames / elapsed, elapsed * 1e9 / (blocks * num_frames));
+            }
+
+            // The same blocks with the luma differences measured per 32x32 super-block first.
+            if (bs[0] < 32)
+            {
+                BifrostArgs args;
+                args.clip = src;
+                args.interlaced = false;
+                args.blockx = bs[0];
+                args.blocky = bs[1];
+                args.superblock = 32;
+                const PClip clip = invoke(&env, args);
+
+                const Clock::time_point start = Clock::now();
+                for (int n = 0; n < num_frames; ++n)
+                    clip->GetFrame(n, &env);
+                const double elapsed = seconds(start);
+
+                printf("%-8s %2dx%-3d %-8s %-8d %12.1f %12.2f\n", f.name, bs[0], bs[1], "sb32", 1, num_frames / elapsed, elapsed * 1e9 / (blocks * num_frames));
+            }
+        }
+    }
+
+    printf("\n420p8 8x8, single thread, region of interest\n");
+    printf("%-22s %12s\n", "roi", "frames/s");
+
+    {
+        PClip src = new SyntheticClip(width, height, 8, 1, 1, num_frames);
+
+        for (int n = 0; n < num_frames; ++n)
+            src->GetFrame(n, &env);
+
+        // The whole frame, and a ticker band over the bottom eighth of it.
+        for (int band = 0; band < 2; ++band)
+        {
+            BifrostArgs args;
+            args.clip = src;
+            args.interlaced = false;
+            args.blockx = args.blocky = 8;
+            args.roi_top = (band) ? height - height / 8 : 0;
+            const PClip clip = invoke(&env, args);
+
+            const Clock::time_point start = Clock::now();
+            for (int n = 0; n < num_frames; ++n)
+                clip->GetFrame(n, &env);
+
+            printf("%-22s %12.1f\n", (band) ? "bottom eighth" : "whole frame", num_frames / seconds(start));
+        }
+    }
+
+    printf("\n420p8 8x8, single thread, every frame held for 4 and for 8\n");
+    printf("%-6s %-10s %12s %12s\n", "hold", "dup_cache", "frames/s", "hits");
+
+    for (int hold : { 4, 8 })
+    {
+        PClip src = new SequenceClip(new SyntheticClip(width, height, 8, 1, 1, num_frames), SequenceClip::hold(hold, num_frames, num_frames * hold));
+
+        for (int n = 0; n < num_frames * hold; ++n)
+            src->GetFrame(n, &env);
+
+        for (int dup_cache : { 0, 16 })
+        {
+            BifrostArgs args;
+            args.clip = src;
+            args.interlaced = false;
+            args.blockx = args.blocky = 8;
+            args.stats = true;
+            args.dup_cache = dup_cache;
+            const PClip clip = invoke(&env, args);
+
+            int64_t hits = 0;
+
+            const Clock::time_point start = Clock::now();
+            for (int n = 0; n < num_frames * hold; ++n)
+                hits += env.propGetInt(env.getFramePropsRO(clip->GetFrame(n, &env)), "BifrostDupCacheHit", 0, nullptr);
+
+            printf("%-6d %-10d %12.1f %12lld\n", hold, dup_cache, num_frames * hold / seconds(start), static_cast<long long>(hits));
+        }
+    }
+
+    printf("\n420p8 8x8, single thread, three settings of variation and conservative_mask\n");
+    printf("%-28s %12s\n", "filters", "frames/s");
+
+    {
+        PClip src = new SyntheticClip(width, height, 8, 1, 1, num_frames);
+
+        for (int n = 0; n < num_frames; ++n)
+            src->GetFrame(n, &env);
+
+        // Three Bifrost, and one BifrostAnalyse whose frames are kept for three BifrostApply.
+        for (int split = 0; split < 2; ++split)
+        {
+            BifrostAnalyseArgs analyse_args;
+            analyse_args.clip = src;
+            analyse_args.interlaced = false;
+            analyse_args.blockx = analyse_args.blocky = 8;
+            const PClip analysis = new CacheClip(invoke(&env, analyse_args));
+            std::vector<PClip> clips;
+
+            for (int setting = 0; setting < 3; ++setting)
+            {
+                BifrostArgs args;
+                args.clip = src;
+                args.variation = 5 + setting * 5;
+                args.conservative_mask = setting == 2;
+                args.interlaced = false;
+                args.blockx = args.blocky = 8;
+
+                BifrostApplyArgs apply_args;
+                apply_args.clip = src;
+                apply_args.analysis = analysis;
+                apply_args.variation = args.variation;
+                apply_args.conservative_mask = args.conservative_mask;
+                apply_args.interlaced = false;
+                apply_args.blockx = apply_args.blocky = 8;
+
+                clips.push_back((split) ? invoke(&env, apply_args) : invoke(&env, args));
+            }
+
+            const Clock::time_point start = Clock::now();
+            for (int n = 0; n < num_frames; ++n)
+                for (const PClip& clip : clips)
+                    clip->GetFrame(n, &env);
+
+            printf("%-28s %12.1f\n", (split) ? "BifrostAnalyse + 3 Apply" : "3 Bifrost", num_frames / seconds(start));
+        }
+    }
+
+    printf("\n420p8 8x8, single thread, show: Bifrost, and BifrostApply on classes computed beforehand\n");
+    printf("%-8s %12s %12s\n", "show", "frames/s", "apply fps");
+
+    {
+        PClip src = new SyntheticClip(width, height, 8, 1, 1, num_frames);
+
+        for (int n = 0; n < num_frames; ++n)
+            src->GetFrame(n, &env);
+
+        BifrostAnalyseArgs analyse_args;
+        analyse_args.clip = src;
+        analyse_args.interlaced = false;
+        analyse_args.blockx = analyse_args.blocky = 8;
+        const PClip analysis = new CacheClip(invoke(&env, analyse_args));
+
+        for (int n = 0; n < num_frames; ++n)
+            analysis->GetFrame(n, &env);
+
+        for (int show = 0; show < 3; ++show)
+        {
+            BifrostArgs args;
+            args.clip = src;
+            args.interlaced = false;
+            args.blockx = args.blocky = 8;
+            args.show = show;
+            const PClip clip = invoke(&env, args);
+
+            BifrostApplyArgs apply_args;
+            apply_args.clip = src;
+            apply_args.analysis = analysis;
+            apply_args.interlaced = false;
+            apply_args.blockx = apply_args.blocky = 8;
+            apply_args.show = show;
+            const PClip apply = invoke(&env, apply_args);
+
+            Clock::time_point start = Clock::now();
+            for (int n = 0; n < num_frames; ++n)
+                clip->GetFrame(n, &env);
+            const double fps = num_frames / seconds(start);
+
+            start = Clock::now();
+            for (int n = 0; n < num_frames; ++n)
+                apply->GetFrame(n, &env);
+
+            printf("%-8d %12.1f %12.1f\n", show, fps, num_frames / seconds(start));
+        }
+    }
+
+    printf("\n8x8, single thread, luma compared on a decimated plane\n");
+    printf("%-8s %-14s %12s %12s\n", "format", "motion_scale", "frames/s", "lumadiff ms");
+
+    for (const Format& f : formats)
+    {
+        if (f.bits == 32 || f.ssw != 1 || f.ssh != 1)
+            continue;
+
+        PClip src = new SyntheticClip(width, height, f.bits, f.ssw, f.ssh, num_frames);
+
+        for (int n = 0; n < num_frames; ++n)
+            src->GetFrame(n, &env);
+
+        for (int motion_scale : { 1, 2, 4 })
+        {
+            BifrostArgs args;
+            args.clip = src;
+            args.interlaced = false;
+            args.blockx = args.blocky = 8;
+            args.stats = true;
+            args.motion_scale = motion_scale;
+            const PClip clip = invoke(&env, args);
+
+            // The time of the luma comparison per frame, the rest depends on how many blocks are found static.
+            int64_t lumadiff_ns = 0;
+
+            const Clock::time_point start = Clock::now();
+            for (int n = 0; n < num_frames; ++n)
+                lumadiff_ns += env.propGetInt(env.getFramePropsRO(clip->GetFrame(n, &env)), "BifrostLumaDiffTime", 0, nullptr);
+
+            printf("%-8s %-14d %12.1f %12.2f\n", f.name, motion_scale, num_frames / seconds(start), lumadiff_ns / 1e6 / num_frames);
+        }
+    }
+
+    printf("\nper stage, single thread (ns/block)\n");
+    printf("%-8s %-6s %-8s %12s %12s\n", "format", "block", "opt", "lumadiff", "blockrow");
+
+    for (const Format& f : formats)
+    {
+        PClip src = new SyntheticClip(width, height, f.bits, f.ssw, f.ssh, 3);
+        const VideoInfo& vi = src->GetVideoInfo();
+        const PVideoFrame f1 = src->GetFrame(0, &env);
+        const PVideoFrame f2 = src->GetFrame(1, &env);
+        const PVideoFrame f3 = src->GetFrame(2, &env);
+        PVideoFrame dst = env.NewVideoFrame(vi);
+
+        for (auto& bs : block_sizes)
+        {
+            if (bs[0] % (1 << f.ssw) || bs[1] % (1 << f.ssh) || (bs[0] >> f.ssw) < 2 || (bs[1] >> f.ssh) < 2)
+                continue;
+
+            for (const KernelSet& set : kernel_sets)
+            {
+                if (!isSupported(set, cpu_flags))
+                    continue;
+
+                double luma_ns, row_ns;
+
+                if (vi.ComponentSize() == 1)
+                    benchKernels<uint8_t>(set, f1, f2, f3, dst, vi, bs[0], bs[1], luma_ns, row_ns);
+                else if (vi.ComponentSize() == 2)
+                    benchKernels<uint16_t>(set, f1, f2, f3, dst, vi, bs[0], bs[1], luma_ns, row_ns);
+                else
+                    benchKernels<float>(set, f1, f2, f3, dst, vi, bs[0], bs[1], luma_ns, row_ns);
+
+                printf("%-8s %2dx%-3d %-8s %12.2f %12.2f\n", f.name, bs[0], bs[1], set.name, luma_ns, row_ns);
+            }
+        }
+    }
+
+    return 0;
+}
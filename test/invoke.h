@@ -0,0 +1,108 @@
+#pragma once
+
+#include "avisynth.h"
+
+// The parameters of Bifrost, BifrostAnalyse and BifrostApply by name, with the defaults of the filters. The host only takes
+// arguments by position, so every one of them is passed, a null clip or string as an undefined value.
+
+struct BifrostArgs
+{
+    PClip clip;
+    PClip altclip;
+    float luma_thresh = 10.0f;
+    int variation = 5;
+    bool conservative_mask = false;
+    bool interlaced = true;
+    int blockx = 4;
+    int blocky = 4;
+    int opt = -1;
+    int threads = 1;
+    bool stats = false;
+    const char* stats_file = nullptr;
+    const char* analysis_file = nullptr;
+    int superblock = 0;
+    int roi_left = 0;
+    int roi_top = 0;
+    int roi_width = 0;
+    int roi_height = 0;
+    PClip roi_mask;
+    bool scenechange = false;
+    int motion_scale = 1;
+    int dup_cache = 0;
+    int show = 0;
+};
+
+struct BifrostAnalyseArgs
+{
+    PClip clip;
+    float luma_thresh = 10.0f;
+    bool interlaced = true;
+    int blockx = 4;
+    int blocky = 4;
+    int opt = -1;
+    int threads = 1;
+    bool stats = false;
+    const char* analysis_file = nullptr;
+    int superblock = 0;
+    int roi_left = 0;
+    int roi_top = 0;
+    int roi_width = 0;
+    int roi_height = 0;
+    PClip roi_mask;
+    bool scenechange = false;
+    int motion_scale = 1;
+    int dup_cache = 0;
+};
+
+struct BifrostApplyArgs
+{
+    PClip clip;
+    PClip analysis;
+    PClip altclip;
+    int variation = 5;
+    bool conservative_mask = false;
+    bool interlaced = true;
+    int blockx = 4;
+    int blocky = 4;
+    int opt = -1;
+    int threads = 1;
+    bool stats = false;
+    const char* stats_file = nullptr;
+    int dup_cache = 0;
+    int show = 0;
+};
+
+static inline AVSValue optionalArg(const PClip& clip)
+{
+    return (clip) ? AVSValue(clip) : AVSValue();
+}
+
+static inline AVSValue optionalArg(const char* s)
+{
+    return (s) ? AVSValue(s) : AVSValue();
+}
+
+static inline PClip invoke(IScriptEnvironment* env, const BifrostArgs& a)
+{
+    const AVSValue args[23] = { a.clip, optionalArg(a.altclip), a.luma_thresh, a.variation, a.conservative_mask, a.interlaced, a.blockx, a.blocky,
+        a.opt, a.threads, a.stats, optionalArg(a.stats_file), optionalArg(a.analysis_file), a.superblock,
+        a.roi_left, a.roi_top, a.roi_width, a.roi_height, optionalArg(a.roi_mask), a.scenechange, a.motion_scale, a.dup_cache, a.show };
+
+    return env->Invoke("Bifrost", AVSValue(args, 23)).AsClip();
+}
+
+static inline PClip invoke(IScriptEnvironment* env, const BifrostAnalyseArgs& a)
+{
+    const AVSValue args[18] = { a.clip, a.luma_thresh, a.interlaced, a.blockx, a.blocky, a.opt, a.threads, a.stats, optionalArg(a.analysis_file),
+        a.superblock, a.roi_left, a.roi_top, a.roi_width, a.roi_height, optionalArg(a.roi_mask), a.scenechange, a.motion_scale, a.dup_cache };
+
+    return env->Invoke("BifrostAnalyse", AVSValue(args, 18)).AsClip();
+}
+
+static inline PClip invoke(IScriptEnvironment* env, const BifrostApplyArgs& a)
+{
+    const AVSValue args[14] = { a.clip, a.analysis, optionalArg(a.altclip), a.variation, a.conservative_mask, a.interlaced, a.blockx, a.blocky,
+        a.opt, a.threads, a.stats, optionalArg(a.stats_file), a.dup_cache, a.show };
+
+    return env->Invoke("BifrostApply", AVSValue(args, 14)).AsClip();
+}
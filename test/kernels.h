@@ -0,0 +1,65 @@
+#pragma once
+
+#include "avisynth.h"
+#include "bifrost.h"
+
+typedef BlockRowFunction (*BlockRowSelector)(int block_width_uv, int block_height_uv);
+
+// Every instruction set the filter can dispatch to, in the order of the opt parameter.
+struct KernelSet
+{
+    const char* name;
+    int opt;
+    int cpu_flags;
+    LumaDiffRowFunction lumaDiffRow8;
+    LumaDiffRowFunction lumaDiffRow16;
+    BlockRowSelector blockRow8;
+    BlockRowSelector blockRow16;
+    LumaDiffRowFunction lumaDiffRow32;
+    BlockRowSelector blockRow32;
+    DecimateRowFunction decimateRow8[2];  // motion_scale 2 and 4
+    DecimateRowFunction decimateRow16[2];
+    HashPlaneFunction hashPlane;
+};
+
+static const KernelSet kernel_sets[] =
+{
+    { "C", 0, 0, lumaDiffRow_c<uint8_t>, lumaDiffRow_c<uint16_t>, blockRowFunction_c<uint8_t>, blockRowFunction_c<uint16_t>,
+        lumaDiffRow_c<float>, blockRowFunction_c<float>,
+        { decimateRow_c<uint8_t, 2>, decimateRow_c<uint8_t, 4> }, { decimateRow_c<uint16_t, 2>, decimateRow_c<uint16_t, 4> }, hashPlane_c },
+    { "SSE2", 1, CPUF_SSE2, lumaDiffRow_sse2<uint8_t>, lumaDiffRow_sse2<uint16_t>, blockRowFunction_sse2<uint8_t>, blockRowFunction_sse2<uint16_t>,
+        lumaDiffRow_c<float>, blockRowFunction_c<float>,
+        { decimateRow_sse2<uint8_t, 2>, decimateRow_sse2<uint8_t, 4> }, { decimateRow_sse2<uint16_t, 2>, decimateRow_sse2<uint16_t, 4> }, hashPlane_sse2 },
+    { "SSE4.1", 2, CPUF_SSE4_1, lumaDiffRow_sse2<uint8_t>, lumaDiffRow_sse41, blockRowFunction_sse2<uint8_t>, blockRowFunction_sse2<uint16_t>,
+        lumaDiffRow_c<float>, blockRowFunction_c<float>,
+        { decimateRow_sse2<uint8_t, 2>, decimateRow_sse2<uint8_t, 4> }, { decimateRow_sse2<uint16_t, 2>, decimateRow_sse2<uint16_t, 4> }, hashPlane_sse2 },
+    { "AVX2", 3, CPUF_AVX2, lumaDiffRow_avx2<uint8_t>, lumaDiffRow_avx2<uint16_t>, blockRowFunction_avx2<uint8_t>, blockRowFunction_avx2<uint16_t>,
+        lumaDiffRow_avx2<float>, blockRowFunction_avx2<float>,
+        { decimateRow_avx2<uint8_t, 2>, decimateRow_avx2<uint8_t, 4> }, { decimateRow_avx2<uint16_t, 2>, decimateRow_avx2<uint16_t, 4> }, hashPlane_avx2 },
+    { "AVX512", 4, CPUF_AVX512F | CPUF_AVX512BW, lumaDiffRow_avx512<uint8_t>, lumaDiffRow_avx512<uint16_t>, blockRowFunction_avx512<uint8_t>, blockRowFunction_avx512<uint16_t>,
+        lumaDiffRow_avx2<float>, blockRowFunction_avx2<float>,
+        { decimateRow_avx2<uint8_t, 2>, decimateRow_avx2<uint8_t, 4> }, { decimateRow_avx2<uint16_t, 2>, decimateRow_avx2<uint16_t, 4> }, hashPlane_avx2 }
+};
+
+template <typename T>
+static inline LumaDiffRowFunction lumaDiffRowOf(const KernelSet& set)
+{
+    return (sizeof(T) == 1) ? set.lumaDiffRow8 : (sizeof(T) == 2) ? set.lumaDiffRow16 : set.lumaDiffRow32;
+}
+
+template <typename T>
+static inline BlockRowSelector blockRowOf(const KernelSet& set)
+{
+    return (sizeof(T) == 1) ? set.blockRow8 : (sizeof(T) == 2) ? set.blockRow16 : set.blockRow32;
+}
+
+template <typename T>
+static inline DecimateRowFunction decimateRowOf(const KernelSet& set, int scale)
+{
+    return (sizeof(T) == 1) ? set.decimateRow8[scale == 4] : set.decimateRow16[scale == 4];
+}
+
+static inline bool isSupported(const KernelSet& set, int cpu_flags)
+{
+    return (cpu_flags & set.cpu_flags) == set.cpu_flags;
+}
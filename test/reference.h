@@ -0,0 +1,529 @@
+// Frozen scalar port of the original filter, the oracle of testBaseline. The block functions are the ones of the first
+// version of this plugin, unchanged; ReferenceClip replaces only its frames, SeparateFields and Weave.
+// Like the original it supports 8..16-bit clips. Don't optimize or modernize anything here.
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#include "avisynth.h"
+
+namespace baseline
+{
+
+enum BlendDirection
+{
+    bdNext,
+    bdPrev,
+    bdBoth
+};
+
+template <typename T>
+static void applyBlockRainbowMask(const T* srcp_u, const T* srcp_v,
+    const T* srcc_u, const T* srcc_v,
+    const T* srcn_u, const T* srcn_v,
+    T* dst_u, T* dst_v,
+    int block_width_uv, int block_height_uv,
+    int srcp_stride_uv, int srcc_stride_uv, int srcn_stride_uv, int dst_stride_uv,
+    BlendDirection blenddirection, int col)
+{
+    for (int y = 0; y < block_height_uv; ++y)
+    {
+        if (blenddirection == bdNext)
+        {
+            for (int x = 0; x < block_width_uv; ++x)
+            {
+                if (dst_v[x])
+                {
+                    dst_u[x] = (srcc_u[x] + srcn_u[x] + 1) >> 1;
+                    dst_v[x] = (srcc_v[x] + srcn_v[x] + 1) >> 1;
+                }
+                else
+                {
+                    dst_u[x] = srcc_u[x];
+                    dst_v[x] = srcc_v[x];
+                }
+            }
+        }
+        else if (blenddirection == bdPrev)
+        {
+            for (int x = 0; x < block_width_uv; ++x)
+            {
+                if (dst_v[x])
+                {
+                    dst_u[x] = (srcc_u[x] + srcp_u[x] + 1) >> 1;
+                    dst_v[x] = (srcc_v[x] + srcp_v[x] + 1) >> 1;
+                }
+                else
+                {
+                    dst_u[x] = srcc_u[x];
+                    dst_v[x] = srcc_v[x];
+                }
+            }
+        }
+        else if (blenddirection == bdBoth)
+        {
+            for (int x = 0; x < block_width_uv; ++x)
+            {
+                if (dst_v[x])
+                {
+                    dst_u[x] = (2 * srcc_u[x] + srcp_u[x] + srcn_u[x] + 3) >> 2;
+                    dst_v[x] = (2 * srcc_v[x] + srcp_v[x] + srcn_v[x] + 3) >> 2;
+                }
+                else
+                {
+                    dst_u[x] = srcc_u[x];
+                    dst_v[x] = srcc_v[x];
+                }
+            }
+        }
+
+        if (col)
+        {
+            for (int x = block_width_uv; x < block_width_uv + col; ++x)
+            {
+                dst_u[x] = srcc_u[x];
+                dst_v[x] = srcc_v[x];
+            }
+        }
+
+        srcp_u += srcp_stride_uv;
+        srcp_v += srcp_stride_uv;
+
+        srcc_u += srcc_stride_uv;
+        srcc_v += srcc_stride_uv;
+
+        srcn_u += srcn_stride_uv;
+        srcn_v += srcn_stride_uv;
+
+        dst_u += dst_stride_uv;
+        dst_v += dst_stride_uv;
+    }
+}
+
+template <typename T>
+static void processBlockRainbowMask(T* dst_u, T* dst_v, int block_width_uv, int block_height_uv, int dst_stride_uv, bool conservative_mask)
+{
+    T* tmp = dst_v;
+
+    //denoise mask, remove marked pixels with no horizontal marked neighbors
+    for (int y = 0; y < block_height_uv; ++y)
+    {
+        dst_v[0] = dst_u[0] && dst_u[1];
+
+        for (int x = 1; x < block_width_uv - 1; ++x)
+            dst_v[x] = dst_u[x] && (dst_u[x - 1] || dst_u[x + 1]);
+
+        dst_v[block_width_uv - 1] = dst_u[block_width_uv - 1] && dst_u[block_width_uv - 2];
+
+        dst_u += dst_stride_uv;
+        dst_v += dst_stride_uv;
+    }
+
+    //expand mask vertically
+    if (!conservative_mask)
+    {
+        dst_v = tmp;
+
+        for (int x = 0; x < block_width_uv; ++x)
+            dst_v[x] = dst_v[x] || dst_v[x + dst_stride_uv];
+
+        dst_v += dst_stride_uv;
+
+        for (int y = 1; y < block_height_uv - 1; ++y)
+        {
+            for (int x = 0; x < block_width_uv; ++x)
+                dst_v[x] = dst_v[x] || (dst_v[x + dst_stride_uv] && dst_v[x - dst_stride_uv]);
+
+            dst_v += dst_stride_uv;
+        }
+
+        for (int x = 0; x < block_width_uv; ++x)
+            dst_v[x] = dst_v[x] || dst_v[x - dst_stride_uv];
+    }
+}
+
+template <typename T>
+static void makeBlockRainbowMask(const T* srcp_u, const T* srcp_v,
+    const T* srcc_u, const T* srcc_v,
+    const T* srcn_u, const T* srcn_v,
+    T* dst_u, T* dst_v,
+    int block_width_uv, int block_height_uv,
+    int srcp_stride_uv, int srcc_stride_uv, int srcn_stride_uv, int dst_stride_uv,
+    int variation)
+{
+    for (int y = 0; y < block_height_uv; ++y)
+    {
+        for (int x = 0; x < block_width_uv; ++x)
+        {
+            int up = srcp_u[x];
+            int uc = srcc_u[x];
+            int un = srcn_u[x];
+
+            int vp = srcp_v[x];
+            int vc = srcc_v[x];
+            int vn = srcn_v[x];
+
+            int ucup = uc - up;
+            int ucun = uc - un;
+
+            int vcvp = vc - vp;
+            int vcvn = vc - vn;
+
+            dst_u[x] = (((ucup + variation) & (ucun + variation)) < 0)
+                || (((-ucup + variation) & (-ucun + variation)) < 0)
+                || (((vcvp + variation) & (vcvn + variation)) < 0)
+                || (((-vcvp + variation) & (-vcvn + variation)) < 0);
+        }
+
+        srcp_u += srcp_stride_uv;
+        srcp_v += srcp_stride_uv;
+
+        srcc_u += srcc_stride_uv;
+        srcc_v += srcc_stride_uv;
+
+        srcn_u += srcn_stride_uv;
+        srcn_v += srcn_stride_uv;
+
+        dst_u += dst_stride_uv;
+        dst_v += dst_stride_uv;
+    }
+}
+
+template <typename T>
+static void copyChromaBlock(T* dst_u, T* dst_v,
+    const T* src_u, const T* src_v,
+    int block_width_uv, int block_height_uv,
+    int dst_stride_uv, int src_stride_uv, int col)
+{
+    for (int y = 0; y < block_height_uv; ++y)
+    {
+        memcpy(dst_u, src_u, (block_width_uv + static_cast<int64_t>(col)) * sizeof(T));
+        memcpy(dst_v, src_v, (block_width_uv + static_cast<int64_t>(col)) * sizeof(T));
+
+        dst_u += dst_stride_uv;
+        dst_v += dst_stride_uv;
+        src_u += src_stride_uv;
+        src_v += src_stride_uv;
+    }
+}
+
+template <typename T>
+static float blockLumaDiff(const T* src1_y, const T* src2_y, int block_width, int block_height, int src1_stride_y, int src2_stride_y)
+{
+    int diff = 0;
+
+    for (int y = 0; y < block_height; ++y)
+    {
+        for (int x = 0; x < block_width; ++x)
+        {
+            diff += abs(src1_y[x] - src2_y[x]);
+        }
+
+        src1_y += src1_stride_y;
+        src2_y += src2_stride_y;
+    }
+
+    return static_cast<float>(diff) / (block_width * block_height);
+}
+
+// One frame, or one field of a frame as SeparateFields gives it: the planes start at the first line of the field
+// and the pitches skip the lines of the other field.
+struct Picture
+{
+    uint8_t* ptr[3];
+    int pitch[3];
+    int width;
+    int height;
+};
+
+} // namespace baseline
+
+// The original Bifrost: Bifrost(child, altclip) on SeparateFields of both clips followed by Weave when interlaced,
+// with the fields taken from the frames of child directly.
+class ReferenceClip : public IClip
+{
+    PClip child;
+    PClip child2;
+    VideoInfo vi;
+    int fields;
+    float luma_thresh;
+    int variation;
+    bool conservative_mask;
+    int block_width, block_height, block_width_uv, block_height_uv;
+
+    baseline::Picture picture(const PVideoFrame& frame, int unit)
+    {
+        const int planes[3] = { PLANAR_Y, PLANAR_U, PLANAR_V };
+        const bool bottom = fields == 2 && (unit & 1) == child->GetParity(unit / fields);
+        baseline::Picture p;
+
+        for (int i = 0; i < 3; ++i)
+        {
+            p.ptr[i] = const_cast<uint8_t*>(frame->GetReadPtr(planes[i])) + ((bottom) ? frame->GetPitch(planes[i]) : 0);
+            p.pitch[i] = frame->GetPitch(planes[i]) * fields;
+        }
+
+        p.width = vi.width;
+        p.height = vi.height / fields;
+
+        return p;
+    }
+
+    // Bifrost::Framedepth of the original with its frames replaced by pictures.
+    template <typename T>
+    void Framedepth(const baseline::Picture& dst, const baseline::Picture& altsrcc, const baseline::Picture& srcnn, const baseline::Picture& srcn,
+        const baseline::Picture& srcc, const baseline::Picture& srcp, const baseline::Picture& srcpp)
+    {
+        const float relativeframediff = 1.2f;
+        const int blocks_x = srcc.width / block_width;
+        const int blocks_y = srcc.height / block_height;
+
+        const T* srcpp_y = reinterpret_cast<const T*>(srcpp.ptr[0]);
+        const T* srcpp_u = reinterpret_cast<const T*>(srcpp.ptr[1]);
+        const T* srcpp_v = reinterpret_cast<const T*>(srcpp.ptr[2]);
+
+        const T* srcp_y = reinterpret_cast<const T*>(srcp.ptr[0]);
+        const T* srcp_u = reinterpret_cast<const T*>(srcp.ptr[1]);
+        const T* srcp_v = reinterpret_cast<const T*>(srcp.ptr[2]);
+
+        const T* srcc_y = reinterpret_cast<const T*>(srcc.ptr[0]);
+        const T* srcc_u = reinterpret_cast<const T*>(srcc.ptr[1]);
+        const T* srcc_v = reinterpret_cast<const T*>(srcc.ptr[2]);
+
+        const T* srcn_y = reinterpret_cast<const T*>(srcn.ptr[0]);
+        const T* srcn_u = reinterpret_cast<const T*>(srcn.ptr[1]);
+        const T* srcn_v = reinterpret_cast<const T*>(srcn.ptr[2]);
+
+        const T* srcnn_y = reinterpret_cast<const T*>(srcnn.ptr[0]);
+        const T* srcnn_u = reinterpret_cast<const T*>(srcnn.ptr[1]);
+        const T* srcnn_v = reinterpret_cast<const T*>(srcnn.ptr[2]);
+
+        const T* altsrcc_u = reinterpret_cast<const T*>(altsrcc.ptr[1]);
+        const T* altsrcc_v = reinterpret_cast<const T*>(altsrcc.ptr[2]);
+
+        T* dst_u = reinterpret_cast<T*>(dst.ptr[1]);
+        T* dst_v = reinterpret_cast<T*>(dst.ptr[2]);
+
+        const int srcpp_pitch_y = srcpp.pitch[0] / sizeof(T);
+        const int srcpp_pitch_uv = srcpp.pitch[1] / sizeof(T);
+
+        const int srcp_pitch_y = srcp.pitch[0] / sizeof(T);
+        const int srcp_pitch_uv = srcp.pitch[1] / sizeof(T);
+
+        const int srcc_pitch_y = srcc.pitch[0] / sizeof(T);
+        const int srcc_pitch_uv = srcc.pitch[1] / sizeof(T);
+
+        const int srcn_pitch_y = srcn.pitch[0] / sizeof(T);
+        const int srcn_pitch_uv = srcn.pitch[1] / sizeof(T);
+
+        const int srcnn_pitch_y = srcnn.pitch[0] / sizeof(T);
+        const int srcnn_pitch_uv = srcnn.pitch[1] / sizeof(T);
+
+        //the original took the pitch of srcc, which is the one of altsrcc for frames of the same format
+        const int altsrcc_pitch_uv = altsrcc.pitch[1] / sizeof(T);
+
+        const int dst_pitch_uv = dst.pitch[1] / sizeof(T);
+
+        const int rowsize_y = srcc.width;
+        const int height_y = srcc.height;
+
+        for (int y = 0; y < height_y; ++y)
+            memcpy(dst.ptr[0] + static_cast<int64_t>(y) * dst.pitch[0], srcc.ptr[0] + static_cast<int64_t>(y) * srcc.pitch[0], rowsize_y * sizeof(T));
+
+        const int col = (rowsize_y - rowsize_y / block_width * block_width) >> vi.GetPlaneWidthSubsampling(PLANAR_U);
+
+        for (int y = 0; y < blocks_y; ++y)
+        {
+            for (int x = 0; x < blocks_x; ++x)
+            {
+                float ldprev = baseline::blockLumaDiff<T>(srcp_y + block_width * static_cast<int64_t>(x), srcc_y + block_width * static_cast<int64_t>(x), block_width, block_height, srcp_pitch_y, srcc_pitch_y);
+                float ldnext = baseline::blockLumaDiff<T>(srcc_y + block_width * static_cast<int64_t>(x), srcn_y + block_width * static_cast<int64_t>(x), block_width, block_height, srcc_pitch_y, srcn_pitch_y);
+                float ldprevprev = 0.0f;
+                float ldnextnext = 0.0f;
+
+                //too much movement in both directions?
+                if (ldnext > luma_thresh && ldprev > luma_thresh)
+                {
+                    baseline::copyChromaBlock<T>(dst_u + block_width_uv * static_cast<int64_t>(x), dst_v + block_width_uv * static_cast<int64_t>(x),
+                        altsrcc_u + block_width_uv * static_cast<int64_t>(x), altsrcc_v + block_width_uv * static_cast<int64_t>(x),
+                        block_width_uv, block_height_uv, dst_pitch_uv, altsrcc_pitch_uv, (x == blocks_x - 1) ? col : 0);
+                    continue;
+                }
+
+                if (ldnext > luma_thresh)
+                {
+                    ldprevprev = baseline::blockLumaDiff<T>(srcpp_y + block_width * static_cast<int64_t>(x), srcp_y + block_width * static_cast<int64_t>(x), block_width, block_height, srcpp_pitch_y, srcp_pitch_y);
+                }
+                else if (ldprev > luma_thresh)
+                {
+                    ldnextnext = baseline::blockLumaDiff<T>(srcn_y + block_width * static_cast<int64_t>(x), srcnn_y + block_width * static_cast<int64_t>(x), block_width, block_height, srcn_pitch_y, srcnn_pitch_y);
+                }
+
+                //two consecutive frames in one direction to generate mask?
+                if ((ldnext > luma_thresh && ldprevprev > luma_thresh) ||
+                    (ldprev > luma_thresh && ldnextnext > luma_thresh))
+                {
+                    baseline::copyChromaBlock<T>(dst_u + block_width_uv * static_cast<int64_t>(x), dst_v + block_width_uv * static_cast<int64_t>(x),
+                        altsrcc_u + block_width_uv * static_cast<int64_t>(x), altsrcc_v + block_width_uv * static_cast<int64_t>(x),
+                        block_width_uv, block_height_uv, dst_pitch_uv, altsrcc_pitch_uv, (x == blocks_x - 1) ? col : 0);
+                    continue;
+                }
+
+                //generate mask from correct side of scenechange
+                if (ldnext > luma_thresh)
+                {
+                    baseline::makeBlockRainbowMask<T>(srcpp_u + block_width_uv * static_cast<int64_t>(x), srcpp_v + block_width_uv * static_cast<int64_t>(x),
+                        srcp_u + block_width_uv * static_cast<int64_t>(x), srcp_v + block_width_uv * static_cast<int64_t>(x),
+                        srcc_u + block_width_uv * static_cast<int64_t>(x), srcc_v + block_width_uv * static_cast<int64_t>(x),
+                        dst_u + block_width_uv * static_cast<int64_t>(x), dst_v + block_width_uv * static_cast<int64_t>(x),
+                        block_width_uv, block_height_uv,
+                        srcpp_pitch_uv, srcp_pitch_uv, srcc_pitch_uv, dst_pitch_uv,
+                        variation);
+                }
+                else if (ldprev > luma_thresh)
+                {
+                    baseline::makeBlockRainbowMask<T>(srcc_u + block_width_uv * static_cast<int64_t>(x), srcc_v + block_width_uv * static_cast<int64_t>(x),
+                        srcn_u + block_width_uv * static_cast<int64_t>(x), srcn_v + block_width_uv * static_cast<int64_t>(x),
+                        srcnn_u + block_width_uv * static_cast<int64_t>(x), srcnn_v + block_width_uv * static_cast<int64_t>(x),
+                        dst_u + block_width_uv * static_cast<int64_t>(x), dst_v + block_width_uv * static_cast<int64_t>(x),
+                        block_width_uv, block_height_uv,
+                        srcc_pitch_uv, srcn_pitch_uv, srcnn_pitch_uv, dst_pitch_uv,
+                        variation);
+                }
+                else
+                {
+                    baseline::makeBlockRainbowMask<T>(srcp_u + block_width_uv * static_cast<int64_t>(x), srcp_v + block_width_uv * static_cast<int64_t>(x),
+                        srcc_u + block_width_uv * static_cast<int64_t>(x), srcc_v + block_width_uv * static_cast<int64_t>(x),
+                        srcn_u + block_width_uv * static_cast<int64_t>(x), srcn_v + block_width_uv * static_cast<int64_t>(x),
+                        dst_u + block_width_uv * static_cast<int64_t>(x), dst_v + block_width_uv * static_cast<int64_t>(x),
+                        block_width_uv, block_height_uv,
+                        srcp_pitch_uv, srcc_pitch_uv, srcn_pitch_uv, dst_pitch_uv,
+                        variation);
+                }
+
+                //denoise and expand mask
+                baseline::processBlockRainbowMask<T>(dst_u + block_width_uv * static_cast<int64_t>(x), dst_v + block_width_uv * static_cast<int64_t>(x),
+                    block_width_uv, block_height_uv, dst_pitch_uv, conservative_mask);
+
+                //determine direction to blend in
+                baseline::BlendDirection direction;
+                if (ldprev > ldnext * relativeframediff)
+                    direction = baseline::bdNext;
+                else if (ldnext > ldprev * relativeframediff)
+                    direction = baseline::bdPrev;
+                else
+                    direction = baseline::bdBoth;
+
+                baseline::applyBlockRainbowMask<T>(srcp_u + block_width_uv * static_cast<int64_t>(x), srcp_v + block_width_uv * static_cast<int64_t>(x),
+                    srcc_u + block_width_uv * static_cast<int64_t>(x), srcc_v + block_width_uv * static_cast<int64_t>(x),
+                    srcn_u + block_width_uv * static_cast<int64_t>(x), srcn_v + block_width_uv * static_cast<int64_t>(x),
+                    dst_u + block_width_uv * static_cast<int64_t>(x), dst_v + block_width_uv * static_cast<int64_t>(x),
+                    block_width_uv, block_height_uv,
+                    srcp_pitch_uv, srcc_pitch_uv, srcn_pitch_uv, dst_pitch_uv,
+                    direction, (x == blocks_x - 1) ? col : 0);
+            }
+
+            srcpp_y += block_height * static_cast<int64_t>(srcpp_pitch_y);
+            srcpp_u += block_height_uv * static_cast<int64_t>(srcpp_pitch_uv);
+            srcpp_v += block_height_uv * static_cast<int64_t>(srcpp_pitch_uv);
+
+            srcp_y += block_height * static_cast<int64_t>(srcp_pitch_y);
+            srcp_u += block_height_uv * static_cast<int64_t>(srcp_pitch_uv);
+            srcp_v += block_height_uv * static_cast<int64_t>(srcp_pitch_uv);
+
+            srcc_y += block_height * static_cast<int64_t>(srcc_pitch_y);
+            srcc_u += block_height_uv * static_cast<int64_t>(srcc_pitch_uv);
+            srcc_v += block_height_uv * static_cast<int64_t>(srcc_pitch_uv);
+
+            srcn_y += block_height * static_cast<int64_t>(srcn_pitch_y);
+            srcn_u += block_height_uv * static_cast<int64_t>(srcn_pitch_uv);
+            srcn_v += block_height_uv * static_cast<int64_t>(srcn_pitch_uv);
+
+            srcnn_y += block_height * static_cast<int64_t>(srcnn_pitch_y);
+            srcnn_u += block_height_uv * static_cast<int64_t>(srcnn_pitch_uv);
+            srcnn_v += block_height_uv * static_cast<int64_t>(srcnn_pitch_uv);
+
+            altsrcc_u += block_height_uv * static_cast<int64_t>(altsrcc_pitch_uv);
+            altsrcc_v += block_height_uv * static_cast<int64_t>(altsrcc_pitch_uv);
+
+            dst_u += block_height_uv * static_cast<int64_t>(dst_pitch_uv);
+            dst_v += block_height_uv * static_cast<int64_t>(dst_pitch_uv);
+        }
+
+        const int row = height_y / block_height * block_height;
+        if (row != height_y)
+        {
+            const int width_uv = (rowsize_y >> vi.GetPlaneWidthSubsampling(PLANAR_U)) * sizeof(T);
+            const int height_uv = height_y >> vi.GetPlaneHeightSubsampling(PLANAR_U);
+            const int h = row >> vi.GetPlaneHeightSubsampling(PLANAR_U);
+
+            for (int y = h; y < height_uv; ++y)
+            {
+                memcpy(dst_u, srcc_u, width_uv);
+                memcpy(dst_v, srcc_v, width_uv);
+
+                srcc_u += srcc_pitch_uv;
+                srcc_v += srcc_pitch_uv;
+                dst_u += dst_pitch_uv;
+                dst_v += dst_pitch_uv;
+            }
+        }
+    }
+
+public:
+    // altclip is null when not given.
+    ReferenceClip(PClip _child, PClip altclip, float _luma_thresh, int _variation, bool _conservative_mask, bool interlaced, int blockx, int blocky)
+        : child(_child), child2((altclip) ? altclip : _child), vi(_child->GetVideoInfo()), fields((interlaced) ? 2 : 1), luma_thresh(_luma_thresh), variation(_variation),
+        conservative_mask(_conservative_mask), block_width(blockx), block_height(blocky)
+    {
+        if (vi.ComponentSize() == 2)
+        {
+            const int peak = (1 << vi.BitsPerComponent()) - 1;
+            luma_thresh *= peak / 255;
+            variation *= peak / 255;
+        }
+
+        block_width_uv = block_width >> vi.GetPlaneWidthSubsampling(PLANAR_U);
+        block_height_uv = block_height >> vi.GetPlaneHeightSubsampling(PLANAR_U);
+    }
+
+    PVideoFrame __stdcall GetFrame(int n, IScriptEnvironment* env) override
+    {
+        //with offset 2 on the separated fields, the neighbours of a field are the same field of the neighbouring frames
+        const int units = vi.num_frames * fields;
+        const PVideoFrame altframe = child2->GetFrame(n, env);
+        PVideoFrame dst = env->NewVideoFrame(vi);
+
+        for (int field = 0; field < fields; ++field)
+        {
+            const int u = n * fields + field;
+            const int unit[5] = { std::max(u - fields * 2, 0), std::max(u - fields, 0), u, std::min(u + fields, units - 1), std::min(u + fields * 2, units - 1) };
+
+            PVideoFrame frames[5];
+            baseline::Picture src[5];
+            for (int i = 0; i < 5; ++i)
+            {
+                frames[i] = child->GetFrame(unit[i] / fields, env);
+                src[i] = picture(frames[i], unit[i]);
+            }
+
+            const baseline::Picture alt = picture(altframe, u);
+            const baseline::Picture out = picture(dst, u);
+
+            if (vi.ComponentSize() == 2)
+                Framedepth<uint16_t>(out, alt, src[4], src[3], src[2], src[1], src[0]);
+            else
+                Framedepth<uint8_t>(out, alt, src[4], src[3], src[2], src[1], src[0]);
+        }
+
+        return dst;
+    }
+
+    bool __stdcall GetParity(int n) override { return child->GetParity(n); }
+    const VideoInfo& __stdcall GetVideoInfo() override { return vi; }
+    int __stdcall SetCacheHints(int cachehints, int frame_range) override { return 0; }
+};
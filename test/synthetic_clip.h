@@ -0,0 +1,198 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <type_traits>
+#include <vector>
+
+#include "avisynth.h"
+
+static inline uint32_t hash32(uint32_t x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352d;
+    x ^= x >> 15;
+    x *= 0x846ca68b;
+    x ^= x >> 16;
+
+    return x;
+}
+
+// Generated YUV clip with the content Bifrost reacts to:
+// - a static luma texture whose chroma carries a fine pattern that flips sign every frame (rainbows),
+// - a box moving across the picture with noisy luma and chroma (blocks that must fall back to altclip),
+// - a scene change every scene_length frames (blocks whose mask comes from one side only).
+// Frames are generated on first request and kept, so timing loops measure only the filter.
+// Float clips have the same content, with luma in 0..1 and chroma in -0.5..0.5.
+class SyntheticClip : public IClip
+{
+    VideoInfo vi;
+    int scene_length;
+    bool tff;
+    std::vector<PVideoFrame> frames;
+    std::mutex mtx;
+
+    template <typename T>
+    void fill(PVideoFrame& frame, int n)
+    {
+        const int shift = (vi.ComponentSize() == 4) ? 0 : vi.BitsPerComponent() - 8;
+        const int scene = n / scene_length;
+        const int box_w = vi.width / 4;
+        const int box_h = vi.height / 4;
+        const int box_x = (n * 8) % std::max(vi.width - box_w, 1);
+        const int box_y = vi.height / 3;
+
+        const int planes[3] = { PLANAR_Y, PLANAR_U, PLANAR_V };
+
+        for (int p = 0; p < 3; ++p)
+        {
+            T* dstp = reinterpret_cast<T*>(frame->GetWritePtr(planes[p]));
+            const int pitch = frame->GetPitch(planes[p]) / sizeof(T);
+            const int width = frame->GetRowSize(planes[p]) / sizeof(T);
+            const int height = frame->GetHeight(planes[p]);
+            const int ssw = vi.GetPlaneWidthSubsampling(planes[p]);
+            const int ssh = vi.GetPlaneHeightSubsampling(planes[p]);
+
+            for (int y = 0; y < height; ++y)
+            {
+                for (int x = 0; x < width; ++x)
+                {
+                    const int lx = x << ssw;
+                    const int ly = y << ssh;
+                    const bool in_box = lx >= box_x && lx < box_x + box_w && ly >= box_y && ly < box_y + box_h;
+                    int v;
+
+                    if (in_box)
+                        v = hash32(lx * 7 + ly * 131 + n * 100003 + p * 17) & 255;
+                    else if (p == 0)
+                        v = ((lx * 3 + ly * 5) ^ (scene * 77)) & 255;
+                    else
+                    {
+                        v = 128 + ((lx + ly + p * 40 + scene * 50) & 63) - 32;
+
+                        //patches of chroma that alternate between two values from frame to frame
+                        if (hash32((lx >> 4) * 977 + (ly >> 4) + scene * 31) % 3 != 0)
+                            v += ((((x + y) & 1) ^ (n & 1)) ? 1 : -1) * (6 + static_cast<int>(hash32(x * 5 + y * 3 + p) % 12));
+                    }
+
+                    v = std::min(std::max(v, 0), 255);
+
+                    if constexpr (std::is_same<T, float>::value)
+                        dstp[x] = (v - ((p == 0) ? 0 : 128)) / 255.0f + (hash32(x + y * 65537 + n * 31 + p) & 255) / (255.0f * 256.0f);
+                    else
+                    {
+                        v <<= shift;
+                        if (shift)
+                            v |= hash32(x + y * 65537 + n * 31 + p) & ((1 << shift) - 1);
+
+                        dstp[x] = static_cast<T>(v);
+                    }
+                }
+
+                dstp += pitch;
+            }
+        }
+    }
+
+public:
+    SyntheticClip(int width, int height, int bits, int subsampling_w, int subsampling_h, int num_frames, int _scene_length = 24, bool _tff = true)
+        : scene_length(_scene_length), tff(_tff)
+    {
+        vi.width = width;
+        vi.height = height;
+        vi.num_frames = num_frames;
+        vi.bits_per_component = bits;
+        vi.subsampling_w = subsampling_w;
+        vi.subsampling_h = subsampling_h;
+        vi.image_type = (tff) ? VideoInfo::IT_TFF : VideoInfo::IT_BFF;
+
+        frames.resize(num_frames);
+    }
+
+    PVideoFrame __stdcall GetFrame(int n, IScriptEnvironment* env) override
+    {
+        n = std::min(std::max(n, 0), vi.num_frames - 1);
+
+        std::lock_guard<std::mutex> lock(mtx);
+
+        if (!frames[n])
+        {
+            frames[n] = env->NewVideoFrame(vi);
+
+            if (vi.ComponentSize() == 1)
+                fill<uint8_t>(frames[n], n);
+            else if (vi.ComponentSize() == 2)
+                fill<uint16_t>(frames[n], n);
+            else
+                fill<float>(frames[n], n);
+        }
+
+        return frames[n];
+    }
+
+    bool __stdcall GetParity(int n) override { return tff; }
+    const VideoInfo& __stdcall GetVideoInfo() override { return vi; }
+    int __stdcall SetCacheHints(int cachehints, int frame_range) override { return 0; }
+};
+
+// Plays the frames of a clip in the given order, for duplicates like those of limited animation.
+class SequenceClip : public IClip
+{
+    PClip child;
+    std::vector<int> sequence;
+    VideoInfo vi;
+
+public:
+    SequenceClip(PClip _child, const std::vector<int>& _sequence) : child(_child), sequence(_sequence), vi(_child->GetVideoInfo())
+    {
+        vi.num_frames = static_cast<int>(sequence.size());
+    }
+
+    // Every frame held for hold frames, starting over after cycle of them.
+    static std::vector<int> hold(int hold, int cycle, int num_frames)
+    {
+        std::vector<int> sequence(num_frames);
+        for (int n = 0; n < num_frames; ++n)
+            sequence[n] = n / hold % cycle;
+
+        return sequence;
+    }
+
+    PVideoFrame __stdcall GetFrame(int n, IScriptEnvironment* env) override { return child->GetFrame(sequence[n], env); }
+    bool __stdcall GetParity(int n) override { return child->GetParity(sequence[n]); }
+    const VideoInfo& __stdcall GetVideoInfo() override { return vi; }
+    int __stdcall SetCacheHints(int cachehints, int frame_range) override { return 0; }
+};
+
+// Keeps every frame and counts the ones it requests from its child, like the cache AviSynth puts after a filter.
+class CacheClip : public IClip
+{
+    PClip child;
+    std::map<int, PVideoFrame> frames;
+    std::mutex mtx;
+
+public:
+    int requests = 0;
+
+    CacheClip(PClip _child) : child(_child) {}
+
+    PVideoFrame __stdcall GetFrame(int n, IScriptEnvironment* env) override
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+
+        PVideoFrame& frame = frames[n];
+        if (!frame)
+        {
+            frame = child->GetFrame(n, env);
+            ++requests;
+        }
+
+        return frame;
+    }
+
+    bool __stdcall GetParity(int n) override { return child->GetParity(n); }
+    const VideoInfo& __stdcall GetVideoInfo() override { return child->GetVideoInfo(); }
+    int __stdcall SetCacheHints(int cachehints, int frame_range) override { return 0; }
+};
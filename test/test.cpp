@@ -0,0 +1,1313 @@
+// Differential tests: every kernel against the generic scalar one on random input,
+// and the whole filter at every opt level and thread count against opt=0.
+
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "avisynth.h"
+#include "bifrost.h"
+#include "invoke.h"
+#include "kernels.h"
+#include "reference.h"
+#include "synthetic_clip.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "y4m.h"
+#endif
+
+static int failures = 0;
+
+static void fail(const char* fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    vprintf(fmt, args);
+    va_end(args);
+    printf("\n");
+
+    ++failures;
+}
+
+// Independent of lumaDiffRow_c: the average absolute difference of every block.
+template <typename T>
+static void lumaDiffReference(const T* src1, const T* src2, int stride1, int stride2, int block_width, int block_height, int blocks_x, float* diff)
+{
+    for (int b = 0; b < blocks_x; ++b)
+    {
+        int64_t sum = 0;
+
+        for (int y = 0; y < block_height; ++y)
+            for (int x = b * block_width; x < (b + 1) * block_width; ++x)
+                sum += std::abs(src1[y * stride1 + x] - src2[y * stride2 + x]);
+
+        diff[b] = static_cast<float>(sum) / (block_width * block_height);
+    }
+}
+
+// Random values are generated as integers, for float they are scaled to 0..1.
+template <typename T>
+static T sample(int v, int peak)
+{
+    if constexpr (std::is_same<T, float>::value)
+        return v / static_cast<float>(peak);
+    else
+        return static_cast<T>(v);
+}
+
+template <typename T>
+static void fuzzLumaDiff(std::mt19937& rng, const KernelSet& set, int bits)
+{
+    const int peak = (bits == 32) ? 65535 : (1 << bits) - 1;
+
+    std::uniform_int_distribution<int> small(1, 40);
+    const int block_width = small(rng);
+    const int block_height = (rng() % 16 == 0) ? 250 + rng() % 60 : small(rng);
+    const int blocks_x = small(rng);
+    const int width = block_width * blocks_x;
+    const int stride1 = width + rng() % 40;
+    const int stride2 = width + rng() % 40;
+
+    std::vector<T> src1(static_cast<size_t>(stride1) * block_height);
+    std::vector<T> src2(static_cast<size_t>(stride2) * block_height);
+
+    // Mostly close values with occasional extremes.
+    for (size_t i = 0; i < src1.size(); ++i)
+        src1[i] = sample<T>((rng() % 8 == 0) ? ((rng() & 1) ? peak : 0) : rng() % (peak + 1), peak);
+    for (size_t i = 0; i < src2.size(); ++i)
+        src2[i] = (i < src1.size() && rng() % 2) ? src1[i] : sample<T>((rng() % 8 == 0) ? ((rng() & 1) ? peak : 0) : rng() % (peak + 1), peak);
+
+    std::vector<float> expected(blocks_x), actual(blocks_x, -1.0f);
+    // Float sums depend on the order, which the C version defines.
+    if constexpr (std::is_same<T, float>::value)
+        lumaDiffRow_c<float>(src1.data(), src2.data(), stride1, stride2, block_width, block_height, blocks_x, expected.data());
+    else
+        lumaDiffReference<T>(src1.data(), src2.data(), stride1, stride2, block_width, block_height, blocks_x, expected.data());
+    lumaDiffRowOf<T>(set)(src1.data(), src2.data(), stride1, stride2, block_width, block_height, blocks_x, actual.data());
+
+    for (int b = 0; b < blocks_x; ++b)
+    {
+        if (expected[b] != actual[b])
+        {
+            fail("lumaDiffRow %s %d-bit: block %dx%d, blocks_x %d, block %d: expected %f, got %f", set.name, bits, block_width, block_height, blocks_x, b, expected[b], actual[b]);
+            return;
+        }
+    }
+}
+
+template <typename T>
+static void fuzzDecimate(std::mt19937& rng, const KernelSet& set, int bits)
+{
+    const int peak = (1 << bits) - 1;
+    const int scale = (rng() & 1) ? 4 : 2;
+    const int width = 1 + rng() % 80;
+    const int stride = width * scale + rng() % 40;
+
+    std::vector<T> src(static_cast<size_t>(stride) * scale);
+    for (size_t i = 0; i < src.size(); ++i)
+        src[i] = static_cast<T>((rng() % 8 == 0) ? ((rng() & 1) ? peak : 0) : rng() % (peak + 1));
+
+    std::vector<T> actual(width + 1, 0x5A);
+    decimateRowOf<T>(set, scale)(src.data(), stride, actual.data(), width);
+
+    for (int x = 0; x <= width; ++x)
+    {
+        int sum = 0;
+        for (int y = 0; y < scale; ++y)
+            for (int i = 0; i < scale; ++i)
+                sum += (x < width) ? src[y * stride + x * scale + i] : 0;
+
+        const int expected = (x < width) ? (sum + scale * scale / 2) / (scale * scale) : 0x5A;
+        if (actual[x] != expected)
+        {
+            fail("decimateRow %s %d-bit: scale %d, width %d, pixel %d: expected %d, got %d", set.name, bits, scale, width, x, expected, actual[x]);
+            return;
+        }
+    }
+}
+
+// Every kernel set must give the hash of the C version, which must change with any byte of the plane.
+static void fuzzHash(std::mt19937& rng, const KernelSet& set)
+{
+    const int row_size = 1 + rng() % 300;
+    const int height = 1 + rng() % 8;
+    const int pitch = row_size + rng() % 40;
+
+    std::vector<uint8_t> src(static_cast<size_t>(pitch) * height);
+    for (uint8_t& v : src)
+        v = static_cast<uint8_t>((rng() % 4) ? rng() : 0);
+
+    const uint64_t expected = hashPlane_c(src.data(), pitch, row_size, height);
+    const uint64_t actual = set.hashPlane(src.data(), pitch, row_size, height);
+    if (expected != actual)
+    {
+        fail("hashPlane %s: %dx%d, pitch %d: expected %016llx, got %016llx", set.name, row_size, height, pitch,
+            static_cast<unsigned long long>(expected), static_cast<unsigned long long>(actual));
+        return;
+    }
+
+    //one bit of a pixel, or the pixels outside the rows
+    const int y = rng() % height;
+    const int x = rng() % pitch;
+    src[static_cast<size_t>(y) * pitch + x] ^= 1 << (rng() % 8);
+
+    if ((set.hashPlane(src.data(), pitch, row_size, height) == expected) != (x >= row_size))
+        fail("hashPlane %s: %dx%d, pitch %d: changing pixel %d of row %d %s the hash", set.name, row_size, height, pitch, x, y,
+            (x >= row_size) ? "changed" : "didn't change");
+}
+
+template <typename T>
+static void fuzzBlockRow(std::mt19937& rng, const KernelSet& set, int bits)
+{
+    const int peak = (bits == 32) ? 65535 : (1 << bits) - 1;
+
+    BlockRow r;
+    // Half of the cases use the sizes with their own instantiations.
+    const int sizes[][2] = { { 2, 2 }, { 2, 4 }, { 4, 4 }, { 4, 8 }, { 8, 8 }, { 8, 16 }, { 16, 16 } };
+    const int size = rng() % 14;
+    r.block_width_uv = (size < 7) ? sizes[size][0] : 2 + rng() % 19;
+    r.block_height_uv = (size < 7) ? sizes[size][1] : 2 + rng() % 9;
+    r.blocks_x = 1 + rng() % 24;
+    r.col = rng() % r.block_width_uv;
+    r.variation = (rng() % 4 == 0) ? rng() % (peak + 1) : rng() % (peak / 16 + 1);
+    r.variation_f = r.variation / static_cast<float>(peak);
+    r.conservative_mask = rng() & 1;
+    r.mask_only = false;
+
+    const int width_uv = r.blocks_x * r.block_width_uv;
+    const int width = width_uv + r.col;
+    const int height = r.block_height_uv;
+
+    // Source planes are generated as small deviations from a common picture so that the rainbow test sees
+    // values on both sides of variation.
+    std::vector<int> base(static_cast<size_t>(width) * height * 2);
+    for (auto& v : base)
+        v = (rng() % 16 == 0) ? ((rng() & 1) ? peak : 0) : rng() % (peak + 1);
+
+    std::vector<std::vector<T>> planes(16);
+    std::vector<int> pitches(8);
+    const int spread = std::max(r.variation * 2, 4);
+
+    for (int i = 0; i < 8; ++i)
+    {
+        pitches[i] = width + rng() % 24;
+
+        for (int uv = 0; uv < 2; ++uv)
+        {
+            std::vector<T>& plane = planes[i * 2 + uv];
+            plane.assign(static_cast<size_t>(pitches[i]) * height, sample<T>(rng() % (peak + 1), peak));
+
+            for (int y = 0; y < height; ++y)
+                for (int x = 0; x < width; ++x)
+                {
+                    const int v = base[(static_cast<size_t>(uv) * height + y) * width + x] + static_cast<int>(rng() % (spread * 2 + 1)) - spread;
+                    plane[static_cast<size_t>(y) * pitches[i] + x] = sample<T>(std::min(std::max(v, 0), peak), peak);
+                }
+        }
+    }
+
+    std::vector<uint8_t> source(r.blocks_x), direction(r.blocks_x);
+    for (int x = 0; x < r.blocks_x; ++x)
+    {
+        // Runs of equal blocks are common in real frames. Blocks outside the region of interest are fallback blocks with bdNone.
+        source[x] = (x > 0 && rng() % 2) ? source[x - 1] : rng() % 4;
+        direction[x] = (x > 0 && rng() % 2) ? direction[x - 1] : rng() % 3;
+        if (source[x] == msFallback && rng() % 2)
+            direction[x] = bdNone;
+    }
+
+    r.mask_stride = (width_uv + 63) / 64 + 1;
+    std::vector<uint64_t> inner_left(r.mask_stride), inner_right(r.mask_stride);
+    for (int x = 0; x < width_uv; ++x)
+    {
+        if (x % r.block_width_uv != 0)
+            inner_left[x >> 6] |= 1ULL << (x & 63);
+        if (x % r.block_width_uv != r.block_width_uv - 1)
+            inner_right[x >> 6] |= 1ULL << (x & 63);
+    }
+
+    r.srcpp_u = planes[0].data(); r.srcpp_v = planes[1].data(); r.srcpp_pitch_uv = pitches[0];
+    r.srcp_u = planes[2].data(); r.srcp_v = planes[3].data(); r.srcp_pitch_uv = pitches[1];
+    r.srcc_u = planes[4].data(); r.srcc_v = planes[5].data(); r.srcc_pitch_uv = pitches[2];
+    r.srcn_u = planes[6].data(); r.srcn_v = planes[7].data(); r.srcn_pitch_uv = pitches[3];
+    r.srcnn_u = planes[8].data(); r.srcnn_v = planes[9].data(); r.srcnn_pitch_uv = pitches[4];
+    r.altsrcc_u = planes[10].data(); r.altsrcc_v = planes[11].data(); r.altsrcc_pitch_uv = pitches[5];
+    r.dst_pitch_uv = pitches[6];
+    r.source = source.data();
+    r.direction = direction.data();
+    r.inner_left = inner_left.data();
+    r.inner_right = inner_right.data();
+
+    BlockRowStats expected_stats = {}, actual_stats = {};
+    std::vector<T> expected_u = planes[12], expected_v = planes[13];
+    std::vector<T> actual_u = planes[12], actual_v = planes[13];
+    std::vector<uint64_t> mask(static_cast<size_t>(r.mask_stride) * height);
+
+    r.mask = mask.data();
+    r.dst_u = expected_u.data();
+    r.dst_v = expected_v.data();
+    r.stats = (rng() & 1) ? &expected_stats : nullptr;
+    processBlockRow_c<T>(r);
+
+    r.dst_u = actual_u.data();
+    r.dst_v = actual_v.data();
+    r.stats = (r.stats) ? &actual_stats : nullptr;
+    blockRowOf<T>(set)(r.block_width_uv, r.block_height_uv)(r);
+
+    if (expected_u != actual_u || expected_v != actual_v ||
+        memcmp(expected_stats.mask_pixels, actual_stats.mask_pixels, sizeof(expected_stats.mask_pixels)))
+        fail("processBlockRow %s %d-bit: block %dx%d, blocks_x %d, col %d, variation %d, conservative_mask %d",
+            set.name, bits, r.block_width_uv, r.block_height_uv, r.blocks_x, r.col, r.variation, r.conservative_mask);
+}
+
+static bool sameFrame(const PVideoFrame& a, const PVideoFrame& b)
+{
+    const int planes[3] = { PLANAR_Y, PLANAR_U, PLANAR_V };
+
+    for (int p : planes)
+        for (int y = 0; y < a->GetHeight(p); ++y)
+            if (memcmp(a->GetReadPtr(p) + static_cast<int64_t>(y) * a->GetPitch(p), b->GetReadPtr(p) + static_cast<int64_t>(y) * b->GetPitch(p), a->GetRowSize(p)))
+                return false;
+
+    return true;
+}
+
+// The statistics that don't depend on timing.
+static bool sameStats(const PVideoFrame& a, const PVideoFrame& b, IScriptEnvironment* env)
+{
+    const char* keys[] = { "BifrostBlocksStatic", "BifrostBlocksOneSided", "BifrostBlocksFallback", "BifrostBlocksSkipped", "BifrostMaskNext", "BifrostMaskPrev", "BifrostMaskBoth" };
+
+    for (const char* key : keys)
+    {
+        int err_a, err_b;
+        if (env->propGetInt(env->getFramePropsRO(a), key, 0, &err_a) != env->propGetInt(env->getFramePropsRO(b), key, 0, &err_b) || err_a || err_b)
+            return false;
+    }
+
+    return true;
+}
+
+static std::string label(const char* fmt, ...)
+{
+    char buf[256];
+
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+
+    return buf;
+}
+
+// The frames 0..count-1, every step-th one, backwards when step is negative.
+static std::vector<int> frames(int count, int step = 1)
+{
+    std::vector<int> order;
+    for (int i = 0; i < count; i += std::abs(step))
+        order.push_back((step < 0) ? count - 1 - i : i);
+
+    return order;
+}
+
+// Compares clip with reference frame by frame in the given order, and the statistics too with stats. The first frame that differs
+// is reported after the name of the case. check is called with every frame of clip that matches.
+static bool compareClips(const PClip& reference, const PClip& clip, const std::vector<int>& order, bool stats, IScriptEnvironment* env, const std::string& name,
+    const std::function<void(int n, const PVideoFrame& actual)>& check = nullptr)
+{
+    for (int n : order)
+    {
+        const PVideoFrame expected = reference->GetFrame(n, env);
+        const PVideoFrame actual = clip->GetFrame(n, env);
+
+        if (!sameFrame(expected, actual) || (stats && !sameStats(expected, actual, env)))
+        {
+            fail("%s: frame %d differs", name.c_str(), n);
+            return false;
+        }
+
+        if (check)
+            check(n, actual);
+    }
+
+    return true;
+}
+
+static void testFilter(IScriptEnvironment* env)
+{
+    struct Format { int bits, ssw, ssh; };
+    const Format formats[] = { { 8, 1, 1 }, { 10, 1, 1 }, { 16, 1, 1 }, { 8, 1, 0 }, { 12, 1, 0 }, { 8, 0, 0 }, { 16, 0, 0 }, { 32, 1, 1 }, { 32, 0, 0 } };
+    const int block_sizes[][2] = { { 4, 4 }, { 8, 8 }, { 16, 8 }, { 12, 6 } };
+    const int cpu_flags = env->GetCPUFlags();
+
+    for (const Format& f : formats)
+    {
+        for (auto& bs : block_sizes)
+        {
+            if (bs[0] % (1 << f.ssw) || bs[1] % (1 << f.ssh))
+                continue;
+
+            for (int interlaced = 0; interlaced < 2; ++interlaced)
+            {
+                for (int conservative = 0; conservative < 2; ++conservative)
+                {
+                    BifrostArgs args;
+                    args.clip = new SyntheticClip(178, 100, f.bits, f.ssw, f.ssh, 12, 5, interlaced == 1);
+                    args.conservative_mask = conservative == 1;
+                    args.interlaced = interlaced == 1;
+                    args.blockx = bs[0];
+                    args.blocky = bs[1];
+                    args.stats = true;
+
+                    args.opt = 0;
+                    const PClip reference = invoke(env, args);
+
+                    for (const KernelSet& set : kernel_sets)
+                    {
+                        if (!isSupported(set, cpu_flags))
+                            continue;
+
+                        for (int threads : { 1, 3 })
+                        {
+                            if (set.opt == 0 && threads == 1)
+                                continue;
+
+                            args.opt = set.opt;
+                            args.threads = threads;
+
+                            // Frames in reverse order, so that the luma difference cache is filled differently.
+                            compareClips(reference, invoke(env, args), frames(12, -1), true, env,
+                                label("Bifrost %d-bit ss %d%d block %dx%d interlaced %d conservative_mask %d opt %d (%s) threads %d",
+                                    f.bits, f.ssw, f.ssh, bs[0], bs[1], interlaced, conservative, set.opt, set.name, threads));
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+// The whole filter against the frozen port of the original one in reference.h, on the formats the original supports
+// (8..16-bit): the C and the SIMD kernels must give the output of the original, with and without altclip.
+static void testBaseline(IScriptEnvironment* env)
+{
+    struct Format { int bits, ssw, ssh; };
+    const Format formats[] = { { 8, 1, 1 }, { 10, 1, 1 }, { 16, 1, 1 }, { 8, 1, 0 }, { 12, 1, 0 }, { 8, 0, 0 }, { 16, 0, 0 } };
+    const int block_sizes[][2] = { { 4, 4 }, { 8, 8 }, { 16, 8 }, { 12, 6 } };
+
+    for (const Format& f : formats)
+    {
+        for (auto& bs : block_sizes)
+        {
+            if (bs[0] % (1 << f.ssw) || bs[1] % (1 << f.ssh))
+                continue;
+
+            for (int interlaced = 0; interlaced < 2; ++interlaced)
+            {
+                for (int setting = 0; setting < 2; ++setting)
+                {
+                    BifrostArgs args;
+                    args.clip = new SyntheticClip(178, 100, f.bits, f.ssw, f.ssh, 12, 5, interlaced == 1);
+                    if (setting)
+                        args.altclip = new SyntheticClip(178, 100, f.bits, f.ssw, f.ssh, 12, 3, interlaced == 1);
+                    args.variation = (setting) ? 20 : 5;
+                    args.conservative_mask = setting == 1;
+                    args.interlaced = interlaced == 1;
+                    args.blockx = bs[0];
+                    args.blocky = bs[1];
+                    args.threads = 2;
+
+                    const PClip reference = new ReferenceClip(args.clip, args.altclip, args.luma_thresh, args.variation, args.conservative_mask, args.interlaced,
+                        args.blockx, args.blocky);
+
+                    for (int opt : { 0, -1 })
+                    {
+                        args.opt = opt;
+                        compareClips(reference, invoke(env, args), frames(12), false, env,
+                            label("baseline %d-bit ss %d%d block %dx%d interlaced %d setting %d opt %d", f.bits, f.ssw, f.ssh, bs[0], bs[1], interlaced, setting, opt));
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Frames large enough for the luma to be copied with non-temporal stores, with rows and columns right of and below the blocks.
+static void testLargeFrame(IScriptEnvironment* env)
+{
+    for (int interlaced = 0; interlaced < 2; ++interlaced)
+    {
+        BifrostArgs args;
+        args.clip = new SyntheticClip(2054, 2044, 8, 1, 1, 4, 2, interlaced == 1);
+        args.interlaced = interlaced == 1;
+        args.blockx = args.blocky = 8;
+
+        args.opt = 0;
+        const PClip reference = invoke(env, args);
+
+        args.opt = -1;
+        args.threads = 3;
+        compareClips(reference, invoke(env, args), frames(4), false, env, label("large frame interlaced %d", interlaced));
+    }
+}
+
+// Runs over an analysis_file must give the same output as the filter without one, whether the units are
+// recorded, read back or a mix of both, and a file written with other settings must be rejected.
+static void testAnalysisFile(IScriptEnvironment* env)
+{
+    const char* path = "bifrost_test_analysis.bin";
+
+    for (int interlaced = 0; interlaced < 2; ++interlaced)
+    {
+        remove(path);
+
+        BifrostArgs args;
+        args.clip = new SyntheticClip(178, 100, 10, 1, 0, 20, 7, interlaced == 1);
+        args.interlaced = interlaced == 1;
+        args.blockx = args.blocky = 8;
+        args.threads = 2;
+
+        const PClip reference = invoke(env, args);
+        args.analysis_file = path;
+
+        // The first pass records every other frame, the next ones read them and record the rest.
+        for (int pass = 0; pass < 3; ++pass)
+            compareClips(reference, invoke(env, args), frames(20, (pass == 0) ? 2 : 1), false, env, label("analysis_file interlaced %d pass %d", interlaced, pass));
+
+        try
+        {
+            args.luma_thresh = 11.0f;
+            invoke(env, args);
+            fail("analysis_file interlaced %d: a file written with another luma_thresh was accepted", interlaced);
+        }
+        catch (const AvisynthError&)
+        {
+        }
+    }
+
+    remove(path);
+}
+
+// The super-block mode decides whole regions from one difference, so it is only compared with itself: every kernel set
+// and thread count must give the same output, including the blocks right of and below the last full super-block.
+static void testSuperBlock(IScriptEnvironment* env)
+{
+    struct Format { int bits, ssw, ssh; };
+    const Format formats[] = { { 8, 1, 1 }, { 16, 1, 0 }, { 32, 0, 0 } };
+    const int cases[][3] = { { 4, 4, 32 }, { 8, 4, 16 }, { 12, 6, 36 } };
+    const int cpu_flags = env->GetCPUFlags();
+
+    for (const Format& f : formats)
+    {
+        for (auto& c : cases)
+        {
+            if (c[0] % (1 << f.ssw) || c[1] % (1 << f.ssh))
+                continue;
+
+            for (int interlaced = 0; interlaced < 2; ++interlaced)
+            {
+                BifrostArgs args;
+                args.clip = new SyntheticClip(178, 100, f.bits, f.ssw, f.ssh, 12, 5, interlaced == 1);
+                args.interlaced = interlaced == 1;
+                args.blockx = c[0];
+                args.blocky = c[1];
+                args.stats = true;
+                args.superblock = c[2];
+
+                args.opt = 0;
+                const PClip reference = invoke(env, args);
+
+                for (const KernelSet& set : kernel_sets)
+                {
+                    if (!isSupported(set, cpu_flags))
+                        continue;
+
+                    args.opt = set.opt;
+                    args.threads = 3;
+                    compareClips(reference, invoke(env, args), frames(12, -1), true, env,
+                        label("superblock %d-bit ss %d%d block %dx%d superblock %d interlaced %d opt %d (%s)", f.bits, f.ssw, f.ssh, c[0], c[1], c[2], interlaced, set.opt, set.name));
+                }
+            }
+        }
+    }
+
+    try
+    {
+        BifrostArgs args;
+        args.clip = new SyntheticClip(64, 64, 8, 1, 1, 3);
+        args.interlaced = false;
+        args.blockx = args.blocky = 8;
+        args.superblock = 12;
+        invoke(env, args);
+        fail("superblock: a size that isn't a multiple of the block was accepted");
+    }
+    catch (const AvisynthError&)
+    {
+    }
+}
+
+// An 8-bit mask with a box that moves a bit every frame, and no box at all in every fourth frame.
+class MaskClip : public IClip
+{
+    VideoInfo vi;
+
+public:
+    MaskClip(const VideoInfo& _vi) : vi(_vi)
+    {
+        vi.bits_per_component = 8;
+    }
+
+    PVideoFrame __stdcall GetFrame(int n, IScriptEnvironment* env) override
+    {
+        PVideoFrame frame = env->NewVideoFrame(vi);
+        const int planes[3] = { PLANAR_Y, PLANAR_U, PLANAR_V };
+
+        for (int p : planes)
+            for (int y = 0; y < frame->GetHeight(p); ++y)
+                memset(frame->GetWritePtr(p) + static_cast<int64_t>(y) * frame->GetPitch(p), 0, frame->GetRowSize(p));
+
+        if (n % 4 != 3)
+        {
+            for (int y = 30 + n; y < 60 + n; ++y)
+                memset(frame->GetWritePtr(PLANAR_Y) + static_cast<int64_t>(y) * frame->GetPitch(PLANAR_Y) + 50 + n * 3, 255, 40);
+        }
+
+        return frame;
+    }
+
+    bool __stdcall GetParity(int n) override { return true; }
+    const VideoInfo& __stdcall GetVideoInfo() override { return vi; }
+    int __stdcall SetCacheHints(int cachehints, int frame_range) override { return 0; }
+};
+
+// Inside the region of interest the output must match the filter without one, outside it the chroma must be the input's.
+static void testRoi(IScriptEnvironment* env)
+{
+    const int block = 8;
+
+    for (int interlaced = 0; interlaced < 2; ++interlaced)
+    {
+        for (int with_mask = 0; with_mask < 2; ++with_mask)
+        {
+            for (int superblock : { 0, 32 })
+            {
+                PClip src = new SyntheticClip(178, 100, 8, 1, 1, 12, 5, interlaced == 1);
+                PClip mask = new MaskClip(src->GetVideoInfo());
+
+                BifrostArgs args;
+                args.clip = src;
+                args.interlaced = interlaced == 1;
+                args.blockx = args.blocky = block;
+                args.threads = 2;
+                args.stats = true;
+                args.superblock = superblock;
+
+                const PClip reference = invoke(env, args);
+
+                args.roi_left = 20;
+                args.roi_top = 22;
+                args.roi_width = 100;
+                args.roi_height = 50;
+                if (with_mask)
+                    args.roi_mask = mask;
+                const PClip clip = invoke(env, args);
+
+                for (int n = 0; n < 12; ++n)
+                {
+                    const PVideoFrame input = src->GetFrame(n, env);
+                    const PVideoFrame expected = reference->GetFrame(n, env);
+                    const PVideoFrame actual = clip->GetFrame(n, env);
+                    const PVideoFrame mask_frame = mask->GetFrame(n, env);
+                    bool ok = true;
+
+                    for (int y = 0; y < 50 && ok; ++y)
+                    {
+                        for (int x = 0; x < 89 && ok; ++x)
+                        {
+                            // Block of the chroma pixel in the unit (frame or field) it belongs to.
+                            const int field = (interlaced) ? y & 1 : 0;
+                            const int fields = (interlaced) ? 2 : 1;
+                            const int bx = x * 2 / block;
+                            const int by = y * 2 / fields / block;
+                            const int blocks_x = 178 / block;
+                            const int blocks_y = 100 / fields / block;
+
+                            bool inside = bx < blocks_x && by < blocks_y && bx * block + block > 20 && bx * block < 120 &&
+                                by * block + block > 22 / fields && by * block < (72 + fields - 1) / fields;
+
+                            if (inside && with_mask)
+                            {
+                                inside = false;
+                                for (int ly = 0; ly < block; ++ly)
+                                    for (int lx = 0; lx < block; ++lx)
+                                        inside |= mask_frame->GetReadPtr(PLANAR_Y)[((by * block + ly) * fields + field) * mask_frame->GetPitch(PLANAR_Y) + bx * block + lx] != 0;
+                            }
+
+                            const PVideoFrame& want = (inside) ? expected : input;
+
+                            for (int p : { PLANAR_U, PLANAR_V })
+                                ok &= want->GetReadPtr(p)[y * want->GetPitch(p) + x] == actual->GetReadPtr(p)[y * actual->GetPitch(p) + x];
+                        }
+                    }
+
+                    if (!ok)
+                    {
+                        fail("roi interlaced %d mask %d superblock %d: frame %d differs", interlaced, with_mask, superblock, n);
+                        break;
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Marks the scene changes of a SyntheticClip like a scene change detector and records the frames that are requested.
+class SceneChangeClip : public IClip
+{
+    PClip child;
+    int scene_length;
+
+public:
+    std::vector<int> requested;
+
+    SceneChangeClip(PClip _child, int _scene_length) : child(_child), scene_length(_scene_length) {}
+
+    PVideoFrame __stdcall GetFrame(int n, IScriptEnvironment* env) override
+    {
+        requested.push_back(n);
+
+        PVideoFrame frame = child->GetFrame(n, env);
+        AVSMap* props = env->getFramePropsRW(frame);
+        env->propSetInt(props, "_SceneChangePrev", n > 0 && n % scene_length == 0, PROPAPPENDMODE_REPLACE);
+        env->propSetInt(props, "_SceneChangeNext", n < child->GetVideoInfo().num_frames - 1 && n % scene_length == scene_length - 1, PROPAPPENDMODE_REPLACE);
+
+        return frame;
+    }
+
+    bool __stdcall GetParity(int n) override { return child->GetParity(n); }
+    const VideoInfo& __stdcall GetVideoInfo() override { return child->GetVideoInfo(); }
+    int __stdcall SetCacheHints(int cachehints, int frame_range) override { return 0; }
+};
+
+// The scene changes of the generated clips are found in every block anyway, so reading them from the frame properties
+// must give the same output, without requesting the frames across them.
+static void testSceneChange(IScriptEnvironment* env)
+{
+    for (int interlaced = 0; interlaced < 2; ++interlaced)
+    {
+        for (int scene_length : { 1, 2, 5 })
+        {
+            PClip src = new SyntheticClip(178, 100, 8, 1, 1, 20, scene_length, interlaced == 1);
+            SceneChangeClip* marked = new SceneChangeClip(src, scene_length);
+            const PClip marked_src = marked;
+
+            BifrostArgs args;
+            args.clip = src;
+            args.interlaced = interlaced == 1;
+            args.blockx = args.blocky = 8;
+            args.stats = true;
+            const PClip reference = invoke(env, args);
+
+            args.clip = marked_src;
+            args.scenechange = true;
+            const PClip clip = invoke(env, args);
+
+            compareClips(reference, clip, frames(20), true, env, label("scenechange interlaced %d scene_length %d", interlaced, scene_length),
+                [&](int n, const PVideoFrame&)
+                {
+                    const int first = n / scene_length * scene_length;
+                    for (int r : marked->requested)
+                    {
+                        if (r < first || r >= first + scene_length)
+                        {
+                            fail("scenechange interlaced %d scene_length %d: frame %d requested frame %d of another scene", interlaced, scene_length, n, r);
+                            break;
+                        }
+                    }
+
+                    marked->requested.clear();
+                });
+        }
+    }
+}
+
+// Makes the luma constant within 4x8 cells, so that every 4x4 square of a field holds one value.
+class CellClip : public IClip
+{
+    PClip child;
+
+public:
+    CellClip(PClip _child) : child(_child) {}
+
+    PVideoFrame __stdcall GetFrame(int n, IScriptEnvironment* env) override
+    {
+        const PVideoFrame src = child->GetFrame(n, env);
+        const VideoInfo& vi = child->GetVideoInfo();
+        PVideoFrame frame = env->NewVideoFrame(vi);
+        const int size = vi.ComponentSize();
+
+        for (int p : { PLANAR_U, PLANAR_V })
+            env->BitBlt(frame->GetWritePtr(p), frame->GetPitch(p), src->GetReadPtr(p), src->GetPitch(p), src->GetRowSize(p), src->GetHeight(p));
+
+        for (int y = 0; y < vi.height; ++y)
+            for (int x = 0; x < vi.width; ++x)
+                memcpy(frame->GetWritePtr(PLANAR_Y) + static_cast<int64_t>(y) * frame->GetPitch(PLANAR_Y) + x * size,
+                    src->GetReadPtr(PLANAR_Y) + static_cast<int64_t>(y / 8 * 8) * src->GetPitch(PLANAR_Y) + x / 4 * 4 * size, size);
+
+        return frame;
+    }
+
+    bool __stdcall GetParity(int n) override { return child->GetParity(n); }
+    const VideoInfo& __stdcall GetVideoInfo() override { return child->GetVideoInfo(); }
+    int __stdcall SetCacheHints(int cachehints, int frame_range) override { return 0; }
+};
+
+// Decimating luma that is constant within the squares keeps every luma difference, so the output must be the one of motion_scale=1.
+// Every kernel set and thread count must give the same output.
+static void testMotionScale(IScriptEnvironment* env)
+{
+    struct Format { int bits, ssw, ssh; };
+    const Format formats[] = { { 8, 1, 1 }, { 10, 1, 0 }, { 16, 0, 0 }, { 32, 1, 1 } };
+    const int cases[][4] = { { 8, 8, 0, 2 }, { 8, 8, 0, 4 }, { 16, 8, 0, 4 }, { 4, 4, 0, 4 }, { 4, 4, 32, 2 } };
+    const int cpu_flags = env->GetCPUFlags();
+
+    for (const Format& f : formats)
+    {
+        for (auto& c : cases)
+        {
+            if (c[0] % (2 << f.ssw) || c[1] % (2 << f.ssh))
+                continue;
+
+            for (int interlaced = 0; interlaced < 2; ++interlaced)
+            {
+                BifrostArgs args;
+                args.clip = new CellClip(new SyntheticClip(178, 100, f.bits, f.ssw, f.ssh, 10, 5, interlaced == 1));
+                args.interlaced = interlaced == 1;
+                args.blockx = c[0];
+                args.blocky = c[1];
+                args.stats = true;
+                args.superblock = c[2];
+
+                //float averages aren't exact, so they are only compared between kernel sets
+                args.opt = 0;
+                args.motion_scale = (f.bits == 32) ? c[3] : 1;
+                const PClip reference = invoke(env, args);
+
+                for (const KernelSet& set : kernel_sets)
+                {
+                    if (!isSupported(set, cpu_flags))
+                        continue;
+
+                    args.opt = set.opt;
+                    args.threads = 3;
+                    args.motion_scale = c[3];
+                    compareClips(reference, invoke(env, args), frames(10, -1), true, env,
+                        label("motion_scale %d %d-bit ss %d%d block %dx%d superblock %d interlaced %d opt %d (%s)", c[3], f.bits, f.ssw, f.ssh, c[0], c[1], c[2], interlaced,
+                            set.opt, set.name));
+                }
+            }
+        }
+    }
+
+    try
+    {
+        BifrostArgs args;
+        args.clip = new SyntheticClip(64, 64, 8, 1, 1, 3);
+        args.interlaced = false;
+        args.blockx = args.blocky = 6;
+        args.motion_scale = 4;
+        invoke(env, args);
+        fail("motion_scale: a block size that isn't a multiple of it was accepted");
+    }
+    catch (const AvisynthError&)
+    {
+    }
+}
+
+// Frames whose neighbourhood was already processed must be copied from the cache with the same output and statistics.
+static void testDupCache(IScriptEnvironment* env)
+{
+    for (int interlaced = 0; interlaced < 2; ++interlaced)
+    {
+        for (int bits : { 8, 16 })
+        {
+            PClip src = new SequenceClip(new SyntheticClip(178, 100, bits, 1, 1, 4, 2, interlaced == 1), SequenceClip::hold(6, 4, 60));
+            PClip alt = new SequenceClip(new SyntheticClip(178, 100, bits, 1, 1, 4, 4, interlaced == 1), SequenceClip::hold(6, 4, 60));
+
+            for (int altclip = 0; altclip < 2; ++altclip)
+            {
+                BifrostArgs args;
+                args.clip = src;
+                if (altclip)
+                    args.altclip = alt;
+                args.interlaced = interlaced == 1;
+                args.blockx = args.blocky = 8;
+                args.threads = 2;
+                args.stats = true;
+                const PClip reference = invoke(env, args);
+
+                args.dup_cache = 64;
+                const PClip clip = invoke(env, args);
+                int hits = 0;
+
+                compareClips(reference, clip, { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31,
+                    59, 58, 57, 56, 55, 54, 53, 52, 1, 2 }, true, env, label("dup_cache %d-bit interlaced %d altclip %d", bits, interlaced, altclip),
+                    [&](int, const PVideoFrame& actual)
+                    {
+                        hits += static_cast<int>(env->propGetInt(env->getFramePropsRO(actual), "BifrostDupCacheHit", 0, nullptr));
+                    });
+
+                //three in every hold, most of the second cycle and the repeated requests
+                if (hits < 24)
+                    fail("dup_cache %d-bit interlaced %d altclip %d: only %d hits", bits, interlaced, altclip, hits);
+            }
+        }
+    }
+
+    //frames 3 and 10 have the same neighbours, but the moving blocks of frame 3 read a frame two steps away that differs
+    for (int interlaced = 0; interlaced < 2; ++interlaced)
+    {
+        BifrostArgs args;
+        args.clip = new SequenceClip(new SyntheticClip(178, 100, 8, 1, 1, 4, 100, interlaced == 1), { 3, 3, 0, 1, 1, 2, 2, 3, 3, 0, 1, 1, 1, 3, 3 });
+        args.interlaced = interlaced == 1;
+        args.blockx = args.blocky = 8;
+        args.stats = true;
+        const PClip reference = invoke(env, args);
+
+        args.dup_cache = 64;
+        compareClips(reference, invoke(env, args), frames(15), true, env, label("dup_cache interlaced %d sequence", interlaced));
+    }
+}
+
+// BifrostApply must give the output and statistics of Bifrost, and one analysis must serve several of them with other settings.
+static void testSplit(IScriptEnvironment* env)
+{
+    struct Format { int bits, ssw, ssh; };
+    const Format formats[] = { { 8, 1, 1 }, { 16, 1, 0 }, { 32, 0, 0 } };
+    const int cases[][3] = { { 0, 1, 0 }, { 32, 2, 1 } }; // superblock, motion_scale, region of interest
+
+    for (const Format& f : formats)
+    {
+        for (int interlaced = 0; interlaced < 2; ++interlaced)
+        {
+            PClip src = new SyntheticClip(178, 100, f.bits, f.ssw, f.ssh, 12, 5, interlaced == 1);
+            PClip alt = new SyntheticClip(178, 100, f.bits, f.ssw, f.ssh, 12, 3, interlaced == 1);
+            PClip mask = new MaskClip(src->GetVideoInfo());
+
+            for (auto& c : cases)
+            {
+                BifrostArgs args;
+                args.clip = src;
+                args.interlaced = interlaced == 1;
+                args.blockx = args.blocky = 8;
+                args.threads = 2;
+                args.stats = true;
+                args.superblock = c[0];
+                args.motion_scale = c[1];
+                if (c[2])
+                {
+                    args.roi_left = 20;
+                    args.roi_top = 22;
+                    args.roi_width = 100;
+                    args.roi_height = 50;
+                    args.roi_mask = mask;
+                }
+
+                BifrostAnalyseArgs analyse_args;
+                analyse_args.clip = src;
+                analyse_args.interlaced = args.interlaced;
+                analyse_args.blockx = analyse_args.blocky = 8;
+                analyse_args.threads = 2;
+                analyse_args.stats = true;
+                analyse_args.superblock = args.superblock;
+                analyse_args.motion_scale = args.motion_scale;
+                analyse_args.roi_left = args.roi_left;
+                analyse_args.roi_top = args.roi_top;
+                analyse_args.roi_width = args.roi_width;
+                analyse_args.roi_height = args.roi_height;
+                analyse_args.roi_mask = args.roi_mask;
+
+                CacheClip* cache = new CacheClip(invoke(env, analyse_args));
+                const PClip analysis = cache;
+
+                for (int setting = 0; setting < 2; ++setting)
+                {
+                    args.altclip = (setting) ? alt : PClip();
+                    args.variation = (setting) ? 20 : 5;
+                    args.conservative_mask = setting == 1;
+
+                    BifrostApplyArgs apply_args;
+                    apply_args.clip = src;
+                    apply_args.analysis = analysis;
+                    apply_args.altclip = args.altclip;
+                    apply_args.variation = args.variation;
+                    apply_args.conservative_mask = args.conservative_mask;
+                    apply_args.interlaced = args.interlaced;
+                    apply_args.blockx = apply_args.blocky = 8;
+                    apply_args.threads = 2;
+                    apply_args.stats = true;
+
+                    compareClips(invoke(env, args), invoke(env, apply_args), frames(12), true, env,
+                        label("BifrostApply %d-bit interlaced %d superblock %d motion_scale %d roi %d setting %d", f.bits, interlaced, c[0], c[1], c[2], setting));
+                }
+
+                if (cache->requests != 12)
+                    fail("BifrostAnalyse %d-bit interlaced %d: %d frames analysed for 12", f.bits, interlaced, cache->requests);
+            }
+        }
+    }
+
+    try
+    {
+        BifrostAnalyseArgs analyse_args;
+        analyse_args.clip = new SyntheticClip(64, 64, 8, 1, 1, 3);
+        analyse_args.blockx = analyse_args.blocky = 8;
+
+        BifrostApplyArgs apply_args;
+        apply_args.clip = analyse_args.clip;
+        apply_args.analysis = invoke(env, analyse_args);
+        invoke(env, apply_args);
+        fail("BifrostApply: an analysis of other blocks was accepted");
+    }
+    catch (const AvisynthError&)
+    {
+    }
+}
+
+// An altclip with the pixel type, dimensions and length of the input must be accepted by Bifrost and BifrostApply, any other one rejected.
+static void testAltclip(IScriptEnvironment* env)
+{
+    struct Alt { int width, height, bits, ssw, ssh, frames; bool accepted; };
+    const Alt alts[] = { { 64, 64, 8, 1, 1, 3, true }, { 64, 64, 10, 1, 1, 3, false }, { 64, 64, 8, 1, 0, 3, false }, { 64, 32, 8, 1, 1, 3, false }, { 64, 64, 8, 1, 1, 4, false } };
+
+    for (const Alt& a : alts)
+    {
+        BifrostArgs args;
+        args.clip = new SyntheticClip(64, 64, 8, 1, 1, 3);
+        args.altclip = new SyntheticClip(a.width, a.height, a.bits, a.ssw, a.ssh, a.frames);
+
+        BifrostAnalyseArgs analyse_args;
+        analyse_args.clip = args.clip;
+
+        BifrostApplyArgs apply_args;
+        apply_args.clip = args.clip;
+        apply_args.analysis = invoke(env, analyse_args);
+        apply_args.altclip = args.altclip;
+
+        for (int split = 0; split < 2; ++split)
+        {
+            bool accepted = true;
+
+            try
+            {
+                const PClip clip = (split) ? invoke(env, apply_args) : invoke(env, args);
+                clip->GetFrame(1, env);
+            }
+            catch (const AvisynthError&)
+            {
+                accepted = false;
+            }
+
+            if (accepted != a.accepted)
+                fail("%s: an altclip %dx%d %d-bit ss %d%d of %d frames was %s", (split) ? "BifrostApply" : "Bifrost", a.width, a.height, a.bits, a.ssw, a.ssh, a.frames,
+                    (accepted) ? "accepted" : "rejected");
+        }
+    }
+}
+
+// Whether the sample at p is the 8-bit value v at the given depth, float chroma being centered on 0.
+static bool isShowValue(const uint8_t* p, int bits, int v)
+{
+    if (bits == 32)
+        return *reinterpret_cast<const float*>(p) == (v - 128) / 255.0f;
+    if (bits > 8)
+        return *reinterpret_cast<const uint16_t*>(p) == v << (bits - 8);
+
+    return *p == v;
+}
+
+// show=1 must paint every block in the colour of its class and read nothing but the current frame. show=2 must paint
+// only magenta and grey over the blocks, magenta at least where the filter changes the chroma. Both keep the rest of the input.
+static void testShow(IScriptEnvironment* env)
+{
+    struct Format { int bits, ssw, ssh; };
+    const Format formats[] = { { 8, 1, 1 }, { 16, 1, 0 }, { 32, 0, 0 } };
+    const int class_colours[4][2] = { { 90, 240 }, { 54, 34 }, { 240, 110 }, { 16, 146 } };
+
+    for (const Format& f : formats)
+    {
+        for (int interlaced = 0; interlaced < 2; ++interlaced)
+        {
+            for (int roi = 0; roi < 2; ++roi)
+            {
+                PClip src = new SyntheticClip(178, 100, f.bits, f.ssw, f.ssh, 12, 5, interlaced == 1);
+                //the scenes are longer than the clip, no scene change is marked
+                SceneChangeClip* marked = new SceneChangeClip(src, 100);
+                const PClip marked_src = marked;
+
+                BifrostAnalyseArgs analyse_args;
+                analyse_args.clip = src;
+                analyse_args.interlaced = interlaced == 1;
+                analyse_args.blockx = analyse_args.blocky = 8;
+                analyse_args.threads = 2;
+                if (roi)
+                {
+                    analyse_args.roi_left = 20;
+                    analyse_args.roi_top = 22;
+                    analyse_args.roi_width = 100;
+                    analyse_args.roi_height = 50;
+                }
+                const PClip analysis = new CacheClip(invoke(env, analyse_args));
+
+                BifrostApplyArgs args;
+                args.clip = src;
+                args.analysis = analysis;
+                args.interlaced = interlaced == 1;
+                args.blockx = args.blocky = 8;
+                args.threads = 2;
+                const PClip reference = invoke(env, args);
+
+                args.show = 2;
+                const PClip mask = invoke(env, args);
+
+                args.clip = marked_src;
+                args.show = 1;
+                const PClip classes = invoke(env, args);
+
+                const VideoInfo& vi = src->GetVideoInfo();
+                const int size = vi.ComponentSize();
+                const int fields = interlaced + 1;
+                const int blocks_x = vi.width / 8;
+                const int blocks_y = vi.height / fields / 8;
+                const int width_uv = blocks_x * 8 >> f.ssw;
+                const int height_uv = blocks_y * 8 * fields >> f.ssh;
+                int64_t magenta = 0;
+
+                for (int n = 0; n < 12; ++n)
+                {
+                    const PVideoFrame input = src->GetFrame(n, env);
+                    const PVideoFrame expected = reference->GetFrame(n, env);
+                    const PVideoFrame classes_frame = analysis->GetFrame(n, env);
+
+                    marked->requested.clear();
+                    const PVideoFrame shown_classes = classes->GetFrame(n, env);
+                    if (marked->requested.size() != 1 || marked->requested[0] != n)
+                        fail("show=1 %d-bit interlaced %d roi %d: frame %d requested %d frames", f.bits, interlaced, roi, n, static_cast<int>(marked->requested.size()));
+
+                    const PVideoFrame shown_mask = mask->GetFrame(n, env);
+
+                    bool ok = true;
+                    for (int p : { PLANAR_Y, PLANAR_U, PLANAR_V })
+                    {
+                        for (int y = 0; y < input->GetHeight(p) && ok; ++y)
+                        {
+                            for (int x = 0; x < input->GetRowSize(p) / size && ok; ++x)
+                            {
+                                auto at = [&](const PVideoFrame& frame, int plane) { return frame->GetReadPtr(plane) + static_cast<int64_t>(y) * frame->GetPitch(plane) + x * size; };
+                                const bool same_classes = !memcmp(at(shown_classes, p), at(input, p), size);
+                                const bool same_mask = !memcmp(at(shown_mask, p), at(input, p), size);
+
+                                if (p == PLANAR_Y || x >= width_uv || y >= height_uv)
+                                {
+                                    ok = same_classes && same_mask;
+                                    continue;
+                                }
+
+                                //the classes are only checked on progressive frames, where a row of blocks is a run of chroma rows
+                                if (!interlaced)
+                                {
+                                    const uint8_t c = classes_frame->GetReadPtr(PLANAR_Y)[(y / (8 >> f.ssh)) * classes_frame->GetPitch(PLANAR_Y) + x / (8 >> f.ssw)];
+                                    ok = (c == (msFallback | bdNone << 2)) ? same_classes : isShowValue(at(shown_classes, p), f.bits, class_colours[c & 3][p == PLANAR_V]);
+                                }
+
+                                const bool changed = memcmp(at(expected, PLANAR_U), at(input, PLANAR_U), size) || memcmp(at(expected, PLANAR_V), at(input, PLANAR_V), size);
+                                const bool is_magenta = isShowValue(at(shown_mask, PLANAR_U), f.bits, 202) && isShowValue(at(shown_mask, PLANAR_V), f.bits, 222);
+                                const bool is_grey = isShowValue(at(shown_mask, PLANAR_U), f.bits, 128) && isShowValue(at(shown_mask, PLANAR_V), f.bits, 128);
+
+                                ok = ok && (is_magenta || (is_grey && !changed));
+                                magenta += is_magenta && p == PLANAR_U;
+                            }
+                        }
+                    }
+
+                    if (!ok)
+                    {
+                        fail("show %d-bit interlaced %d roi %d: frame %d differs", f.bits, interlaced, roi, n);
+                        break;
+                    }
+                }
+
+                if (!magenta)
+                    fail("show=2 %d-bit interlaced %d roi %d: no pixel is masked", f.bits, interlaced, roi);
+            }
+        }
+    }
+}
+
+#ifndef _WIN32
+// Bifrost on a YUV4MPEG2 file (mapped) and stream (read into the ring) must give the output of the same clip, frames without padding included.
+static void testY4M(IScriptEnvironment* env)
+{
+    const char* path = "bifrost_test.y4m";
+
+    struct Format { int bits, ssw, ssh; const char* colorspace; };
+    const Format formats[] = { { 8, 1, 1, "420jpeg" }, { 16, 1, 0, "422p16" } };
+
+    for (const Format& f : formats)
+    {
+        for (int interlaced = 0; interlaced < 2; ++interlaced)
+        {
+            PClip src = new SyntheticClip(178, 100, f.bits, f.ssw, f.ssh, 12, 5, interlaced == 1);
+
+            char header[128];
+            snprintf(header, sizeof(header), "YUV4MPEG2 W178 H100 F24000:1001 I%c A1:1 C%s XCOLORRANGE=LIMITED\n", (interlaced) ? 't' : 'p', f.colorspace);
+
+            const int out = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            bool written = out != -1 && writeY4M(out, header, strlen(header));
+            for (int n = 0; n < 12 && written; ++n)
+                written = writeY4MFrame(out, src->GetFrame(n, env));
+            if (out != -1)
+                close(out);
+
+            if (!written)
+            {
+                fail("Y4M: cannot write %s", path);
+                return;
+            }
+
+            BifrostArgs args;
+            args.clip = src;
+            args.interlaced = interlaced == 1;
+            args.blockx = args.blocky = 8;
+            args.threads = 2;
+            const PClip reference = invoke(env, args);
+
+            for (int stream = 0; stream < 2; ++stream)
+            {
+                const int in = (stream) ? open(path, O_RDONLY) : -1;
+                Y4MClip* y4m = (stream) ? new Y4MClip(in, 0, 10) : new Y4MClip(path);
+                args.clip = y4m;
+                PClip clip = invoke(env, args);
+
+                //the ring only keeps the frames that weren't released, so they are requested in order and released as they are compared
+                compareClips(reference, clip, frames(12), false, env, label("Y4M %d-bit interlaced %d stream %d", f.bits, interlaced, stream),
+                    [&](int n, const PVideoFrame&) { y4m->release(n - 1); });
+
+                if (!y4m->hasFrame(11) || y4m->hasFrame(12))
+                    fail("Y4M %d-bit interlaced %d stream %d: the clip doesn't have 12 frames", f.bits, interlaced, stream);
+
+                args.clip = PClip();
+                clip = PClip();
+                if (in != -1)
+                    close(in);
+            }
+        }
+    }
+
+    remove(path);
+}
+#endif
+
+int main(int argc, char** argv)
+{
+    const int iterations = (argc > 1) ? atoi(argv[1]) : 2000;
+
+    IScriptEnvironment env;
+    AvisynthPluginInit3(&env, nullptr);
+
+    const int cpu_flags = env.GetCPUFlags();
+    std::mt19937 rng(12345);
+
+    for (const KernelSet& set : kernel_sets)
+    {
+        if (!isSupported(set, cpu_flags))
+        {
+            printf("%s: not supported by this CPU, skipped\n", set.name);
+            continue;
+        }
+
+        const int before = failures;
+
+        for (int i = 0; i < iterations; ++i)
+        {
+            fuzzLumaDiff<uint8_t>(rng, set, 8);
+            fuzzLumaDiff<uint16_t>(rng, set, 10 + 2 * (i % 4 == 0) + 4 * (i % 4 == 1));
+            fuzzBlockRow<uint8_t>(rng, set, 8);
+            fuzzBlockRow<uint16_t>(rng, set, 10 + 2 * (i % 4 == 0) + 4 * (i % 4 == 1));
+            fuzzLumaDiff<float>(rng, set, 32);
+            fuzzBlockRow<float>(rng, set, 32);
+            fuzzDecimate<uint8_t>(rng, set, 8);
+            fuzzDecimate<uint16_t>(rng, set, 10 + 2 * (i % 4 == 0) + 4 * (i % 4 == 1));
+            fuzzHash(rng, set);
+        }
+
+        printf("%s: %d random cases, %d failures\n", set.name, iterations * 9, failures - before);
+    }
+
+    const int before = failures;
+    testFilter(&env);
+    printf("filter: %d failures\n", failures - before);
+
+    const int before_baseline = failures;
+    testBaseline(&env);
+    printf("baseline: %d failures\n", failures - before_baseline);
+
+    const int before_large = failures;
+    testLargeFrame(&env);
+    printf("large frame: %d failures\n", failures - before_large);
+
+    const int before_analysis = failures;
+    testAnalysisFile(&env);
+    printf("analysis_file: %d failures\n", failures - before_analysis);
+
+    const int before_superblock = failures;
+    testSuperBlock(&env);
+    printf("superblock: %d failures\n", failures - before_superblock);
+
+    const int before_roi = failures;
+    testRoi(&env);
+    printf("roi: %d failures\n", failures - before_roi);
+
+    const int before_scenechange = failures;
+    testSceneChange(&env);
+    printf("scenechange: %d failures\n", failures - before_scenechange);
+
+    const int before_motion_scale = failures;
+    testMotionScale(&env);
+    printf("motion_scale: %d failures\n", failures - before_motion_scale);
+
+    const int before_dup_cache = failures;
+    testDupCache(&env);
+    printf("dup_cache: %d failures\n", failures - before_dup_cache);
+
+    const int before_split = failures;
+    testSplit(&env);
+    printf("BifrostAnalyse/BifrostApply: %d failures\n", failures - before_split);
+
+    const int before_altclip = failures;
+    testAltclip(&env);
+    printf("altclip: %d failures\n", failures - before_altclip);
+
+    const int before_show = failures;
+    testShow(&env);
+    printf("show: %d failures\n", failures - before_show);
+
+#ifndef _WIN32
+    const int before_y4m = failures;
+    testY4M(&env);
+    printf("Y4M: %d failures\n", failures - before_y4m);
+#endif
+
+    printf((failures) ? "FAILED\n" : "PASSED\n");
+
+    return (failures) ? 1 : 0;
+}
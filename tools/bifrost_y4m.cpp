@@ -0,0 +1,301 @@
+// Runs Bifrost on YUV4MPEG2 and writes the result to stdout as YUV4MPEG2, without AviSynth:
+//     bifrost_y4m [input.y4m] [name=value ...]
+// The input is read from stdin when it isn't given or is "-". The parameters are those of Bifrost(), clips are YUV4MPEG2 files.
+// The stream is read, filtered and written by three threads, with frames handed over without copies.
+
+#include <algorithm>
+#include <condition_variable>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include "avisynth.h"
+#include "y4m.h"
+
+struct Param
+{
+    std::string name;
+    char type;
+};
+
+// The parameter string of AddFunction: a type letter per parameter, optional ones preceded by their [name].
+static std::vector<Param> parseParams(const char* params)
+{
+    std::vector<Param> list;
+
+    while (*params)
+    {
+        Param param;
+
+        if (*params == '[')
+        {
+            const char* end = strchr(params, ']');
+            param.name.assign(params + 1, end);
+            params = end + 1;
+        }
+
+        param.type = *params++;
+        list.push_back(param);
+    }
+
+    return list;
+}
+
+static AVSValue parseValue(const Param& param, const char* value)
+{
+    char* end = nullptr;
+
+    switch (param.type)
+    {
+        case 'i':
+        {
+            const long i = strtol(value, &end, 10);
+            if (*value && !*end)
+                return static_cast<int>(i);
+            break;
+        }
+        case 'f':
+        {
+            const double f = strtod(value, &end);
+            if (*value && !*end)
+                return f;
+            break;
+        }
+        case 'b':
+            if (!strcmp(value, "true") || !strcmp(value, "1"))
+                return true;
+            if (!strcmp(value, "false") || !strcmp(value, "0"))
+                return false;
+            break;
+        case 's':
+            return value;
+        case 'c':
+            return new Y4MClip(value);
+    }
+
+    throw std::runtime_error(param.name + " must be " + ((param.type == 'i') ? "an integer." : (param.type == 'f') ? "a number." : "true or false."));
+}
+
+// Writes the frames it is given on a thread of its own, a few of them behind the filter.
+class FrameWriter
+{
+    static constexpr size_t queue_size = 4;
+
+    int fd;
+    std::deque<PVideoFrame> queue;
+    bool finished;
+    bool failed;
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::thread thread;
+
+    void run()
+    {
+        for (;;)
+        {
+            PVideoFrame frame;
+
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                cv.wait(lock, [&]() { return !queue.empty() || finished; });
+
+                if (queue.empty())
+                    return;
+
+                frame = queue.front();
+            }
+
+            const bool written = writeY4MFrame(fd, frame);
+
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                queue.pop_front();
+                failed = !written;
+            }
+
+            cv.notify_all();
+
+            if (!written)
+                return;
+        }
+    }
+
+public:
+    FrameWriter(int _fd) : fd(_fd), finished(false), failed(false), thread(&FrameWriter::run, this) {}
+
+    ~FrameWriter() { finish(); }
+
+    // Returns false once a write failed.
+    bool push(const PVideoFrame& frame)
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        cv.wait(lock, [&]() { return queue.size() < queue_size || failed; });
+
+        if (failed)
+            return false;
+
+        queue.push_back(frame);
+        cv.notify_all();
+
+        return true;
+    }
+
+    // Waits for the frames in the queue to be written.
+    bool finish()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            finished = true;
+        }
+
+        cv.notify_all();
+
+        if (thread.joinable())
+            thread.join();
+
+        return !failed;
+    }
+};
+
+static void usage(const std::vector<Param>& params)
+{
+    fprintf(stderr, "Usage: bifrost_y4m [input.y4m] [name=value ...] > output.y4m\n"
+        "The input is read from stdin when it isn't given or is -. Clips are YUV4MPEG2 files. Parameters of Bifrost():\n");
+
+    for (size_t i = 1; i < params.size(); ++i)
+        fprintf(stderr, "    %s (%s)\n", params[i].name.c_str(),
+            (params[i].type == 'c') ? "clip" : (params[i].type == 'i') ? "int" : (params[i].type == 'f') ? "float" : (params[i].type == 'b') ? "bool" : "string");
+}
+
+static int run(int argc, char** argv, IScriptEnvironment& env)
+{
+    const std::vector<Param> params = parseParams(env.GetFunctionParams("Bifrost"));
+    std::vector<AVSValue> args(params.size());
+
+    auto find = [&](const char* name)
+    {
+        for (size_t i = 1; i < params.size(); ++i)
+            if (params[i].name == name)
+                return static_cast<int>(i);
+
+        return 0;
+    };
+
+    const char* input = nullptr;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const char* eq = strchr(argv[i], '=');
+
+        if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help"))
+        {
+            usage(params);
+            return 0;
+        }
+
+        if (eq)
+        {
+            const std::string name(argv[i], eq - argv[i]);
+            const int index = find(name.c_str());
+            if (!index)
+                throw std::runtime_error("unknown parameter " + name + ".");
+
+            args[index] = parseValue(params[index], eq + 1);
+        }
+        else if (!input)
+            input = argv[i];
+        else
+        {
+            usage(params);
+            return 1;
+        }
+    }
+
+    const bool stream = !input || !strcmp(input, "-");
+    Y4MClip* source;
+
+    if (stream)
+    {
+        //the length of a pipe isn't known, unless the clips given as parameters tell it
+        int num_frames = 0;
+        for (size_t i = 1; i < params.size(); ++i)
+            if (args[i].IsClip() && !num_frames)
+                num_frames = args[i].AsClip()->GetVideoInfo().num_frames;
+
+        if (args[find("analysis_file")].Defined() && !num_frames)
+            throw std::runtime_error("analysis_file needs the length of the input, read it from a file instead of a pipe.");
+
+        //the five frames around the current one and a few the reader fills ahead
+        source = new Y4MClip(STDIN_FILENO, num_frames, 5 + 3);
+    }
+    else
+        source = new Y4MClip(input);
+
+    args[0] = source;
+
+    //without the parameter, the field order of the header says whether the input is interlaced
+    const int interlaced = find("interlaced");
+    if (!args[interlaced].Defined() && source->interlacing() >= 0)
+        args[interlaced] = source->interlacing() == 1;
+
+    const PClip clip = env.Invoke("Bifrost", AVSValue(args.data(), static_cast<int>(args.size()))).AsClip();
+    const int num_frames = clip->GetVideoInfo().num_frames;
+
+    const std::string header = source->header() + "\n";
+    if (!writeY4M(STDOUT_FILENO, header.data(), header.size()))
+        throw std::runtime_error("cannot write the output.");
+
+    FrameWriter writer(STDOUT_FILENO);
+    int n = 0;
+
+    for (; n < num_frames && source->hasFrame(n); ++n)
+    {
+        if (!writer.push(clip->GetFrame(n, &env)))
+            break;
+
+        //the frames from n - 1 on are still needed for frame n + 1
+        source->release(n - 1);
+    }
+
+    if (!writer.finish())
+        throw std::runtime_error("cannot write the output.");
+
+    if (stream && num_frames != Y4MClip::unknown_length && (n < num_frames || source->hasFrame(num_frames)))
+        throw std::runtime_error("the input must have the length of the clips given as parameters.");
+
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    //a closed output is reported as a write error
+    signal(SIGPIPE, SIG_IGN);
+
+    //the messages of AvisynthError live in the environment
+    IScriptEnvironment env;
+    AvisynthPluginInit3(&env, nullptr);
+
+    try
+    {
+        return run(argc, argv, env);
+    }
+    catch (const AvisynthError& e)
+    {
+        fprintf(stderr, "bifrost_y4m: %s\n", e.msg);
+    }
+    catch (const std::exception& e)
+    {
+        fprintf(stderr, "bifrost_y4m: %s\n", e.what());
+    }
+
+    return 1;
+}
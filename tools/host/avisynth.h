@@ -0,0 +1,556 @@
+// Minimal in-process host: a stand-in for the parts of avisynth.h used by Bifrost.
+// bifrost_y4m, bifrost_bench and bifrost_test link the filter statically against it and run it without an AviSynth installation.
+// Only the names and semantics the filter relies on are provided. It isn't ABI compatible with AviSynth:
+// a plugin built against it can't be loaded by AviSynth, and it can't load AviSynth plugins.
+
+#pragma once
+
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#if !defined(_WIN32)
+#define __stdcall
+#define __cdecl
+#define __declspec(x)
+#endif
+
+struct AVS_Linkage {};
+
+enum
+{
+    PLANAR_Y = 1 << 0,
+    PLANAR_U = 1 << 1,
+    PLANAR_V = 1 << 2
+};
+
+enum
+{
+    CPUF_SSE2 = 0x20,
+    CPUF_SSE4_1 = 0x400,
+    CPUF_AVX2 = 0x2000,
+    CPUF_AVX512F = 0x100000,
+    CPUF_AVX512BW = 0x4000000
+};
+
+enum
+{
+    CACHE_NOTHING = 10,
+    CACHE_WINDOW = 11,
+    CACHE_GET_POLICY = 30,
+    CACHE_GET_WINDOW = 31,
+    CACHE_GET_MTMODE = 0x1000
+};
+
+enum MtMode
+{
+    MT_INVALID = 0,
+    MT_NICE_FILTER = 1,
+    MT_MULTI_INSTANCE = 2,
+    MT_SERIALIZED = 3
+};
+
+enum AvsEnvProperty
+{
+    AEP_PHYSICAL_CPUS = 1,
+    AEP_LOGICAL_CPUS = 2,
+    AEP_THREADPOOL_THREADS = 3,
+    AEP_FILTERCHAIN_THREADS = 4,
+    AEP_THREAD_ID = 5,
+    AEP_VERSION = 6
+};
+
+enum AVSPropAppendMode
+{
+    PROPAPPENDMODE_REPLACE = 0,
+    PROPAPPENDMODE_APPEND = 1,
+    PROPAPPENDMODE_TOUCH = 2
+};
+
+enum AVSGetPropErrors
+{
+    GETPROPERROR_UNSET = 1,
+    GETPROPERROR_TYPE = 2,
+    GETPROPERROR_INDEX = 4
+};
+
+class AvisynthError
+{
+public:
+    const char* const msg;
+    AvisynthError(const char* _msg) : msg(_msg) {}
+};
+
+class IScriptEnvironment;
+
+// Planar YUV, or 8-bit Y when pixel_type is CS_Y8. bits_per_component 32 is float.
+struct VideoInfo
+{
+    int width = 0;
+    int height = 0;
+    unsigned fps_numerator = 24000;
+    unsigned fps_denominator = 1001;
+    int num_frames = 0;
+    int bits_per_component = 8;
+    int subsampling_w = 1;
+    int subsampling_h = 1;
+    int image_type = 0;
+    int pixel_type = 0;
+
+    enum
+    {
+        CS_Y8 = 1
+    };
+
+    enum
+    {
+        IT_BFF = 1 << 0,
+        IT_TFF = 1 << 1,
+        IT_FIELDBASED = 1 << 2
+    };
+
+    bool HasVideo() const { return width != 0; }
+    bool IsPlanar() const { return true; }
+    bool IsRGB() const { return false; }
+    bool IsY() const { return pixel_type == CS_Y8; }
+    int NumComponents() const { return (IsY()) ? 1 : 3; }
+    int BitsPerComponent() const { return (IsY()) ? 8 : bits_per_component; }
+    int ComponentSize() const { return (BitsPerComponent() == 8) ? 1 : (BitsPerComponent() == 32) ? 4 : 2; }
+    int GetPlaneWidthSubsampling(int plane) const { return (plane == PLANAR_Y) ? 0 : subsampling_w; }
+    int GetPlaneHeightSubsampling(int plane) const { return (plane == PLANAR_Y) ? 0 : subsampling_h; }
+
+    bool IsSameColorspace(const VideoInfo& v) const
+    {
+        return v.pixel_type == pixel_type && v.bits_per_component == bits_per_component && v.subsampling_w == subsampling_w && v.subsampling_h == subsampling_h;
+    }
+
+    bool IsFieldBased() const { return !!(image_type & IT_FIELDBASED); }
+    bool IsTFF() const { return !!(image_type & IT_TFF); }
+    bool IsBFF() const { return !!(image_type & IT_BFF); }
+    void SetFieldBased(bool isfieldbased) { if (isfieldbased) image_type |= IT_FIELDBASED; else image_type &= ~IT_FIELDBASED; }
+};
+
+struct AVSMap
+{
+    struct Value
+    {
+        char type; // 'i', 'f' or 's'
+        int64_t i;
+        double f;
+        std::string s;
+    };
+
+    std::map<std::string, std::vector<Value>> values;
+};
+
+class VideoFrame
+{
+    struct Plane
+    {
+        std::vector<uint8_t> data;
+        uint8_t* ptr;
+        int pitch;
+        int row_size;
+        int height;
+    };
+
+    Plane planes[3];
+    std::shared_ptr<const void> owner;
+
+    static int index(int plane) { return (plane == PLANAR_U) ? 1 : (plane == PLANAR_V) ? 2 : 0; }
+
+public:
+    AVSMap properties;
+
+    VideoFrame(const VideoInfo& vi, int align)
+    {
+        const int plane_ids[3] = { PLANAR_Y, PLANAR_U, PLANAR_V };
+
+        for (int i = 0; i < 3; ++i)
+        {
+            Plane& p = planes[i];
+            p.row_size = (i < vi.NumComponents()) ? (vi.width >> vi.GetPlaneWidthSubsampling(plane_ids[i])) * vi.ComponentSize() : 0;
+            p.height = (i < vi.NumComponents()) ? vi.height >> vi.GetPlaneHeightSubsampling(plane_ids[i]) : 0;
+            p.pitch = (p.row_size + align - 1) / align * align;
+            p.data.resize(static_cast<size_t>(p.pitch) * p.height + align);
+            p.ptr = p.data.data() + (align - reinterpret_cast<uintptr_t>(p.data.data()) % align) % align;
+        }
+    }
+
+    // A frame over memory it doesn't own, like a memory-mapped file: the planes one after the other without padding.
+    // _owner keeps the memory alive as long as the frame.
+    VideoFrame(const VideoInfo& vi, const uint8_t* data, std::shared_ptr<const void> _owner) : owner(std::move(_owner))
+    {
+        const int plane_ids[3] = { PLANAR_Y, PLANAR_U, PLANAR_V };
+
+        for (int i = 0; i < 3; ++i)
+        {
+            Plane& p = planes[i];
+            p.row_size = (i < vi.NumComponents()) ? (vi.width >> vi.GetPlaneWidthSubsampling(plane_ids[i])) * vi.ComponentSize() : 0;
+            p.height = (i < vi.NumComponents()) ? vi.height >> vi.GetPlaneHeightSubsampling(plane_ids[i]) : 0;
+            p.pitch = p.row_size;
+            p.ptr = const_cast<uint8_t*>(data);
+            data += static_cast<size_t>(p.pitch) * p.height;
+        }
+    }
+
+    const uint8_t* GetReadPtr(int plane = 0) const { return planes[index(plane)].ptr; }
+    uint8_t* GetWritePtr(int plane = 0) { return planes[index(plane)].ptr; }
+    int GetPitch(int plane = 0) const { return planes[index(plane)].pitch; }
+    int GetRowSize(int plane = 0) const { return planes[index(plane)].row_size; }
+    int GetHeight(int plane = 0) const { return planes[index(plane)].height; }
+    bool IsWritable() const { return true; }
+};
+
+class PVideoFrame
+{
+    std::shared_ptr<VideoFrame> p;
+
+public:
+    PVideoFrame() {}
+    PVideoFrame(VideoFrame* frame) : p(frame) {}
+
+    VideoFrame* operator->() const { return p.get(); }
+    explicit operator bool() const { return !!p; }
+    bool operator!() const { return !p; }
+};
+
+class IClip
+{
+public:
+    virtual ~IClip() {}
+
+    virtual PVideoFrame __stdcall GetFrame(int n, IScriptEnvironment* env) = 0;
+    virtual bool __stdcall GetParity(int n) = 0;
+    virtual const VideoInfo& __stdcall GetVideoInfo() = 0;
+    virtual int __stdcall SetCacheHints(int cachehints, int frame_range) = 0;
+};
+
+class PClip
+{
+    std::shared_ptr<IClip> p;
+
+public:
+    PClip() {}
+    PClip(IClip* clip) : p(clip) {}
+
+    IClip* operator->() const { return p.get(); }
+    explicit operator bool() const { return !!p; }
+    bool operator!() const { return !p; }
+};
+
+class GenericVideoFilter : public IClip
+{
+protected:
+    PClip child;
+    VideoInfo vi;
+
+public:
+    GenericVideoFilter(PClip _child) : child(_child) { vi = child->GetVideoInfo(); }
+
+    PVideoFrame __stdcall GetFrame(int n, IScriptEnvironment* env) override { return child->GetFrame(n, env); }
+    bool __stdcall GetParity(int n) override { return child->GetParity(n); }
+    const VideoInfo& __stdcall GetVideoInfo() override { return vi; }
+    int __stdcall SetCacheHints(int cachehints, int frame_range) override { return 0; }
+};
+
+class AVSValue
+{
+    char type;
+    PClip clip;
+    bool boolean;
+    int integer;
+    double floating_pt;
+    std::string string;
+    std::vector<AVSValue> array;
+
+public:
+    AVSValue() : type('v'), boolean(false), integer(0), floating_pt(0.0) {}
+    AVSValue(IClip* c) : AVSValue() { type = 'c'; clip = c; }
+    AVSValue(const PClip& c) : AVSValue() { type = 'c'; clip = c; }
+    AVSValue(bool b) : AVSValue() { type = 'b'; boolean = b; }
+    AVSValue(int i) : AVSValue() { type = 'i'; integer = i; }
+    AVSValue(float f) : AVSValue() { type = 'f'; floating_pt = f; }
+    AVSValue(double f) : AVSValue() { type = 'f'; floating_pt = f; }
+    AVSValue(const char* s) : AVSValue() { type = 's'; string = s; }
+    AVSValue(const AVSValue* a, int size) : AVSValue() { type = 'a'; array.assign(a, a + size); }
+
+    bool Defined() const { return type != 'v'; }
+    bool IsClip() const { return type == 'c'; }
+    bool IsBool() const { return type == 'b'; }
+    bool IsInt() const { return type == 'i'; }
+    bool IsFloat() const { return type == 'f' || type == 'i'; }
+    bool IsString() const { return type == 's'; }
+    bool IsArray() const { return type == 'a'; }
+
+    PClip AsClip() const { return clip; }
+    bool AsBool(bool def) const { return (type == 'b') ? boolean : def; }
+    int AsInt(int def) const { return (type == 'i') ? integer : def; }
+    double AsFloat(float def) const { return (type == 'f') ? floating_pt : (type == 'i') ? integer : def; }
+    float AsFloatf(float def) const { return static_cast<float>(AsFloat(def)); }
+    const char* AsString(const char* def) const { return (type == 's') ? string.c_str() : def; }
+
+    int ArraySize() const { return static_cast<int>(array.size()); }
+
+    const AVSValue& operator[](int index) const
+    {
+        static const AVSValue undefined;
+        return (index >= 0 && index < static_cast<int>(array.size())) ? array[index] : undefined;
+    }
+};
+
+// A single-process script environment: registered functions can be invoked by name, frames live in memory.
+class IScriptEnvironment
+{
+public:
+    typedef AVSValue(__cdecl* ApplyFunc)(AVSValue args, void* user_data, IScriptEnvironment* env);
+
+    class NotFound {};
+
+private:
+    struct Function
+    {
+        std::string params;
+        ApplyFunc apply;
+        void* user_data;
+    };
+
+    std::map<std::string, Function> functions;
+    std::deque<std::string> errors;
+    std::mutex errors_mtx;
+
+    int interface_version;
+    int cpu_flags;
+    size_t filterchain_threads;
+
+    static int detectCPUFlags()
+    {
+        int flags = 0;
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+        __builtin_cpu_init();
+
+        if (__builtin_cpu_supports("sse2"))
+            flags |= CPUF_SSE2;
+        if (__builtin_cpu_supports("sse4.1"))
+            flags |= CPUF_SSE4_1;
+        if (__builtin_cpu_supports("avx2"))
+            flags |= CPUF_AVX2;
+        if (__builtin_cpu_supports("avx512f"))
+            flags |= CPUF_AVX512F;
+        if (__builtin_cpu_supports("avx512bw"))
+            flags |= CPUF_AVX512BW;
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+        int regs[4];
+        __cpuid(regs, 1);
+
+        if (regs[3] & (1 << 26))
+            flags |= CPUF_SSE2;
+        if (regs[2] & (1 << 19))
+            flags |= CPUF_SSE4_1;
+
+        const unsigned long long xcr0 = (regs[2] & (1 << 27)) ? _xgetbv(0) : 0;
+
+        __cpuidex(regs, 7, 0);
+
+        if ((regs[1] & (1 << 5)) && (xcr0 & 0x6) == 0x6)
+            flags |= CPUF_AVX2;
+        if ((xcr0 & 0xE6) == 0xE6)
+        {
+            if (regs[1] & (1 << 16))
+                flags |= CPUF_AVX512F;
+            if (regs[1] & (1 << 30))
+                flags |= CPUF_AVX512BW;
+        }
+#endif
+
+        return flags;
+    }
+
+    static const AVSMap::Value* getProp(const AVSMap* map, const char* key, int index, char type, int* error)
+    {
+        int dummy;
+        if (!error)
+            error = &dummy;
+
+        *error = 0;
+
+        auto it = map->values.find(key);
+        if (it == map->values.end())
+            *error = GETPROPERROR_UNSET;
+        else if (index < 0 || index >= static_cast<int>(it->second.size()))
+            *error = GETPROPERROR_INDEX;
+        else if (it->second[index].type != type)
+            *error = GETPROPERROR_TYPE;
+        else
+            return &it->second[index];
+
+        return nullptr;
+    }
+
+    static int setProp(AVSMap* map, const char* key, const AVSMap::Value& value, int append)
+    {
+        std::vector<AVSMap::Value>& values = map->values[key];
+
+        if (append == PROPAPPENDMODE_REPLACE)
+            values.clear();
+        if (append != PROPAPPENDMODE_TOUCH)
+            values.push_back(value);
+
+        return 0;
+    }
+
+public:
+    IScriptEnvironment()
+        : interface_version(8), cpu_flags(detectCPUFlags()), filterchain_threads(1)
+    {
+    }
+
+    virtual ~IScriptEnvironment() {}
+
+    // Hooks for the host: pretend to be an older interface, mask cpu features or simulate Prefetch.
+    void SetInterfaceVersion(int version) { interface_version = version; }
+    void SetCPUFlags(int flags) { cpu_flags = flags; }
+    void SetFilterChainThreads(size_t threads) { filterchain_threads = threads; }
+
+    [[noreturn]] void ThrowError(const char* fmt, ...)
+    {
+        char buf[1024];
+        va_list args;
+        va_start(args, fmt);
+        vsnprintf(buf, sizeof(buf), fmt, args);
+        va_end(args);
+
+        // The message must outlive the exception, like the strings AviSynth keeps for the script's lifetime.
+        std::lock_guard<std::mutex> lock(errors_mtx);
+        errors.emplace_back(buf);
+        throw AvisynthError(errors.back().c_str());
+    }
+
+    int GetCPUFlags() { return cpu_flags; }
+
+    void CheckVersion(int version)
+    {
+        if (version > interface_version)
+            ThrowError("Plugin was designed for a later version of Avisynth (%d)", version);
+    }
+
+    size_t GetEnvProperty(AvsEnvProperty prop)
+    {
+        switch (prop)
+        {
+            case AEP_FILTERCHAIN_THREADS: return filterchain_threads;
+            case AEP_VERSION: return interface_version;
+            default: return 0;
+        }
+    }
+
+    void BitBlt(uint8_t* dstp, int dst_pitch, const uint8_t* srcp, int src_pitch, int row_size, int height)
+    {
+        for (int y = 0; y < height; ++y)
+            memcpy(dstp + static_cast<int64_t>(y) * dst_pitch, srcp + static_cast<int64_t>(y) * src_pitch, row_size);
+    }
+
+    PVideoFrame NewVideoFrame(const VideoInfo& vi, int align = 64)
+    {
+        return new VideoFrame(vi, align);
+    }
+
+    PVideoFrame NewVideoFrameP(const VideoInfo& vi, const PVideoFrame* prop_src, int align = 64)
+    {
+        PVideoFrame frame = NewVideoFrame(vi, align);
+
+        if (prop_src && *prop_src)
+            frame->properties = (*prop_src)->properties;
+
+        return frame;
+    }
+
+    void AddFunction(const char* name, const char* params, ApplyFunc apply, void* user_data)
+    {
+        functions[name] = { params, apply, user_data };
+    }
+
+    bool FunctionExists(const char* name) { return functions.count(name) != 0; }
+
+    // The parameters a function was registered with, like the "$Plugin!name!Param$" variable of AviSynth+.
+    const char* GetFunctionParams(const char* name)
+    {
+        auto it = functions.find(name);
+        return (it == functions.end()) ? nullptr : it->second.params.c_str();
+    }
+
+    // Arguments are passed by position, named arguments are not supported.
+    AVSValue Invoke(const char* name, const AVSValue args, const char* const* arg_names = nullptr)
+    {
+        auto it = functions.find(name);
+        if (it == functions.end())
+            throw NotFound();
+
+        return it->second.apply((args.IsArray()) ? args : AVSValue(&args, 1), it->second.user_data, this);
+    }
+
+    const AVSMap* getFramePropsRO(const PVideoFrame& frame) { return &frame->properties; }
+    AVSMap* getFramePropsRW(PVideoFrame& frame) { return &frame->properties; }
+
+    int propNumElements(const AVSMap* map, const char* key)
+    {
+        auto it = map->values.find(key);
+        return (it == map->values.end()) ? -1 : static_cast<int>(it->second.size());
+    }
+
+    int propDeleteKey(AVSMap* map, const char* key) { return static_cast<int>(map->values.erase(key)); }
+
+    int64_t propGetInt(const AVSMap* map, const char* key, int index, int* error)
+    {
+        const AVSMap::Value* v = getProp(map, key, index, 'i', error);
+        return (v) ? v->i : 0;
+    }
+
+    double propGetFloat(const AVSMap* map, const char* key, int index, int* error)
+    {
+        const AVSMap::Value* v = getProp(map, key, index, 'f', error);
+        return (v) ? v->f : 0.0;
+    }
+
+    const char* propGetData(const AVSMap* map, const char* key, int index, int* error)
+    {
+        const AVSMap::Value* v = getProp(map, key, index, 's', error);
+        return (v) ? v->s.c_str() : nullptr;
+    }
+
+    int propGetDataSize(const AVSMap* map, const char* key, int index, int* error)
+    {
+        const AVSMap::Value* v = getProp(map, key, index, 's', error);
+        return (v) ? static_cast<int>(v->s.size()) : 0;
+    }
+
+    int propSetInt(AVSMap* map, const char* key, int64_t i, int append)
+    {
+        return setProp(map, key, { 'i', i, 0.0, std::string() }, append);
+    }
+
+    int propSetFloat(AVSMap* map, const char* key, double d, int append)
+    {
+        return setProp(map, key, { 'f', 0, d, std::string() }, append);
+    }
+
+    int propSetData(AVSMap* map, const char* key, const char* d, int length, int append)
+    {
+        return setProp(map, key, { 's', 0, 0.0, std::string(d, (length < 0) ? strlen(d) : length) }, append);
+    }
+};
+
+extern "C" const char* __stdcall AvisynthPluginInit3(IScriptEnvironment* env, const AVS_Linkage* const vectors);
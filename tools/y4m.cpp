@@ -0,0 +1,438 @@
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "y4m.h"
+
+struct Y4MClip::Mapping
+{
+    void* data = MAP_FAILED;
+    size_t size = 0;
+
+    ~Mapping()
+    {
+        if (data != MAP_FAILED)
+            munmap(data, size);
+    }
+};
+
+// The C parameter: 4:2:0 comes with several chroma sitings, all of them 8-bit.
+static bool parseColorspace(const std::string& c, VideoInfo& vi)
+{
+    static const struct { const char* name; int ssw, ssh; } layouts[] = { { "420", 1, 1 }, { "422", 1, 0 }, { "444", 0, 0 }, { "411", 2, 0 } };
+
+    for (const auto& l : layouts)
+    {
+        if (c.compare(0, 3, l.name))
+            continue;
+
+        const std::string depth = c.substr(3);
+        vi.subsampling_w = l.ssw;
+        vi.subsampling_h = l.ssh;
+
+        if (depth.empty() || (l.ssh == 1 && (depth == "jpeg" || depth == "paldv" || depth == "mpeg2")))
+            vi.bits_per_component = 8;
+        else if (depth == "p9" || depth == "p10" || depth == "p12" || depth == "p14" || depth == "p16")
+            vi.bits_per_component = atoi(depth.c_str() + 1);
+        else
+            return false;
+
+        return true;
+    }
+
+    return false;
+}
+
+void Y4MClip::parseHeader()
+{
+    std::istringstream tokens(header_line);
+    std::string token;
+
+    if (!(tokens >> token) || token != "YUV4MPEG2")
+        throw std::runtime_error(name + ": not a YUV4MPEG2 stream.");
+
+    field_order = -1;
+
+    while (tokens >> token)
+    {
+        const char* value = token.c_str() + 1;
+
+        switch (token[0])
+        {
+            case 'W': vi.width = atoi(value); break;
+            case 'H': vi.height = atoi(value); break;
+            case 'F':
+            {
+                unsigned num, den;
+                if (sscanf(value, "%u:%u", &num, &den) == 2 && num && den)
+                {
+                    vi.fps_numerator = num;
+                    vi.fps_denominator = den;
+                }
+                break;
+            }
+            case 'I':
+                vi.image_type = (value[0] == 't') ? VideoInfo::IT_TFF : (value[0] == 'b') ? VideoInfo::IT_BFF : 0;
+                field_order = (value[0] == 'p') ? 0 : (value[0] == 't' || value[0] == 'b') ? 1 : -1;
+                break;
+            case 'C':
+                if (!parseColorspace(value, vi))
+                    throw std::runtime_error(name + ": C" + value + " isn't supported, the frames must be YUV with 3 planes.");
+                break;
+        }
+    }
+
+    if (vi.width <= 0 || vi.height <= 0 || vi.width % (1 << vi.subsampling_w) || vi.height % (1 << vi.subsampling_h))
+        throw std::runtime_error(name + ": W and H must be given and be multiples of the chroma subsampling.");
+
+    const size_t luma = static_cast<size_t>(vi.width) * vi.height;
+    frame_size = (luma + 2 * (luma >> (vi.subsampling_w + vi.subsampling_h))) * vi.ComponentSize();
+}
+
+Y4MClip::Y4MClip(const char* path)
+    : name(path), field_order(-1), frame_size(0), fd(-1), wake{ -1, -1 }, read_frames(0), released(0), eof(true), stop(false)
+{
+    auto m = std::make_shared<Mapping>();
+
+    const int file = open(path, O_RDONLY);
+    if (file == -1)
+        throw std::runtime_error("cannot open " + name + ".");
+
+    struct stat st;
+    if (!fstat(file, &st) && S_ISREG(st.st_mode) && st.st_size > 0)
+    {
+        m->size = static_cast<size_t>(st.st_size);
+        m->data = mmap(nullptr, m->size, PROT_READ, MAP_PRIVATE, file, 0);
+    }
+
+    ::close(file);
+
+    if (m->data == MAP_FAILED)
+        throw std::runtime_error("cannot map " + name + ", it must be a regular file that isn't empty.");
+
+    madvise(m->data, m->size, MADV_SEQUENTIAL);
+    mapping = m;
+
+    const char* data = static_cast<const char*>(m->data);
+    const char* nl = static_cast<const char*>(memchr(data, '\n', m->size));
+    if (!nl)
+        throw std::runtime_error(name + ": not a YUV4MPEG2 stream.");
+
+    header_line.assign(data, nl);
+    parseHeader();
+
+    //the frame headers may carry parameters, so every one of them is looked at once
+    for (size_t pos = nl - data + 1; pos < m->size;)
+    {
+        const std::string frame = name + ": frame " + std::to_string(frame_offsets.size());
+
+        nl = static_cast<const char*>(memchr(data + pos, '\n', m->size - pos));
+        if (m->size - pos < 5 || memcmp(data + pos, "FRAME", 5) || !nl)
+            throw std::runtime_error(frame + " has no FRAME header.");
+
+        pos = nl - data + 1;
+        if (m->size - pos < frame_size)
+            throw std::runtime_error(frame + " is truncated.");
+
+        frame_offsets.push_back(pos);
+        pos += frame_size;
+    }
+
+    if (frame_offsets.empty() || frame_offsets.size() > static_cast<size_t>(unknown_length))
+        throw std::runtime_error(name + ": no frames, or too many of them.");
+
+    vi.num_frames = static_cast<int>(frame_offsets.size());
+}
+
+Y4MClip::Y4MClip(int _fd, int num_frames, int slots)
+    : name("input"), field_order(-1), frame_size(0), fd(_fd), wake{ -1, -1 }, read_frames(0), released(0), eof(false), stop(false)
+{
+    if (pipe(wake))
+        throw std::runtime_error("cannot create a pipe.");
+
+    try
+    {
+        char c;
+        while (readStream(&c, 1) == 1 && c != '\n')
+        {
+            header_line += c;
+            if (header_line.size() > 4096)
+                break;
+        }
+
+        parseHeader();
+    }
+    catch (...)
+    {
+        ::close(wake[0]);
+        ::close(wake[1]);
+        throw;
+    }
+
+    vi.num_frames = (num_frames > 0) ? num_frames : unknown_length;
+
+    buffer.reset(new uint8_t[frame_size * slots], std::default_delete<uint8_t[]>());
+    for (int i = 0; i < slots; ++i)
+        ring.emplace_back(new VideoFrame(vi, buffer.get() + frame_size * i, buffer));
+
+    reader = std::thread(&Y4MClip::readFrames, this);
+}
+
+Y4MClip::~Y4MClip()
+{
+    if (reader.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            stop = true;
+        }
+
+        cv.notify_all();
+
+        //wakes the reader up if it is waiting for the pipe
+        const char c = 0;
+        const ssize_t woken = write(wake[1], &c, 1);
+        (void)woken;
+
+        reader.join();
+    }
+
+    if (wake[0] != -1)
+    {
+        ::close(wake[0]);
+        ::close(wake[1]);
+    }
+}
+
+// Reads up to size bytes, less only at the end of the stream or when the clip is destroyed.
+size_t Y4MClip::readStream(void* data, size_t size)
+{
+    size_t done = 0;
+
+    while (done < size)
+    {
+        pollfd fds[2] = { { fd, POLLIN, 0 }, { wake[0], POLLIN, 0 } };
+        if (poll(fds, 2, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            throw std::runtime_error("cannot read " + name + ".");
+        }
+
+        if (fds[1].revents)
+            break;
+
+        const ssize_t got = read(fd, static_cast<uint8_t*>(data) + done, size - done);
+        if (got == 0)
+            break;
+
+        if (got < 0)
+        {
+            if (errno == EINTR || errno == EAGAIN)
+                continue;
+
+            throw std::runtime_error("cannot read " + name + ".");
+        }
+
+        done += got;
+    }
+
+    return done;
+}
+
+void Y4MClip::readFrames()
+{
+    const int slots = static_cast<int>(ring.size());
+
+    for (int n = 0;; ++n)
+    {
+        //frame n goes into the slot of frame n - slots
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            cv.wait(lock, [&]() { return stop || n < released + slots; });
+
+            if (stop)
+                return;
+        }
+
+        std::string error;
+        bool end = false;
+
+        try
+        {
+            const std::string frame = name + ": frame " + std::to_string(n);
+            char tag[6];
+            const size_t got = readStream(tag, sizeof(tag));
+
+            if (got == 0)
+                end = true;
+            else
+            {
+                if (got < sizeof(tag) || memcmp(tag, "FRAME", 5))
+                    throw std::runtime_error(frame + " has no FRAME header.");
+
+                //the parameters of the frame header are skipped
+                for (char c = tag[5]; c != '\n';)
+                    if (readStream(&c, 1) != 1)
+                        throw std::runtime_error(frame + " is truncated.");
+
+                if (readStream(buffer.get() + frame_size * (n % slots), frame_size) != frame_size)
+                    throw std::runtime_error(frame + " is truncated.");
+            }
+        }
+        catch (const std::exception& e)
+        {
+            error = e.what();
+            end = true;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+
+            if (end)
+            {
+                eof = true;
+                read_error = error;
+            }
+            else
+                read_frames = n + 1;
+        }
+
+        cv.notify_all();
+
+        if (end)
+            return;
+    }
+}
+
+bool Y4MClip::hasFrame(int n)
+{
+    if (mapping)
+        return n < vi.num_frames;
+
+    std::unique_lock<std::mutex> lock(mtx);
+    cv.wait(lock, [&]() { return n < read_frames || eof; });
+
+    if (n < read_frames)
+        return true;
+
+    if (!read_error.empty())
+        throw std::runtime_error(read_error);
+
+    return false;
+}
+
+void Y4MClip::release(int n)
+{
+    if (mapping)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        released = std::max(released, n);
+    }
+
+    cv.notify_all();
+}
+
+PVideoFrame __stdcall Y4MClip::GetFrame(int n, IScriptEnvironment* env)
+{
+    n = std::max(n, 0);
+
+    if (mapping)
+        return new VideoFrame(vi, static_cast<const uint8_t*>(mapping->data) + frame_offsets[std::min(n, vi.num_frames - 1)], mapping);
+
+    std::unique_lock<std::mutex> lock(mtx);
+
+    if (n < released)
+        env->ThrowError("%s: frame %d was requested after it was released.", name.c_str(), n);
+
+    cv.wait(lock, [&]() { return n < read_frames || eof; });
+
+    if (n >= read_frames)
+    {
+        if (!read_error.empty())
+            env->ThrowError("%s", read_error.c_str());
+        if (read_frames == 0)
+            env->ThrowError("%s: no frames.", name.c_str());
+
+        n = read_frames - 1;
+    }
+
+    return ring[n % ring.size()];
+}
+
+static bool writeAll(int fd, iovec* iov, size_t count)
+{
+    while (count)
+    {
+        const ssize_t written = writev(fd, iov, static_cast<int>(std::min<size_t>(count, IOV_MAX)));
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            return false;
+        }
+
+        size_t left = static_cast<size_t>(written);
+        while (count && left >= iov->iov_len)
+        {
+            left -= iov->iov_len;
+            ++iov;
+            --count;
+        }
+
+        if (count)
+        {
+            iov->iov_base = static_cast<uint8_t*>(iov->iov_base) + left;
+            iov->iov_len -= left;
+        }
+    }
+
+    return true;
+}
+
+bool writeY4M(int fd, const void* data, size_t size)
+{
+    iovec iov = { const_cast<void*>(data), size };
+    return writeAll(fd, &iov, 1);
+}
+
+bool writeY4MFrame(int fd, const PVideoFrame& frame)
+{
+    static const char tag[] = "FRAME\n";
+    const int planes[3] = { PLANAR_Y, PLANAR_U, PLANAR_V };
+
+    std::vector<iovec> iov = { { const_cast<char*>(tag), sizeof(tag) - 1 } };
+
+    //a plane without padding goes in one piece
+    for (int p : planes)
+    {
+        uint8_t* ptr = const_cast<uint8_t*>(frame->GetReadPtr(p));
+        const int pitch = frame->GetPitch(p);
+        const size_t row_size = frame->GetRowSize(p);
+        const int height = frame->GetHeight(p);
+
+        if (pitch == static_cast<int>(row_size))
+            iov.push_back({ ptr, row_size * height });
+        else
+            for (int y = 0; y < height; ++y)
+                iov.push_back({ ptr + static_cast<int64_t>(y) * pitch, row_size });
+    }
+
+    return writeAll(fd, iov.data(), iov.size());
+}
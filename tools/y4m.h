@@ -0,0 +1,81 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "avisynth.h"
+
+// A YUV4MPEG2 file or stream as a clip, for bifrost_y4m. Errors are reported with std::runtime_error, and with ThrowError from GetFrame.
+// A file is memory-mapped and its frames point into the mapping, nothing is copied.
+// A stream (a pipe) is read by a thread of its own, ahead of the requests, into a ring of frames allocated once:
+// a frame can be requested until release() is called past it, only then is its slot refilled.
+// The length of a stream isn't known in advance, frames past its end repeat the last one.
+class Y4MClip : public IClip
+{
+    struct Mapping;
+
+    VideoInfo vi;
+    std::string name;
+    std::string header_line;
+    int field_order;
+    size_t frame_size;
+
+    //file
+    std::shared_ptr<const Mapping> mapping;
+    std::vector<size_t> frame_offsets;
+
+    //stream
+    int fd;
+    int wake[2];
+    std::shared_ptr<uint8_t> buffer;
+    std::vector<PVideoFrame> ring;
+    int read_frames;
+    int released;
+    bool eof;
+    bool stop;
+    std::string read_error;
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::thread reader;
+
+    void parseHeader();
+    size_t readStream(void* data, size_t size);
+    void readFrames();
+
+public:
+    // Length of a stream whose length isn't given.
+    static constexpr int unknown_length = 1 << 24;
+
+    // Maps the file at path.
+    explicit Y4MClip(const char* path);
+    // Reads the stream from _fd into slots frames. num_frames is its length if known, 0 otherwise.
+    Y4MClip(int _fd, int num_frames, int slots);
+    ~Y4MClip();
+
+    Y4MClip(const Y4MClip&) = delete;
+    Y4MClip& operator=(const Y4MClip&) = delete;
+
+    // The header line, without the newline.
+    const std::string& header() const { return header_line; }
+    // -1: not given or mixed, 0: progressive, 1: interlaced.
+    int interlacing() const { return field_order; }
+    // Whether frame n exists, waiting for it to be read.
+    bool hasFrame(int n);
+    // The frames before n won't be requested anymore.
+    void release(int n);
+
+    PVideoFrame __stdcall GetFrame(int n, IScriptEnvironment* env) override;
+    bool __stdcall GetParity(int n) override { return vi.IsTFF(); }
+    const VideoInfo& __stdcall GetVideoInfo() override { return vi; }
+    int __stdcall SetCacheHints(int cachehints, int frame_range) override { return 0; }
+};
+
+// Writes size bytes to fd. Returns false on an error, with errno set.
+bool writeY4M(int fd, const void* data, size_t size);
+// Writes the frame header and the planes of frame to fd, straight from the frame.
+bool writeY4MFrame(int fd, const PVideoFrame& frame);